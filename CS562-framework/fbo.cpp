@@ -11,93 +11,86 @@
 using namespace gl;
 
 #include "fbo.h"
+#include "rendertarget.h"
 #include "texture.h"
 #include "stb_image.h"
 
-void FBO::CreateFBO(const int w, const int h)
+// Attaches a pooled texture to the bound framebuffer.
+unsigned int FBO::Attach(const GLenum internalFormat, const GLenum attachment)
+{
+    unsigned int id = pool->Acquire((int)internalFormat, width, height);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, id, 0);
+    return id;
+}
+
+void FBO::CreateFBO(const int w, const int h, const bool _packed)
 {
     width = w;
     height = h;
+    packed = _packed;
     
     glGenFramebuffersEXT(1, &fboID);
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fboID);
-
-    // Create a render buffer, and attach it to FBO's depth attachment
-    unsigned int depthBuffer;
-    glGenRenderbuffersEXT(1, &depthBuffer);
-    glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, depthBuffer);
-    glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_DEPTH_COMPONENT,
-                             width, height);
-    glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT,
-                                 GL_RENDERBUFFER_EXT, depthBuffer);
-
-    // Create a texture and attach FBO's color 0 attachment.  The
-    // GL_RGBA32F and GL_RGBA constants set this texture to be 32 bit
-    // floats for each of the 4 components.  Many other choices are
-    // possible.
-    glGenTextures(1, &gPosition);
-    glBindTexture(GL_TEXTURE_2D, gPosition);
-    glTexImage2D(GL_TEXTURE_2D, 0, (int)GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, (int)GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, (int)GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, (int)GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, (int)GL_LINEAR);
-    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT,
-                              GL_TEXTURE_2D, gPosition, 0);
-
-    glGenTextures(1, &gNormal);
-    glBindTexture(GL_TEXTURE_2D, gNormal);
-    glTexImage2D(GL_TEXTURE_2D, 0, (int)GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, (int)GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, (int)GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, (int)GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, (int)GL_LINEAR);
-    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT1_EXT,
-        GL_TEXTURE_2D, gNormal, 0);
+    AttachTargets();
+}
 
-    glGenTextures(1, &gDiffuse);
-    glBindTexture(GL_TEXTURE_2D, gDiffuse);
-    glTexImage2D(GL_TEXTURE_2D, 0, (int)GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, (int)GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, (int)GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, (int)GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, (int)GL_LINEAR);
-    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT2_EXT,
-        GL_TEXTURE_2D, gDiffuse, 0);
+// (Re)attaches a full set of targets of the current size and layout.
+void FBO::AttachTargets()
+{
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fboID);
 
-    glGenTextures(1, &gSpecular);
-    glBindTexture(GL_TEXTURE_2D, gSpecular);
-    glTexImage2D(GL_TEXTURE_2D, 0, (int)GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, (int)GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, (int)GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, (int)GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, (int)GL_LINEAR);
-    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT3_EXT,
-        GL_TEXTURE_2D, gSpecular, 0);
+    // Depth (and stencil, so it blits to the default framebuffer's
+    // depth-stencil buffer).  A texture, so the packed layout can
+    // reconstruct position from it.
+    gDepth = Attach(GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL_ATTACHMENT);
 
+    if (packed) {
+        gNormal = Attach(GL_RG16, GL_COLOR_ATTACHMENT0);
+        gDiffuse = Attach(GL_RGBA8, GL_COLOR_ATTACHMENT1);
+        GLenum bufs[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        glDrawBuffers(2, bufs); }
+    else {
+        // The GL_RGBA32F format makes these textures 32 bit floats
+        // for each of the 4 components.
+        gPosition = Attach(GL_RGBA32F, GL_COLOR_ATTACHMENT0);
+        gNormal = Attach(GL_RGBA32F, GL_COLOR_ATTACHMENT1);
+        gDiffuse = Attach(GL_RGBA32F, GL_COLOR_ATTACHMENT2);
+        gSpecular = Attach(GL_RGBA32F, GL_COLOR_ATTACHMENT3);
+        GLenum bufs[4] = { GL_COLOR_ATTACHMENT0_EXT , GL_COLOR_ATTACHMENT1_EXT , GL_COLOR_ATTACHMENT2_EXT , GL_COLOR_ATTACHMENT3_EXT };
+        glDrawBuffers(4, bufs); }
 
     // Check for completeness/correctness
     int status = (int)glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
     if (status != int(GL_FRAMEBUFFER_COMPLETE_EXT))
         printf("FBO Error: %d\n", status);
-
-    GLenum bufs[4] = { GL_COLOR_ATTACHMENT0_EXT , GL_COLOR_ATTACHMENT1_EXT , GL_COLOR_ATTACHMENT2_EXT , GL_COLOR_ATTACHMENT3_EXT };
-    glDrawBuffers(4, bufs);
-    // 
-    unsigned int rbo;
-    glGenRenderbuffers(1, &rbo);
-    glBindRenderbuffer(GL_RENDERBUFFER, rbo);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, width, height);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rbo);
-    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-        printf( "ERROR::FRAMEBUFFER:: Framebuffer is not completed\n");
     glBindFramebuffer(GL_FRAMEBUFFER_EXT, 0);
 }
 
+void FBO::ReleaseTargets()
+{
+    pool->Release(gPosition);
+    pool->Release(gNormal);
+    pool->Release(gDiffuse);
+    pool->Release(gSpecular);
+    pool->Release(gDepth);
+    gPosition = gNormal = gDiffuse = gSpecular = gDepth = 0;
+}
+
+void FBO::Resize(const int w, const int h)
+{
+    if ((w == width && h == height) || w == 0 || h == 0) return;
+    width = w;
+    height = h;
+    ReleaseTargets();
+    AttachTargets();
+}
+
+void FBO::DeleteFBO()
+{
+    ReleaseTargets();
+    if (fboID) glDeleteFramebuffers(1, &fboID);
+    fboID = 0;
+}
+
 void FBO::BindFBO() { glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fboID); }
 void FBO::UnbindFBO() { glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0); }
 
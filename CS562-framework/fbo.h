@@ -4,18 +4,43 @@
 // output of the graphics pipeline is captured into the texture.  When
 // it is "Unbound", the texture is available for use as any normal
 // texture.
+//
+// Both G-buffer layouts share gDepth, a sampleable DEPTH24_STENCIL8
+// texture, and differ in their color targets:
+//   full:   gPosition, gNormal, gDiffuse, gSpecular, all RGBA32F
+//           (68 bytes per pixel with depth).
+//   packed: gNormal as an octahedral encoded RG16, and gDiffuse as
+//           RGBA8 with the specular value in alpha (12 bytes per pixel
+//           with depth).  The lighting pass reconstructs position
+//           from gDepth.
+// The textures come from a RenderTargetPool, which recycles them on
+// resize and layout changes.
 ////////////////////////////////////////////////////////////////////////
 
+class RenderTargetPool;
+
 class FBO {
 public:
     unsigned int fboID;
-    unsigned int gPosition;
+    unsigned int gPosition;     // Full layout only
     unsigned int gNormal;
     unsigned int gDiffuse;
-    unsigned int gSpecular;
+    unsigned int gSpecular;     // Full layout only
+    unsigned int gDepth;
+    bool packed;
     int width, height, depth;  // Size of the texture.
+    RenderTargetPool* pool;
+
+    FBO(RenderTargetPool* _pool) : fboID(0), gPosition(0), gNormal(0), gDiffuse(0), gSpecular(0),
+                                   gDepth(0), packed(false), width(0), height(0), pool(_pool) {}
+
+    void CreateFBO(const int w, const int h, const bool _packed=false);
 
-    void CreateFBO(const int w, const int h);
+    // Match a new viewport size, swapping in targets of that size.
+    void Resize(const int w, const int h);
+
+    // Free the framebuffer and return its targets to the pool.
+    void DeleteFBO();
     
     // Bind this FBO to receive the output of the graphics pipeline.
     void BindFBO();
@@ -28,4 +53,9 @@ public:
 
     // Unbind this FBO's texture from a texture unit.
     void UnbindTexture(const int unit);
+
+private:
+    unsigned int Attach(const GLenum internalFormat, const GLenum attachment);
+    void AttachTargets();
+    void ReleaseTargets();
 };
@@ -0,0 +1,304 @@
+///////////////////////////////////////////////////////////////////////
+// A small frame graph.  See framegraph.h.
+////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+
+#include <glbinding/gl/gl.h>
+#include <glbinding/Binding.h>
+using namespace gl;
+
+#include "framegraph.h"
+#include "rendertarget.h"
+
+#include <glu.h>                // For gluErrorString
+#define CHECKERROR {GLenum err = glGetError(); if (err != GL_NO_ERROR) { fprintf(stderr, "OpenGL error (at line framegraph.cpp:%d): %s\n", __LINE__, gluErrorString(err)); exit(-1);} }
+
+FrameGraph::FrameGraph(RenderTargetPool* _pool)
+    : passCount(0), culledPasses(0), clears(0), skippedClears(0),
+      stateChanges(0), skippedStateChanges(0), transientTargets(0), reusedTargets(0),
+      pool(_pool), frame(0), currentKnown(false), currentFbo(0)
+{}
+
+void FrameGraph::Reset()
+{
+    resources.clear();
+    passes.clear();
+}
+
+int FrameGraph::CreateTarget(const char* name, const int internalFormat, const int width, const int height)
+{
+    Resource r;
+    r.name = name;
+    r.kind = transientTarget;
+    r.internalFormat = internalFormat;
+    r.width = width;
+    r.height = height;
+    r.depth = internalFormat == (int)GL_DEPTH24_STENCIL8 || internalFormat == (int)GL_DEPTH_COMPONENT24
+        || internalFormat == (int)GL_DEPTH_COMPONENT32F;
+    r.output = false;
+    r.texture = r.fbo = 0;
+    resources.push_back(r);
+    return resources.size()-1;
+}
+
+int FrameGraph::ImportTarget(const char* name, const unsigned int texture, const unsigned int fbo,
+                             const bool depth, const int width, const int height, const bool output)
+{
+    Resource r;
+    r.name = name;
+    r.kind = importedTarget;
+    r.internalFormat = 0;
+    r.width = width;
+    r.height = height;
+    r.depth = depth;
+    r.output = output;
+    r.texture = texture;
+    r.fbo = fbo;
+    resources.push_back(r);
+    return resources.size()-1;
+}
+
+int FrameGraph::ImportBackbuffer(const char* name, const bool depth, const int width, const int height,
+                                 const bool output)
+{
+    int id = ImportTarget(name, 0, 0, depth, width, height, output);
+    resources[id].kind = backbuffer;
+    return id;
+}
+
+int FrameGraph::CreateVirtual(const char* name)
+{
+    int id = ImportTarget(name, 0, 0, false, 0, 0, false);
+    resources[id].kind = virtualResource;
+    return id;
+}
+
+void FrameGraph::AddPass(const char* name, const std::vector<int>& reads, const std::vector<int>& writes,
+                         const std::vector<int>& clears, const PassState& state, std::function<void()> run)
+{
+    Pass p;
+    p.name = name;
+    p.reads = reads;
+    p.writes = writes;
+    p.clears = clears;
+    p.state = state;
+    p.run = run;
+    passes.push_back(p);
+}
+
+unsigned int FrameGraph::Texture(const int resource)
+{
+    return resources[resource].texture;
+}
+
+// Reference counting from the outputs backwards: a resource nobody
+// reads releases its writers, and a pass with no needed writes is
+// culled, which in turn releases what it reads.
+void FrameGraph::Cull()
+{
+    for (size_t r=0;  r<resources.size();  r++)
+        resources[r].refCount = 0;
+    for (size_t p=0;  p<passes.size();  p++) {
+        passes[p].refCount = passes[p].writes.size();
+        passes[p].culled = false;
+        for (size_t i=0;  i<passes[p].reads.size();  i++)
+            resources[passes[p].reads[i]].refCount++; }
+
+    std::vector<int> unused;
+    for (size_t r=0;  r<resources.size();  r++)
+        if (resources[r].refCount == 0 && !resources[r].output)
+            unused.push_back(r);
+
+    culledPasses = 0;
+    while (!unused.empty()) {
+        int r = unused.back();
+        unused.pop_back();
+        for (size_t p=0;  p<passes.size();  p++) {
+            Pass& pass = passes[p];
+            if (pass.culled || std::find(pass.writes.begin(), pass.writes.end(), r) == pass.writes.end())
+                continue;
+            if (--pass.refCount > 0) continue;
+            pass.culled = true;
+            culledPasses++;
+            for (size_t i=0;  i<pass.reads.size();  i++) {
+                Resource& read = resources[pass.reads[i]];
+                if (--read.refCount == 0 && !read.output)
+                    unused.push_back(pass.reads[i]); } } }
+}
+
+// Binds the framebuffer a pass renders to, and sets the viewport to
+// its size.  Passes that write no render target leave both alone.
+unsigned int FrameGraph::BindTargets(const Pass& pass)
+{
+    std::vector<int> targets;
+    for (size_t i=0;  i<pass.writes.size();  i++)
+        if (resources[pass.writes[i]].kind != virtualResource)
+            targets.push_back(pass.writes[i]);
+    if (targets.empty()) return currentFbo;
+
+    unsigned int fbo = 0;
+    bool found = false;
+    for (size_t i=0;  i<targets.size() && !found;  i++)
+        if (resources[targets[i]].kind == backbuffer) {
+            fbo = 0;
+            found = true; }
+    for (size_t i=0;  i<targets.size() && !found;  i++)
+        if (resources[targets[i]].kind == importedTarget) {
+            fbo = resources[targets[i]].fbo;
+            found = true; }
+
+    if (!found) {
+        // All transient: find or build a framebuffer with exactly these attachments.
+        std::vector<unsigned int> attachments;
+        for (size_t i=0;  i<targets.size();  i++)
+            attachments.push_back(resources[targets[i]].texture);
+        for (size_t i=0;  i<framebuffers.size() && !found;  i++)
+            if (framebuffers[i].attachments == attachments) {
+                framebuffers[i].lastUsed = frame;
+                fbo = framebuffers[i].id;
+                found = true; }
+        if (!found) {
+            Framebuffer f;
+            f.attachments = attachments;
+            f.lastUsed = frame;
+            glGenFramebuffers(1, &f.id);
+            glBindFramebuffer(GL_FRAMEBUFFER, f.id);
+            std::vector<GLenum> bufs;
+            for (size_t i=0;  i<targets.size();  i++) {
+                const Resource& r = resources[targets[i]];
+                GLenum attachment = r.internalFormat == (int)GL_DEPTH24_STENCIL8 ? GL_DEPTH_STENCIL_ATTACHMENT
+                    : r.depth ? GL_DEPTH_ATTACHMENT
+                    : (GLenum)((int)GL_COLOR_ATTACHMENT0 + bufs.size());
+                if (!r.depth) bufs.push_back(attachment);
+                glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, r.texture, 0); }
+            if (bufs.empty()) glDrawBuffer(GL_NONE);
+            else glDrawBuffers(bufs.size(), &bufs[0]);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                printf("FrameGraph: framebuffer for pass %s is not complete\n", pass.name.c_str());
+            framebuffers.push_back(f);
+            currentKnown = false; // Force the rebind below
+            fbo = f.id; } }
+
+    if (currentKnown && fbo == currentFbo)
+        skippedStateChanges++;
+    else {
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        stateChanges++; }
+    currentFbo = fbo;
+
+    const Resource& first = resources[targets[0]];
+    glViewport(0, 0, first.width, first.height);
+    return fbo;
+}
+
+void FrameGraph::SetCap(const GLenum cap, const bool want, const bool have)
+{
+    if (currentKnown && want == have) {
+        skippedStateChanges++;
+        return; }
+    if (want) glEnable(cap);
+    else glDisable(cap);
+    stateChanges++;
+}
+
+void FrameGraph::ApplyState(const PassState& state)
+{
+    SetCap(GL_DEPTH_TEST, state.depthTest, current.depthTest);
+    SetCap(GL_BLEND, state.blend, current.blend);
+    SetCap(GL_CULL_FACE, state.cullFace, current.cullFace);
+    if (currentKnown && state.depthWrite == current.depthWrite)
+        skippedStateChanges++;
+    else {
+        glDepthMask(state.depthWrite ? GL_TRUE : GL_FALSE);
+        stateChanges++; }
+    current = state;
+}
+
+void FrameGraph::Execute()
+{
+    frame++;
+    passCount = passes.size();
+    clears = skippedClears = 0;
+    stateChanges = skippedStateChanges = 0;
+    transientTargets = reusedTargets = 0;
+    released.clear();
+    clean.assign(resources.size(), false);
+    // The GUI and anything else between frames may have changed state.
+    currentKnown = false;
+
+    Cull();
+
+    // Lifetimes of the resources over the surviving passes
+    for (size_t r=0;  r<resources.size();  r++)
+        resources[r].firstUse = resources[r].lastUse = -1;
+    for (size_t p=0;  p<passes.size();  p++) {
+        if (passes[p].culled) continue;
+        for (int k=0;  k<2;  k++) {
+            const std::vector<int>& list = k ? passes[p].writes : passes[p].reads;
+            for (size_t i=0;  i<list.size();  i++) {
+                Resource& r = resources[list[i]];
+                if (r.firstUse < 0) r.firstUse = p;
+                r.lastUse = p; } } }
+
+    for (size_t p=0;  p<passes.size();  p++) {
+        Pass& pass = passes[p];
+        if (pass.culled) continue;
+
+        // Transient targets come alive at their first use.
+        for (size_t r=0;  r<resources.size();  r++) {
+            Resource& res = resources[r];
+            if (res.kind != transientTarget || res.firstUse != int(p)) continue;
+            res.texture = pool->Acquire(res.internalFormat, res.width, res.height);
+            transientTargets++;
+            if (std::find(released.begin(), released.end(), res.texture) != released.end())
+                reusedTargets++; }
+
+        BindTargets(pass);
+        ApplyState(pass.state);
+        currentKnown = true;
+
+        // Clear only what has been drawn on since it was last cleared.
+        ClearBufferMask mask = GL_NONE_BIT;
+        for (size_t i=0;  i<pass.clears.size();  i++) {
+            int r = pass.clears[i];
+            if (clean[r]) {
+                skippedClears++;
+                continue; }
+            mask |= resources[r].depth ? GL_DEPTH_BUFFER_BIT : GL_COLOR_BUFFER_BIT;
+            clean[r] = true; }
+        if (mask != GL_NONE_BIT) {
+            if (!current.depthWrite && (mask & GL_DEPTH_BUFFER_BIT) != GL_NONE_BIT) glDepthMask(GL_TRUE);
+            glClear(mask);
+            if (!current.depthWrite) glDepthMask(GL_FALSE);
+            clears++; }
+
+        pass.run();
+        CHECKERROR;
+        for (size_t i=0;  i<pass.writes.size();  i++)
+            clean[pass.writes[i]] = false;
+
+        // Transient targets go back to the pool after their last use,
+        // free for a later pass to reuse.
+        for (size_t r=0;  r<resources.size();  r++) {
+            Resource& res = resources[r];
+            if (res.kind != transientTarget || res.lastUse != int(p)) continue;
+            pool->Release(res.texture);
+            released.push_back(res.texture); } }
+
+    // Framebuffers assembled for transient targets live as long as
+    // they are used every frame; the pool may delete their textures
+    // once they are not.
+    size_t kept = 0;
+    for (size_t i=0;  i<framebuffers.size();  i++) {
+        if (framebuffers[i].lastUsed == frame)
+            framebuffers[kept++] = framebuffers[i];
+        else
+            glDeleteFramebuffers(1, &framebuffers[i].id); }
+    framebuffers.resize(kept);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    currentFbo = 0;
+}
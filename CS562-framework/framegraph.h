@@ -0,0 +1,134 @@
+///////////////////////////////////////////////////////////////////////
+// A small frame graph.  Each frame, DrawScene declares its passes in
+// execution order, along with the resources each pass reads, writes
+// and clears, and the fixed function state it runs with.  Execute
+// then:
+//   * culls passes whose results nobody reads (only output resources,
+//     such as the default framebuffer, keep their writers alive),
+//   * allocates transient render targets from a RenderTargetPool
+//     just before their first use and returns them just after their
+//     last, so a later target of the same format and size, whose
+//     lifetime doesn't overlap, reuses the texture.  (GL has no memory
+//     heaps to place textures of different formats or sizes in, so
+//     those never share memory.)
+//   * skips clears of resources that are still clear, and state
+//     changes that would not change anything.
+//
+// A pass body that changes fixed function state beyond its PassState
+// must restore it before returning.  The blend function is the
+// exception: a pass that enables blending sets its own.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _FRAMEGRAPH
+#define _FRAMEGRAPH
+
+#include <vector>
+#include <string>
+#include <functional>
+
+#include <glbinding/gl/types.h>
+
+class RenderTargetPool;
+
+// The fixed function state a pass runs with.
+struct PassState
+{
+    bool depthTest, blend, cullFace, depthWrite;
+
+    PassState(const bool _depthTest=true, const bool _blend=false, const bool _cullFace=true,
+              const bool _depthWrite=true)
+        : depthTest(_depthTest), blend(_blend), cullFace(_cullFace), depthWrite(_depthWrite) {}
+};
+
+class FrameGraph
+{
+public:
+    // Statistics from the most recent Execute
+    int passCount, culledPasses;
+    int clears, skippedClears;
+    int stateChanges, skippedStateChanges;
+    int transientTargets;
+    int reusedTargets;          // Transient targets given a texture released earlier this frame
+
+    FrameGraph(RenderTargetPool* _pool);
+
+    // Forget the previous frame's passes and resources.
+    void Reset();
+
+    // A render target that lives only between its first and last use
+    // in this frame.
+    int CreateTarget(const char* name, const int internalFormat, const int width, const int height);
+
+    // An existing texture attached to framebuffer fbo.  Writers of an
+    // output resource are never culled.
+    int ImportTarget(const char* name, const unsigned int texture, const unsigned int fbo,
+                     const bool depth, const int width, const int height, const bool output=false);
+
+    // The default framebuffer's color or depth buffer.  The color
+    // buffer is normally an output; the depth buffer rarely is.
+    int ImportBackbuffer(const char* name, const bool depth, const int width, const int height,
+                         const bool output=true);
+
+    // A dependency that is not a render target, such as a buffer.
+    int CreateVirtual(const char* name);
+
+    // Declare a pass.  Every resource in clears must also be in writes.
+    // Render targets in writes determine the framebuffer bound for
+    // run: the default framebuffer for backbuffer resources, else the
+    // imported targets' framebuffer, else one assembled from the
+    // transient targets with color attachments in declaration order.
+    void AddPass(const char* name, const std::vector<int>& reads, const std::vector<int>& writes,
+                 const std::vector<int>& clears, const PassState& state, std::function<void()> run);
+
+    // The texture of a render target; valid while its passes run.
+    unsigned int Texture(const int resource);
+
+    // Cull, then run the surviving passes in declaration order.
+    void Execute();
+
+private:
+    enum ResourceKind { transientTarget, importedTarget, backbuffer, virtualResource };
+    struct Resource {
+        std::string name;
+        ResourceKind kind;
+        int internalFormat, width, height;
+        bool depth, output;
+        unsigned int texture, fbo;
+        int refCount;           // Readers (surviving ones, once culled)
+        int firstUse, lastUse;  // Surviving pass indices
+    };
+    struct Pass {
+        std::string name;
+        std::vector<int> reads, writes, clears;
+        PassState state;
+        std::function<void()> run;
+        int refCount;           // Written resources still needed
+        bool culled;
+    };
+    struct Framebuffer {
+        std::vector<unsigned int> attachments;
+        unsigned int id;
+        int lastUsed;
+    };
+
+    RenderTargetPool* pool;
+    std::vector<Resource> resources;
+    std::vector<Pass> passes;
+    std::vector<Framebuffer> framebuffers;
+    std::vector<unsigned int> released; // Textures returned to the pool this frame
+    int frame;
+
+    // Last fixed function state set, and whether it is known at all
+    // (other code, like the GUI, runs between frames).
+    PassState current;
+    bool currentKnown;
+    unsigned int currentFbo;
+    std::vector<bool> clean;    // Per resource: cleared and not yet written
+
+    void Cull();
+    unsigned int BindTargets(const Pass& pass);
+    void ApplyState(const PassState& state);
+    void SetCap(const gl::GLenum cap, const bool want, const bool have);
+};
+
+#endif
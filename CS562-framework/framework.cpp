@@ -24,12 +24,18 @@ int main(int argc, char** argv)
     // Initialize glfw open a window
     if (!glfwInit())  exit(EXIT_FAILURE);
 
+    // Ask for GL 4.3 (compute shaders) first, and fall back to 3.3.
     glfwWindowHint(GLFW_RESIZABLE, 1);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, 0);
+    glfwWindowHint(GLFW_STENCIL_BITS, 8); // Light volume masking
     scene.window = glfwCreateWindow(750,750, "Graphics Framework", NULL, NULL);
+    if (!scene.window) {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        scene.window = glfwCreateWindow(750,750, "Graphics Framework", NULL, NULL); }
     if (!scene.window)  { glfwTerminate();  exit(-1); }
 
     glfwMakeContextCurrent(scene.window);
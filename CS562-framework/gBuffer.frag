@@ -3,10 +3,14 @@
 ////////////////////////////////////////////////////////////////////////
 #version 330
 
-layout (location = 0) out vec3 gPosition;
-layout (location = 1) out vec3 gNormal;
-layout (location = 2) out vec3 gDiffuse;
-layout (location = 3) out float gSpecular;
+// Full layout:   0 position, 1 normal, 2 diffuse, 3 specular
+// Packed layout: 0 octahedral normal, 1 diffuse + specular in alpha
+// (position comes from the depth buffer; see fbo.h)
+layout (location = 0) out vec4 gTarget0;
+layout (location = 1) out vec4 gTarget1;
+layout (location = 2) out vec4 gTarget2;
+layout (location = 3) out vec4 gTarget3;
+uniform bool packedGBuffer;
 
 //out vec4 FragData[];
 
@@ -17,22 +21,41 @@ in vec3 Normal;
 uniform sampler2D texture_diffuse1;
 uniform sampler2D texture_specular1;
 
-uniform int objectId;
-uniform vec3 diffuse;
-uniform vec3 specular;
-uniform float shininess;
+// Material, from uniforms or the instance buffer (see gBuffer.vert)
+flat in vec3 Diffuse;
+flat in vec3 Specular;
+flat in float Shininess;
+flat in int ObjectId;
+
+// Maps a unit vector onto the octahedron, unfolded into [0,1]^2.
+// lightingPhong.frag has the inverse.
+vec2 OctEncode(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 e = n.xy;
+    if (n.z < 0.0)
+        e = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return e*0.5 + 0.5;
+}
 
 void main()
 {    
     //vec2 pos = gl_FragCoord.xy/vec2(WIDTH,HEIGHT);
+    vec3 N = normalize(Normal);
+    if (packedGBuffer) {
+        gTarget0 = vec4(OctEncode(N), 0.0, 0.0);
+        gTarget1 = vec4(Diffuse, Specular.x);
+        return;
+    }
+
     // store the fragment position vector in the first gbuffer texture
-    gPosition = FragPos;
+    gTarget0 = vec4(FragPos, 1.0);
     // also store the per-fragment normals into the gbuffer
-    gNormal = normalize(Normal);
+    gTarget1 = vec4(N, 0.0);
     // and the diffuse per-fragment color
-    gDiffuse = diffuse;//texture(texture_diffuse1, TexCoords).rgb;
-    // store specular intensity in gAlbedoSpec's alpha component
-    gSpecular = specular.x;//texture(texture_specular1, TexCoords).r;
+    gTarget2 = vec4(Diffuse, 1.0);//texture(texture_diffuse1, TexCoords).rgb;
+    // store specular intensity in every channel of gSpecular
+    gTarget3 = vec4(Specular.x);//texture(texture_specular1, TexCoords).r;
 
     //FragData[0].xyz = FragPos;
     //FragData[1].xyz = Normal;
@@ -9,19 +9,53 @@ layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
 
+// Per-instance attributes (see shapes.h), read when instanced is set
+// in place of the per-object uniforms.
+layout (location = 4) in mat4 instanceTr;
+layout (location = 8) in vec4 instanceDiffuse;   // w: shininess
+layout (location = 9) in vec4 instanceSpecular;  // w: objectId
+
+// Constant per draw (see shapes.h); compressed shapes store aPos
+// normalized within their bounding box.
+layout (location = 10) in vec3 positionOffset;
+layout (location = 11) in vec3 positionScale;
+
 out vec3 FragPos;
 out vec2 TexCoords;
 out vec3 Normal;
+flat out vec3 Diffuse;
+flat out vec3 Specular;
+flat out float Shininess;
+flat out int ObjectId;
 
 uniform mat4 WorldView, WorldProj, ModelTr, NormalTr;
+uniform bool instanced;
+
+uniform int objectId;
+uniform vec3 diffuse;
+uniform vec3 specular;
+uniform float shininess;
 
 void main()
 {
-    vec4 worldPos = ModelTr * vec4(aPos,1.0);
+    mat4 model = ModelTr;
+    if (instanced) {
+        model = instanceTr;
+        Diffuse = instanceDiffuse.rgb;
+        Shininess = instanceDiffuse.w;
+        Specular = instanceSpecular.rgb;
+        ObjectId = int(instanceSpecular.w); }
+    else {
+        Diffuse = diffuse;
+        Shininess = shininess;
+        Specular = specular;
+        ObjectId = objectId; }
+
+    vec4 worldPos = model * vec4(positionOffset + aPos*positionScale, 1.0);
     FragPos = worldPos.xyz; 
     TexCoords = aTexCoords;
     
-    mat3 normalMatrix = transpose(inverse(mat3(ModelTr)));
+    mat3 normalMatrix = transpose(inverse(mat3(model)));
     Normal = normalMatrix * aNormal;
     //Normal = vertexNormal*mat3(NormalTr); 
 
@@ -0,0 +1,132 @@
+///////////////////////////////////////////////////////////////////////
+// A pool of static geometry drawn with multi-draw indirect.  See
+// geometrypool.h.
+////////////////////////////////////////////////////////////////////////
+
+#include "math.h"
+#include <stdlib.h>
+#include <stddef.h>
+
+#include <glbinding/gl/gl.h>
+#include <glbinding/Binding.h>
+using namespace gl;
+
+#define GLM_FORCE_CTOR_INIT
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+
+#include "shapes.h"
+#include "geometrypool.h"
+
+#include <glu.h>                // For gluErrorString
+#define CHECKERROR {GLenum err = glGetError(); if (err != GL_NO_ERROR) { fprintf(stderr, "OpenGL error (at line geometrypool.cpp:%d): %s\n", __LINE__, gluErrorString(err)); exit(-1);} }
+
+GeometryPool::GeometryPool()
+    : available(false), shapes(0), vertexCount(0), indexCount(0),
+      vaoID(0), vertexBuffer(0), indexBuffer(0), stale(false)
+{
+    int major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    available = major > 4 || (major == 4 && minor >= 3);
+    if (!available) return;
+
+    glGenVertexArrays(1, &vaoID);
+    glGenBuffers(1, &vertexBuffer);
+    glGenBuffers(1, &indexBuffer);
+
+    // The format is fixed; only the buffer contents change.
+    glBindVertexArray(vaoID);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, texture));
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, tangent));
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+    glBindVertexArray(0);
+    CHECKERROR;
+}
+
+void GeometryPool::Add(Shape* shape)
+{
+    if (shape->LevelCount() > 1) {
+        for (int l=0;  l<shape->LevelCount();  l++)
+            Add(shape->Level(l));
+        return; }
+    if (!available || Contains(shape) || shape->Pnt.empty()) return;
+
+    Range r;
+    r.firstIndex = indices.size();
+    r.count = 3*shape->Tri.size();
+    r.baseVertex = vertices.size();
+    ranges[shape] = r;
+
+    // Missing attributes read as zero, as they do from an unset array.
+    for (size_t i=0;  i<shape->Pnt.size();  i++) {
+        Vertex v = {};
+        for (int c=0;  c<3;  c++) {
+            v.position[c] = shape->Pnt[i][c];
+            if (i < shape->Nrm.size()) v.normal[c] = shape->Nrm[i][c];
+            if (i < shape->Tan.size()) v.tangent[c] = shape->Tan[i][c]; }
+        if (i < shape->Tex.size()) {
+            v.texture[0] = shape->Tex[i][0];
+            v.texture[1] = shape->Tex[i][1]; }
+        vertices.push_back(v); }
+
+    // Indices stay relative to the shape; baseVertex offsets them.
+    for (size_t t=0;  t<shape->Tri.size();  t++)
+        for (int c=0;  c<3;  c++)
+            indices.push_back(shape->Tri[t][c]);
+
+    shapes = ranges.size();
+    vertexCount = vertices.size();
+    indexCount = indices.size();
+    stale = true;
+}
+
+DrawElementsCommand GeometryPool::Command(const Shape* shape, const int instanceCount, const int baseInstance) const
+{
+    const Range& r = ranges.find(shape)->second;
+    DrawElementsCommand c;
+    c.count = r.count;
+    c.instanceCount = instanceCount;
+    c.firstIndex = r.firstIndex;
+    c.baseVertex = r.baseVertex;
+    c.baseInstance = baseInstance;
+    return c;
+}
+
+void GeometryPool::Upload()
+{
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex)*vertices.size(),
+                 vertices.empty() ? NULL : &vertices[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(vaoID);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int)*indices.size(),
+                 indices.empty() ? NULL : &indices[0], GL_STATIC_DRAW);
+    glBindVertexArray(0);
+    stale = false;
+    CHECKERROR;
+}
+
+void GeometryPool::MultiDraw(const unsigned int instanceBuffer, const size_t commandOffset, const int commandCount)
+{
+    if (commandCount == 0) return;
+    if (stale) Upload();
+    CHECKERROR;
+    glBindVertexArray(vaoID);
+    BindInstanceAttributes(instanceBuffer, 0);
+    SetPositionDecode(glm::vec3(0.0f), glm::vec3(1.0f));
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)commandOffset,
+                                commandCount, sizeof(DrawElementsCommand));
+    CHECKERROR;
+    UnbindInstanceAttributes();
+    glBindVertexArray(0);
+}
@@ -0,0 +1,82 @@
+///////////////////////////////////////////////////////////////////////
+// A geometry pool: the vertices and triangles of many static shapes,
+// suballocated from one shared vertex buffer and one shared index
+// buffer behind a single VAO.  Every shape's vertices, whatever its
+// Shape::quality, are converted to one common interleaved format,
+//
+// position,        glm::vec3,   attribute #0
+// normal,          glm::vec3,   attribute #1
+// texture coord,   glm::vec2,   attribute #2
+// tangent,         glm::vec3,   attribute #3
+//
+// so the draws of any number of pooled shapes can go out in a single
+// glMultiDrawElementsIndirect call, one DrawElementsCommand per shape
+// with its firstIndex and baseVertex (see Command).  Per-draw data
+// comes from the instance attributes #4-#9 (see InstanceData), which
+// each command's baseInstance selects.
+//
+// Pooled shapes keep their own VAOs and buffers, since every other
+// path (multi-draw switched off, occlusion queries, the render queue,
+// GL < 4.3) still draws them through those.  The pool is thus a second
+// copy on the GPU, of Bytes() bytes: 44 bytes a vertex, whatever the
+// shape's own quality, and 4 an index.  The CPU copy it keeps for
+// rebuilding when shapes are added costs the same again.
+//
+// Needs GL 4.3 for glMultiDrawElementsIndirect; available is false
+// otherwise.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _GEOMETRYPOOL
+#define _GEOMETRYPOOL
+
+#include <vector>
+#include <unordered_map>
+
+class Shape;
+struct DrawElementsCommand;
+
+class GeometryPool
+{
+public:
+    bool available;             // GL 4.3
+    int shapes, vertexCount, indexCount;
+
+    GeometryPool();
+
+    // Copies shape's vertices and triangles into the pool, or those of
+    // each of its levels of detail.  Adding a shape twice does nothing.
+    // The buffers are rebuilt by the next MultiDraw.
+    void Add(Shape* shape);
+    bool Contains(const Shape* shape) const { return ranges.count(shape) > 0; }
+
+    // Size of the pool's vertex and index buffers.
+    size_t Bytes() const { return sizeof(Vertex)*vertices.size() + sizeof(unsigned int)*indices.size(); }
+
+    // The command drawing instanceCount instances of a pooled shape,
+    // with instance attributes starting at baseInstance.
+    DrawElementsCommand Command(const Shape* shape, const int instanceCount, const int baseInstance) const;
+
+    // Draws commandCount commands from byte commandOffset of the bound
+    // GL_DRAW_INDIRECT_BUFFER, with instance attributes from
+    // instanceBuffer.
+    void MultiDraw(const unsigned int instanceBuffer, const size_t commandOffset, const int commandCount);
+
+private:
+    struct Vertex {
+        float position[3], normal[3], texture[2], tangent[3];
+    };
+    struct Range {
+        unsigned int firstIndex, count;
+        int baseVertex;
+    };
+
+    std::unordered_map<const Shape*, Range> ranges;
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+    unsigned int vaoID, vertexBuffer, indexBuffer;
+    bool stale;                 // Shapes added since the last upload
+
+    void Upload();
+};
+
+#endif
@@ -0,0 +1,493 @@
+///////////////////////////////////////////////////////////////////////
+// A flattened, dirty-tracked Object hierarchy.  See hierarchy.h.
+////////////////////////////////////////////////////////////////////////
+
+#include "math.h"
+#include <stdlib.h>
+#include <float.h>
+#include <algorithm>
+#include <unordered_map>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define HIERARCHY_SSE
+#include <xmmintrin.h>
+#endif
+
+#include <glbinding/gl/gl.h>
+#include <glbinding/Binding.h>
+using namespace gl;
+
+#define GLM_FORCE_CTOR_INIT
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+
+#include "framework.h"
+#include "shapes.h"
+#include "object.h"
+#include "occlusion.h"
+#include "queries.h"
+#include "renderqueue.h"
+#include "geometrypool.h"
+#include "hierarchy.h"
+
+#include <glu.h>                // For gluErrorString
+#define CHECKERROR {GLenum err = glGetError(); if (err != GL_NO_ERROR) { fprintf(stderr, "OpenGL error (at line hierarchy.cpp:%d): %s\n", __LINE__, gluErrorString(err)); exit(-1);} }
+
+// An explicit stack rather than recursion, so deep hierarchies can't
+// overflow the call stack.  Children are pushed in reverse so they
+// come off in the order Object::Draw visits them.
+void ObjectHierarchy::Compile(Object* root)
+{
+    objects.clear();
+    parents.clear();
+    locals.clear();
+
+    struct Pending { Object* object; int parent; glm::mat4 local; };
+    std::vector<Pending> stack;
+    Pending start = { root, -1, glm::mat4(1.0) };
+    stack.push_back(start);
+    while (!stack.empty()) {
+        Pending p = stack.back();
+        stack.pop_back();
+        int index = objects.size();
+        objects.push_back(p.object);
+        parents.push_back(p.parent);
+        locals.push_back(p.local);
+        for (int i=p.object->instances.size()-1;  i>=0;  i--) {
+            Pending child = { p.object->instances[i].first, index, p.object->instances[i].second };
+            stack.push_back(child); } }
+
+    worlds.resize(objects.size());
+    inverses.resize(objects.size());
+    dirty.assign(objects.size(), 1);
+    visible.assign(objects.size(), 1);
+    hasShape.resize(objects.size());
+    levels.assign(objects.size(), 0);
+    drawn.resize(objects.size());
+    for (size_t i=0;  i<objects.size();  i++) {
+        hasShape[i] = objects[i]->shape != NULL;
+        drawn[i] = hasShape[i] ? objects[i]->shape->Level(0) : NULL; }
+    shown.assign(objects.size(), 1);
+    outside.assign(objects.size(), 0);
+    compiled = false;
+
+    // Descendants immediately follow a node, so its subtree ends where
+    // the first later node that isn't a descendant begins.
+    subtreeEnd.assign(objects.size(), objects.size());
+    std::vector<int> open;
+    for (size_t i=0;  i<objects.size();  i++) {
+        while (!open.empty() && open.back() != parents[i]) {
+            subtreeEnd[open.back()] = i;
+            open.pop_back(); }
+        open.push_back(i); }
+
+    ownMin.resize(objects.size());
+    ownMax.resize(objects.size());
+    const size_t padded = (objects.size() + 3) & ~size_t(3);
+    minX.assign(padded, FLT_MAX);  minY.assign(padded, FLT_MAX);  minZ.assign(padded, FLT_MAX);
+    maxX.assign(padded, -FLT_MAX); maxY.assign(padded, -FLT_MAX); maxZ.assign(padded, -FLT_MAX);
+
+    // Group the nodes that draw something by Shape, a node with
+    // levels of detail going into the batch of each level.
+    batches.clear();
+    std::unordered_map<Shape*, int> batchOf;
+    for (size_t i=0;  i<objects.size();  i++) {
+        if (!hasShape[i]) continue;
+        for (int l=0;  l<objects[i]->shape->LevelCount();  l++) {
+            Shape* shape = objects[i]->shape->Level(l);
+            std::unordered_map<Shape*, int>::iterator b = batchOf.find(shape);
+            if (b == batchOf.end()) {
+                Batch batch;
+                batch.shape = shape;
+                batch.first = batch.count = 0;
+                b = batchOf.insert(std::make_pair(shape, int(batches.size()))).first;
+                batches.push_back(batch); }
+            batches[b->second].nodes.push_back(i); } }
+
+    if (!instanceBuffer) glGenBuffers(1, &instanceBuffer);
+    if (!boundsBuffer) glGenBuffers(1, &boundsBuffer);
+    if (!commandBuffer) glGenBuffers(1, &commandBuffer);
+    instancesStale = true;
+}
+
+// A node is dirty if its parent is, or if its parent's animation
+// transformation (which applies to the parent's children, not to the
+// parent itself) has changed.  Parents come first, so one sweep
+// suffices.
+void ObjectHierarchy::Update(const glm::mat4& tr)
+{
+    const bool rootDirty = !compiled || tr != rootTr;
+    rootTr = tr;
+    updated = 0;
+    for (size_t i=0;  i<objects.size();  i++) {
+        const int p = parents[i];
+        if (p < 0)
+            dirty[i] = rootDirty;
+        else
+            dirty[i] = dirty[p] || objects[p]->animDirty;
+        if (!dirty[i]) continue;
+
+        worlds[i] = p < 0 ? rootTr : worlds[p]*locals[i]*objects[p]->animTr;
+        inverses[i] = glm::inverse(worlds[i]);
+        updated++; }
+
+    for (size_t i=0;  i<objects.size();  i++)
+        objects[i]->animDirty = false;
+    if (updated > 0) {
+        UpdateBounds();
+        instancesStale = true; }
+    compiled = true;
+}
+
+// Transforms the shape boxes of the dirty nodes (center by the matrix,
+// half extent by its absolute value), then merges every subtree into
+// its parent, children before parents.
+void ObjectHierarchy::UpdateBounds()
+{
+    for (size_t i=0;  i<objects.size();  i++) {
+        if (!dirty[i]) continue;
+        const Shape* shape = objects[i]->shape;
+        if (!shape) {
+            ownMin[i] = glm::vec3(FLT_MAX);
+            ownMax[i] = glm::vec3(-FLT_MAX);
+            continue; }
+        const glm::mat4& M = worlds[i];
+        const glm::vec3 c = (M*glm::vec4(shape->center, 1.0f)).xyz();
+        const glm::vec3 h = 0.5f*(shape->maxP - shape->minP);
+        const glm::vec3 e = glm::abs(glm::vec3(M[0]))*h.x + glm::abs(glm::vec3(M[1]))*h.y
+            + glm::abs(glm::vec3(M[2]))*h.z;
+        ownMin[i] = c - e;
+        ownMax[i] = c + e; }
+
+    for (size_t i=0;  i<objects.size();  i++) {
+        minX[i] = ownMin[i].x;  minY[i] = ownMin[i].y;  minZ[i] = ownMin[i].z;
+        maxX[i] = ownMax[i].x;  maxY[i] = ownMax[i].y;  maxZ[i] = ownMax[i].z; }
+    for (int i=objects.size()-1;  i>0;  i--) {
+        const int p = parents[i];
+        minX[p] = std::min(minX[p], minX[i]);  maxX[p] = std::max(maxX[p], maxX[i]);
+        minY[p] = std::min(minY[p], minY[i]);  maxY[p] = std::max(maxY[p], maxY[i]);
+        minZ[p] = std::min(minZ[p], minZ[i]);  maxZ[p] = std::max(maxZ[p], maxZ[i]); }
+}
+
+// Returns a bit per node of first..first+3 whose box is entirely on
+// the negative side of some plane.  Per plane, only the box corner
+// furthest along the plane's normal needs testing, and which corner
+// that is depends only on the signs of the normal.
+int ObjectHierarchy::TestBlock(const int first)
+{
+#ifdef HIERARCHY_SSE
+    __m128 out = _mm_setzero_ps();
+    for (int p=0;  p<6;  p++) {
+        const glm::vec4& pl = planes[p];
+        const __m128 x = _mm_loadu_ps(&(pl.x >= 0.0f ? maxX : minX)[first]);
+        const __m128 y = _mm_loadu_ps(&(pl.y >= 0.0f ? maxY : minY)[first]);
+        const __m128 z = _mm_loadu_ps(&(pl.z >= 0.0f ? maxZ : minZ)[first]);
+        const __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(pl.x), x),
+                                               _mm_mul_ps(_mm_set1_ps(pl.y), y)),
+                                    _mm_add_ps(_mm_mul_ps(_mm_set1_ps(pl.z), z),
+                                               _mm_set1_ps(pl.w)));
+        out = _mm_or_ps(out, _mm_cmplt_ps(d, _mm_setzero_ps())); }
+    return _mm_movemask_ps(out);
+#else
+    int mask = 0;
+    for (int k=0;  k<4;  k++)
+        for (int p=0;  p<6;  p++) {
+            const glm::vec4& pl = planes[p];
+            const float d = pl.x*(pl.x >= 0.0f ? maxX : minX)[first+k]
+                + pl.y*(pl.y >= 0.0f ? maxY : minY)[first+k]
+                + pl.z*(pl.z >= 0.0f ? maxZ : minZ)[first+k] + pl.w;
+            if (d < 0.0f) {
+                mask |= 1<<k;
+                break; } }
+    return mask;
+#endif
+}
+
+// The planes are sums and differences of the matrix's rows (Gribb and
+// Hartmann).  Blocks are tested on demand, so a block lying entirely
+// within an already culled subtree is never tested.
+void ObjectHierarchy::Cull(const glm::mat4& viewProj)
+{
+    if (!culling) {
+        outside.assign(objects.size(), 0);
+        return; }
+
+    const glm::mat4 T = glm::transpose(viewProj);
+    for (int i=0;  i<3;  i++) {
+        planes[2*i] = T[3] + T[i];
+        planes[2*i+1] = T[3] - T[i]; }
+
+    int block = -1, mask = 0;
+    size_t i = 0;
+    while (i < objects.size()) {
+        if (int(i>>2) != block) {
+            block = i>>2;
+            mask = TestBlock(block<<2); }
+        if (mask & (1<<(i&3))) {
+            for (int j=i;  j<subtreeEnd[i];  j++)
+                outside[j] = 1;
+            i = subtreeEnd[i]; }
+        else
+            outside[i++] = 0; }
+}
+
+// The projected size is the diameter of the node's box over the
+// distance to its center (the eye inside the box counting as the
+// radius), which is what LodShape::SelectLevel expects.
+void ObjectHierarchy::SelectLevels(const glm::vec3& eye, const float pixelsPerUnit)
+{
+    levelSwitches = 0;
+    for (size_t i=0;  i<objects.size();  i++) {
+        if (!hasShape[i]) continue;
+        Shape* shape = objects[i]->shape;
+        if (shape->LevelCount() < 2) continue;
+
+        int level = 0;
+        if (lod) {
+            const float diameter = glm::length(ownMax[i] - ownMin[i]);
+            const float distance = std::max(glm::length(0.5f*(ownMin[i] + ownMax[i]) - eye), 0.5f*diameter);
+            level = shape->SelectLevel(diameter/std::max(distance, 1e-6f)*pixelsPerUnit, levels[i]); }
+        if (level == levels[i]) continue;
+        levels[i] = level;
+        drawn[i] = shape->Level(level);
+        instancesStale = true;
+        levelSwitches++; }
+}
+
+// A node is visible if it and all its ancestors have drawMe set, and
+// it was not culled.
+void ObjectHierarchy::UpdateVisibility()
+{
+    drawnObjects = culledObjects = 0;
+    for (size_t i=0;  i<objects.size();  i++) {
+        const int p = parents[i];
+        shown[i] = (p < 0 || shown[p]) && objects[i]->drawMe;
+        const char v = shown[i] && !outside[i];
+        if (v != visible[i]) instancesStale = true;
+        visible[i] = v;
+        if (objects[i]->shape && shown[i]) {
+            if (v) drawnObjects++;
+            else culledObjects++; } }
+}
+
+void ObjectHierarchy::ResolveUniforms(ShaderProgram* program)
+{
+    if (program == uniformProgram) return;
+    uniforms.Resolve(program);
+    instancedUniform = program->Uniform("instanced");
+    uniformProgram = program;
+}
+
+void ObjectHierarchy::Draw(ShaderProgram* program)
+{
+    ResolveUniforms(program);
+    program->Set(instancedUniform, 0);
+    UpdateVisibility();
+
+    drawCalls = 0;
+    for (size_t i=0;  i<objects.size();  i++)
+        if (visible[i] && hasShape[i])
+            DrawNode(program, uniforms, i);
+    CHECKERROR;
+}
+
+void ObjectHierarchy::Enqueue(RenderQueue* queue, ShaderProgram* program, const glm::mat4& WorldView)
+{
+    UpdateVisibility();
+    for (size_t i=0;  i<objects.size();  i++)
+        if (visible[i] && hasShape[i]) {
+            glm::vec4 center = WorldView*glm::vec4(0.5f*(ownMin[i] + ownMax[i]), 1.0f);
+            queue->Push(program, objects[i], drawn[i], &worlds[i], &inverses[i], -center.z); }
+}
+
+// Sets the same per-object uniforms Object::Draw does, and draws.
+void ObjectHierarchy::DrawNode(ShaderProgram* program, const ObjectUniforms& u, const int i)
+{
+    const Object* object = objects[i];
+    program->Set(u.diffuse, object->diffuseColor);
+    program->Set(u.specular, object->specularColor);
+    program->Set(u.shininess, object->shininess);
+    program->Set(u.objectId, object->objectId);
+    program->Set(u.ModelTr, worlds[i]);
+    if (u.NormalTr >= 0)
+        program->Set(u.NormalTr, inverses[i]);
+
+    drawn[i]->DrawVAO();
+    drawCalls++;
+}
+
+// Traverses the hierarchy like Cull does, skipping hidden and culled
+// subtrees, and lets queries decide which of the rest are occluded.
+// A box the eye is inside (or nearly, given the near plane) can't be
+// tested by rasterizing it, so it counts as visible.
+void ObjectHierarchy::DrawQueried(ShaderProgram* program, OcclusionQueries* queries,
+                                  const glm::mat4& viewProj, const glm::vec3& eye, const float nearMargin)
+{
+    if (queries->Size() != int(objects.size()))
+        queries->Reset(objects.size());
+    queries->Poll(parents, subtreeEnd, hasShape);
+    UpdateVisibility();
+    queryFrame++;
+
+    ResolveUniforms(program);
+    program->Set(instancedUniform, 0);
+    drawCalls = 0;
+
+    size_t i = 0;
+    while (i < objects.size()) {
+        if (!shown[i] || outside[i]) {
+            i = subtreeEnd[i];
+            continue; }
+
+        const glm::vec3 lo(minX[i], minY[i], minZ[i]);
+        const glm::vec3 hi(maxX[i], maxY[i], maxZ[i]);
+        const bool eyeInside = glm::all(glm::greaterThan(eye, lo - nearMargin))
+            && glm::all(glm::lessThan(eye, hi + nearMargin));
+
+        if (queries->Occluded(i)) {
+            if (eyeInside)
+                queries->SetVisible(i);
+            else {
+                if (!queries->Pending(i))
+                    queries->QueueBox(i, lo, hi);
+                for (int j=i;  j<subtreeEnd[i];  j++)
+                    if (hasShape[j] && shown[j])
+                        queries->skipped++;
+                i = subtreeEnd[i];
+                continue; } }
+
+        if (hasShape[i]) {
+            const bool leaf = subtreeEnd[i] == int(i)+1;
+            const bool queryable = leaf && !queries->Pending(i) && !eyeInside;
+            if (queryable && int(drawn[i]->count) > queries->conditionalTriangles) {
+                queries->BeginConditional(i, queryFrame, viewProj, lo, hi, program);
+                DrawNode(program, uniforms, i);
+                queries->EndConditional(); }
+            else if (queryable && queries->Due(i, queryFrame)) {
+                queries->Begin(i, queryFrame);
+                DrawNode(program, uniforms, i);
+                queries->End(); }
+            else
+                DrawNode(program, uniforms, i); }
+        i++; }
+
+    queries->FlushBoxes(queryFrame, viewProj, program);
+    CHECKERROR;
+}
+
+// Rewrites the instance buffer, batch after batch, only when a
+// transformation or the visibility changed.  The bounds buffer gets
+// each instance's box, tagged with its batch, for OcclusionCuller.
+void ObjectHierarchy::PrepareInstances()
+{
+    UpdateVisibility();
+    if (!instancesStale) return;
+
+    instanceData.clear();
+    instanceBounds.clear();
+    for (size_t b=0;  b<batches.size();  b++) {
+        Batch& batch = batches[b];
+        batch.first = instanceData.size();
+        for (size_t n=0;  n<batch.nodes.size();  n++) {
+            const int i = batch.nodes[n];
+            if (!visible[i] || drawn[i] != batch.shape) continue;
+            const Object* object = objects[i];
+            InstanceData d;
+            d.ModelTr = worlds[i];
+            d.diffuse = glm::vec4(object->diffuseColor, object->shininess);
+            d.specular = glm::vec4(object->specularColor, float(object->objectId));
+            instanceData.push_back(d);
+            instanceBounds.push_back(glm::vec4(ownMin[i], float(b)));
+            instanceBounds.push_back(glm::vec4(ownMax[i], 0.0f)); }
+        batch.count = instanceData.size() - batch.first; }
+
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(InstanceData)*instanceData.size(),
+                 instanceData.empty() ? NULL : &instanceData[0], GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, boundsBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec4)*instanceBounds.size(),
+                 instanceBounds.empty() ? NULL : &instanceBounds[0], GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    instancesStale = false;
+    commandShapes = -1;
+}
+
+void ObjectHierarchy::DrawInstanced(ShaderProgram* program, GeometryPool* pool)
+{
+    PrepareInstances();
+    if (pool && !pool->available) pool = NULL;
+
+    // The commands change only with the instances or the pool.
+    if (pool && commandShapes != pool->shapes) {
+        commands.clear();
+        for (size_t b=0;  b<batches.size();  b++)
+            if (batches[b].count > 0 && pool->Contains(batches[b].shape))
+                commands.push_back(pool->Command(batches[b].shape, batches[b].count, batches[b].first));
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(DrawElementsCommand)*commands.size(),
+                     commands.empty() ? NULL : &commands[0], GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        commandShapes = pool->shapes; }
+
+    ResolveUniforms(program);
+    program->Set(instancedUniform, 1);
+    drawCalls = 0;
+    if (pool && !commands.empty()) {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        pool->MultiDraw(instanceBuffer, 0, commands.size());
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        drawCalls++; }
+    for (size_t b=0;  b<batches.size();  b++) {
+        const Batch& batch = batches[b];
+        if (batch.count == 0 || (pool && pool->Contains(batch.shape))) continue;
+        batch.shape->DrawVAOInstanced(instanceBuffer, batch.first*sizeof(InstanceData), batch.count);
+        drawCalls++; }
+    program->Set(instancedUniform, 0);
+    CHECKERROR;
+}
+
+// Phase 0 draws what last frame's depth doesn't hide; phase 1 draws
+// what the depth phase 0 drew doesn't hide, out of what phase 0 left
+// out.  Between them the pyramid is rebuilt, and it serves next
+// frame's phase 0 as well.  The draws go through the indirect
+// commands, so the CPU issues the same calls whatever is occluded.
+void ObjectHierarchy::DrawOccluded(ShaderProgram* program, OcclusionCuller* culler,
+                                   const unsigned int depthTexture, const int width, const int height,
+                                   const glm::mat4& viewProj, GeometryPool* pool)
+{
+    PrepareInstances();
+
+    // Pooled commands index the pool's buffers, so it is all or nothing.
+    bool pooled = pool && pool->available;
+    for (size_t b=0;  b<batches.size() && pooled;  b++)
+        pooled = pool->Contains(batches[b].shape);
+
+    std::vector<DrawElementsCommand> templates;
+    for (size_t b=0;  b<batches.size();  b++) {
+        DrawElementsCommand c = { 3*batches[b].shape->count, 0, 0, 0, (unsigned int)batches[b].first };
+        templates.push_back(pooled ? pool->Command(batches[b].shape, 0, batches[b].first) : c); }
+
+    ResolveUniforms(program);
+    drawCalls = 0;
+    for (int phase=0;  phase<2;  phase++) {
+        if (phase == 1)
+            culler->BuildPyramid(depthTexture, width, height);
+        culler->Cull(phase, instanceBuffer, boundsBuffer, instanceData.size(), templates, viewProj);
+
+        program->UseShader(); // The culler switches programs
+        program->Set(instancedUniform, 1);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, culler->commandBuffer);
+        if (pooled) {
+            pool->MultiDraw(culler->culledBuffer, phase*batches.size()*sizeof(DrawElementsCommand), batches.size());
+            drawCalls++; }
+        else
+            for (size_t b=0;  b<batches.size();  b++) {
+                if (batches[b].count == 0) continue;
+                batches[b].shape->DrawVAOIndirect(culler->culledBuffer,
+                                                  (phase*batches.size() + b)*sizeof(DrawElementsCommand));
+                drawCalls++; }
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        program->Set(instancedUniform, 0); }
+    CHECKERROR;
+}
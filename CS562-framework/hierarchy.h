@@ -0,0 +1,160 @@
+///////////////////////////////////////////////////////////////////////
+// A flattened copy of an Object hierarchy.
+//
+// Compile walks the tree once and records every path from the root to
+// an Object as a node, in depth-first (pre-)order, so a node's parent
+// always precedes it.  Local and world transformations, and the
+// inverses the shaders use for normals, live in parallel arrays.
+//
+// Update recomputes world transformations only below objects whose
+// animation transformation changed (see Object::SetAnimTr), in one
+// linear sweep.  Draw then submits the nodes in the same order.
+// DrawInstanced instead groups the nodes by Shape and draws each group
+// with a single instanced call, taking transformations and materials
+// from an instance buffer that is rewritten only when something moved
+// or was hidden.  Given a GeometryPool holding the shapes (GL 4.3),
+// DrawInstanced submits all the groups in one multi-draw indirect
+// call instead, so its CPU cost no longer grows with the number of
+// shapes either.
+//
+// Cull tests each node's world space bounding box, which encloses its
+// shape and its whole subtree, against the view frustum.  The boxes
+// live in structure-of-arrays form and are tested four at a time with
+// SSE; a subtree whose box is outside is skipped without testing its
+// nodes.  Draw and DrawInstanced then leave out the culled nodes.
+//
+// DrawOccluded goes one step further on GL 4.3 and lets an
+// OcclusionCuller decide on the GPU which of the remaining instances
+// are hidden behind others (see occlusion.h).  DrawQueried does the
+// same with occlusion queries on any GL 3.3 context (see queries.h).
+//
+// SelectLevels picks a level of detail for every node whose Shape has
+// several (see LodShape) from its projected size.  Each level of such
+// a Shape gets a batch of its own, and the node draws from the batch
+// of its current level in every path above.
+//
+// Changing an Object's instances after Compile requires another
+// Compile.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _HIERARCHY
+#define _HIERARCHY
+
+#include <vector>
+#include "shapes.h"
+#include "object.h"
+
+class Object;
+class ShaderProgram;
+class OcclusionCuller;
+class OcclusionQueries;
+class RenderQueue;
+class GeometryPool;
+
+class ObjectHierarchy
+{
+public:
+    int updated;                // World transformations recomputed by the last Update
+    int drawCalls;              // Issued by the last Draw or DrawInstanced
+    bool culling;               // Cull against the frustum, or draw everything
+    int drawnObjects, culledObjects; // Shape nodes drawn and culled by the last draw
+    bool lod;                   // Select levels of detail, or draw the finest
+    int levelSwitches;          // Nodes that changed level in the last SelectLevels
+
+    ObjectHierarchy() : updated(0), drawCalls(0), culling(true), drawnObjects(0), culledObjects(0),
+                        lod(true), levelSwitches(0),
+                        compiled(false), queryFrame(0), instanceBuffer(0), boundsBuffer(0), instancesStale(true),
+                        commandBuffer(0), commandShapes(-1), uniformProgram(NULL), instancedUniform(-1) {}
+
+    void Compile(Object* root);
+
+    // Brings world transformations up to date for root transformation tr.
+    void Update(const glm::mat4& tr);
+
+    // Marks the nodes outside the frustum of viewProj (WorldProj*WorldView).
+    void Cull(const glm::mat4& viewProj);
+
+    // Picks each node's level of detail for an eye at eye, seeing
+    // pixelsPerUnit pixels per unit at distance 1.  Call after Update.
+    void SelectLevels(const glm::vec3& eye, const float pixelsPerUnit);
+
+    // Draws every node whose object, and every ancestor, has drawMe set.
+    void Draw(ShaderProgram* program);
+    // The same, one instanced draw per Shape.  The program must be
+    // gBuffer.vert's, or have its instance attributes.  The Shapes in
+    // pool, if given, go out in one multi-draw call.
+    void DrawInstanced(ShaderProgram* program, GeometryPool* pool=NULL);
+    // The same, leaving out what culler finds occluded.  depthTexture
+    // is the depth the draws render into, of size width by height.
+    // With every Shape in pool, each phase is one multi-draw call.
+    void DrawOccluded(ShaderProgram* program, OcclusionCuller* culler,
+                      const unsigned int depthTexture, const int width, const int height,
+                      const glm::mat4& viewProj, GeometryPool* pool=NULL);
+    // Draw, leaving out what queries found occluded.  nearMargin is
+    // the distance from the eye to the near plane.
+    void DrawQueried(ShaderProgram* program, OcclusionQueries* queries,
+                     const glm::mat4& viewProj, const glm::vec3& eye, const float nearMargin);
+
+    // Pushes the nodes Draw would draw onto queue, with their depth
+    // in front of the eye of WorldView, for the queue to sort.
+    void Enqueue(RenderQueue* queue, ShaderProgram* program, const glm::mat4& WorldView);
+
+    int Size() { return objects.size(); }
+
+private:
+    std::vector<Object*> objects;
+    std::vector<int> parents;       // -1 for the root
+    std::vector<glm::mat4> locals;  // The instance transformation leading to each node
+    std::vector<glm::mat4> worlds;
+    std::vector<glm::mat4> inverses;
+    std::vector<char> dirty;
+    std::vector<char> hasShape;
+    std::vector<char> shown;        // drawMe set on the node and its ancestors
+    std::vector<char> visible;      // Shown and not culled
+    std::vector<char> outside;      // Culled by the last Cull
+    std::vector<int> subtreeEnd;    // One past the node's last descendant
+    std::vector<int> levels;        // Level of detail of each node's shape
+    std::vector<Shape*> drawn;      // That level's Shape
+
+    // World space bounds of each node's own shape, and of its subtree.
+    // The subtree bounds are padded to a multiple of four nodes.
+    std::vector<glm::vec3> ownMin, ownMax;
+    std::vector<float> minX, minY, minZ, maxX, maxY, maxZ;
+    glm::vec4 planes[6];
+    glm::mat4 rootTr;
+    bool compiled;              // Everything is dirty until the first Update
+    int queryFrame;             // Frames drawn by DrawQueried
+
+    // The nodes drawing each Shape; their visible instances occupy
+    // instanceData[first .. first+count).
+    struct Batch {
+        Shape* shape;
+        std::vector<int> nodes;
+        int first, count;
+    };
+    std::vector<Batch> batches;
+    std::vector<InstanceData> instanceData;
+    std::vector<glm::vec4> instanceBounds; // Two per instance: min (w: batch), max
+    unsigned int instanceBuffer, boundsBuffer;
+    bool instancesStale;        // instanceData no longer matches the nodes
+
+    // DrawInstanced's commands for the batches in a GeometryPool
+    std::vector<DrawElementsCommand> commands;
+    unsigned int commandBuffer;
+    int commandShapes;          // Pool size the commands were built for; -1 if stale
+
+    // Uniform handles of the program last drawn with, resolved again
+    // only when the program changes.
+    ShaderProgram* uniformProgram;
+    ObjectUniforms uniforms;
+    int instancedUniform;
+
+    void ResolveUniforms(ShaderProgram* program);
+    void UpdateVisibility();
+    void PrepareInstances();
+    void DrawNode(ShaderProgram* program, const ObjectUniforms& u, const int i);
+    void UpdateBounds();
+    int TestBlock(const int first);
+};
+
+#endif
@@ -0,0 +1,14 @@
+/////////////////////////////////////////////////////////////////////////
+// Vertex shader for light volumes: a unit sphere placed and scaled to
+// a light's bounding sphere by ModelTr.
+////////////////////////////////////////////////////////////////////////
+#version 330
+
+uniform mat4 WorldView, WorldProj, ModelTr;
+
+in vec4 vertex;
+
+void main()
+{
+    gl_Position = WorldProj*WorldView*ModelTr*vertex;
+}
@@ -0,0 +1,100 @@
+///////////////////////////////////////////////////////////////////////
+// GPU storage for the scene's lights.  See lightbuffer.h for the
+// layout.
+////////////////////////////////////////////////////////////////////////
+
+#include "math.h"
+#include <stdlib.h>
+#include <algorithm>
+
+#include <glbinding/gl/gl.h>
+#include <glbinding/Binding.h>
+using namespace gl;
+
+#define GLM_FORCE_CTOR_INIT
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+
+#include "lightbuffer.h"
+
+#include <glu.h>                // For gluErrorString
+#define CHECKERROR {GLenum err = glGetError(); if (err != GL_NO_ERROR) { fprintf(stderr, "OpenGL error (at line lightbuffer.cpp:%d): %s\n", __LINE__, gluErrorString(err)); exit(-1);} }
+
+// Binding point of the LightBlock, as a uniform block or a storage
+// block.  clusterLights.comp declares the same binding.
+const int lightBinding = 3;
+
+// Storage buffers have no practical size limit; this just keeps the
+// light count slider sane.
+const int maxStorageLights = 1<<16;
+
+LightBuffer::LightBuffer()
+    : storage(false), capacity(0), count(0)
+{
+    int major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    storage = major > 4 || (major == 4 && minor >= 3);
+
+    if (storage)
+        capacity = maxStorageLights;
+    else {
+        int blockSize = 0;
+        glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &blockSize);
+        capacity = blockSize/sizeof(LightData); }
+
+    glGenBuffers(1, &bufferId);
+    CHECKERROR;
+}
+
+std::string LightBuffer::Defines()
+{
+    if (storage)
+        return "#extension GL_ARB_shader_storage_buffer_object : require\n"
+               "#define LIGHT_STORAGE\n";
+    return "#define MAX_LIGHTS " + std::to_string(capacity) + "\n";
+}
+
+void LightBuffer::BindBlock(const int programId)
+{
+    if (storage) {
+        GLuint index = glGetProgramResourceIndex(programId, GL_SHADER_STORAGE_BLOCK, "LightBlock");
+        if (index != GL_INVALID_INDEX)
+            glShaderStorageBlockBinding(programId, index, lightBinding); }
+    else {
+        GLuint index = glGetUniformBlockIndex(programId, "LightBlock");
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(programId, index, lightBinding); }
+    CHECKERROR;
+}
+
+// Fills the CPU side copy and replaces the buffer's store in one call.
+// A uniform block's store is always allocated at its full declared
+// size, since reading past a too small store is undefined.
+void LightBuffer::Upload(const std::vector<glm::vec3>& positions,
+                         const std::vector<glm::vec3>& colors,
+                         const std::vector<float>& radii,
+                         const float linear, const float quadratic)
+{
+    count = std::min(int(positions.size()), capacity);
+    data.resize(storage ? std::max(count, 1) : capacity);
+    for (int i=0;  i<count;  i++) {
+        LightData& d = data[i];
+        d.position = positions[i];
+        d.radius = radii[i];
+        d.color = colors[i];
+        d.linear = linear;
+        d.quadratic = quadratic; }
+
+    GLenum target = storage ? GL_SHADER_STORAGE_BUFFER : GL_UNIFORM_BUFFER;
+    glBindBuffer(target, bufferId);
+    glBufferData(target, sizeof(LightData)*data.size(), &data[0], GL_STREAM_DRAW);
+    glBindBuffer(target, 0);
+    CHECKERROR;
+}
+
+void LightBuffer::Bind()
+{
+    glBindBufferBase(storage ? GL_SHADER_STORAGE_BUFFER : GL_UNIFORM_BUFFER, lightBinding, bufferId);
+}
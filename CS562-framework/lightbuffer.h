@@ -0,0 +1,61 @@
+///////////////////////////////////////////////////////////////////////
+// GPU storage for the scene's lights, shared by the lighting shaders
+// and the cluster assignment compute shader.
+//
+// On a GL 4.3 context the lights live in a shader storage buffer of
+// any length; otherwise they live in a std140 uniform block whose
+// array size (MAX_LIGHTS) is fixed by GL_MAX_UNIFORM_BLOCK_SIZE.
+// Either way the whole array is refilled with one buffer update per
+// frame, and shaders loop over the uniform lightCount.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _LIGHTBUFFER
+#define _LIGHTBUFFER
+
+#include <string>
+#include <vector>
+
+// One light, laid out identically under std140 and std430.  This must
+// agree with the Light struct in lightingPhong.frag and
+// clusterLights.comp.
+struct LightData
+{
+    glm::vec3 position;
+    float radius;
+    glm::vec3 color;
+    float linear;
+    float quadratic;
+    float pad[3];
+};
+
+class LightBuffer
+{
+public:
+    bool storage;               // Shader storage buffer (GL 4.3) rather than a uniform block
+    int capacity;               // Most lights the buffer can hold
+    int count;                  // Lights in the most recent Upload
+    unsigned int bufferId;
+
+    LightBuffer();
+
+    // Preprocessor lines selecting the matching LightBlock declaration;
+    // pass these to ShaderProgram::AddShader for any shader using it.
+    std::string Defines();
+
+    // Attach a linked program's LightBlock to this buffer's binding point.
+    void BindBlock(const int programId);
+
+    // Refill the buffer with the given lights (at most capacity of them).
+    void Upload(const std::vector<glm::vec3>& positions,
+                const std::vector<glm::vec3>& colors,
+                const std::vector<float>& radii,
+                const float linear, const float quadratic);
+
+    // Bind the buffer to its binding point.
+    void Bind();
+
+private:
+    std::vector<LightData> data;
+};
+
+#endif
@@ -0,0 +1,356 @@
+///////////////////////////////////////////////////////////////////////
+// Light binning for the deferred lighting pass.  See lightgrid.h for
+// a description of the data layout.
+////////////////////////////////////////////////////////////////////////
+
+#include "math.h"
+#include <stdlib.h>
+#include <algorithm>
+
+#include <glbinding/gl/gl.h>
+#include <glbinding/Binding.h>
+using namespace gl;
+
+#define GLM_FORCE_CTOR_INIT
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+
+#include "shader.h"
+#include "lightgrid.h"
+
+#include <glu.h>                // For gluErrorString
+#define CHECKERROR {GLenum err = glGetError(); if (err != GL_NO_ERROR) { fprintf(stderr, "OpenGL error (at line lightgrid.cpp:%d): %s\n", __LINE__, gluErrorString(err)); exit(-1);} }
+
+// Work group size of clusterLights.comp
+const int clusterGroupSize = 128;
+
+LightGrid::LightGrid(const int _tileSize, const int _clusterTileSize, const int _clusterSlices)
+    : tileSize(_tileSize), clusterTileSize(_clusterTileSize), clusterSlices(_clusterSlices),
+      tilesX(0), tilesY(0), sliceScale(0.0f), sliceBias(0.0f),
+      computeAvailable(false), useCompute(false), maxLightsPerCluster(256),
+      clusterProgram(NULL), overflowIndex(0),
+      overflowClusters(0), droppedLights(0), maxClusterLights(0),
+      lightCount(0), visibleLights(0), maxLightsPerTile(0), averageLightsPerTile(0.0f)
+{
+    glGenBuffers(1, &gridBuffer);
+    glGenTextures(1, &gridTexture);
+    glGenBuffers(1, &indexBuffer);
+    glGenTextures(1, &indexTexture);
+
+    // Texture buffers must have a store before they can be attached.
+    glBindBuffer(GL_TEXTURE_BUFFER, gridBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::uvec2), NULL, GL_STREAM_DRAW);
+    glBindTexture(GL_TEXTURE_BUFFER, gridTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, gridBuffer);
+
+    glBindBuffer(GL_TEXTURE_BUFFER, indexBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(unsigned int), NULL, GL_STREAM_DRAW);
+    glBindTexture(GL_TEXTURE_BUFFER, indexTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, indexBuffer);
+
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    // Compute shaders and storage buffers need GL 4.3.
+    int major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    computeAvailable = major > 4 || (major == 4 && minor >= 3);
+    for (int i=0;  i<overflowRing;  i++) {
+        overflowBuffers[i] = 0;
+        overflowFences[i] = 0; }
+    if (computeAvailable) {
+        clusterProgram = new ShaderProgram();
+        clusterProgram->AddShader("clusterLights.comp", GL_COMPUTE_SHADER);
+        clusterProgram->LinkProgram();
+        clusterUniforms.WorldView = clusterProgram->Uniform("WorldView");
+        clusterUniforms.clusterDims = clusterProgram->Uniform("clusterDims");
+        clusterUniforms.cellNdc = clusterProgram->Uniform("cellNdc");
+        clusterUniforms.tanHalf = clusterProgram->Uniform("tanHalf");
+        clusterUniforms.front = clusterProgram->Uniform("front");
+        clusterUniforms.back = clusterProgram->Uniform("back");
+        clusterUniforms.lightCount = clusterProgram->Uniform("lightCount");
+        clusterUniforms.maxLightsPerCluster = clusterProgram->Uniform("maxLightsPerCluster");
+
+        glGenBuffers(overflowRing, overflowBuffers);
+        for (int i=0;  i<overflowRing;  i++) {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, overflowBuffers[i]);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, 3*sizeof(unsigned int), NULL, GL_STREAM_READ);
+            glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL); }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0); }
+    useCompute = computeAvailable;
+    CHECKERROR;
+}
+
+// Computes the (inclusive) range of cells covered by a light's
+// bounding sphere, given its view space center c.  The eight corners
+// of the sphere's view space bounding box are projected, which is
+// conservative but cheap.  Returns false if the light cannot touch
+// any pixel.
+bool LightGrid::TileRect(const glm::vec3& c, const float radius, const glm::mat4& WorldProj,
+                         const float front, const int cellSize, const int width, const int height,
+                         glm::ivec4& rect)
+{
+    // Entirely behind the near plane
+    if (c.z - radius > -front)
+        return false;
+
+    glm::vec2 lo(-1.0f), hi(1.0f);
+    if (c.z + radius < -front) {
+        // Entirely in front of the near plane: all corners have w > 0.
+        lo = glm::vec2(1.0f);
+        hi = glm::vec2(-1.0f);
+        for (int i=0;  i<8;  i++) {
+            glm::vec4 corner(c.x + ((i&1) ? radius : -radius),
+                             c.y + ((i&2) ? radius : -radius),
+                             c.z + ((i&4) ? radius : -radius), 1.0f);
+            glm::vec4 p = WorldProj*corner;
+            glm::vec2 ndc = glm::vec2(p.x, p.y)/p.w;
+            lo = glm::min(lo, ndc);
+            hi = glm::max(hi, ndc); }
+        if (hi.x < -1.0f || hi.y < -1.0f || lo.x > 1.0f || lo.y > 1.0f)
+            return false;
+        lo = glm::clamp(lo, -1.0f, 1.0f);
+        hi = glm::clamp(hi, -1.0f, 1.0f); }
+    // else: the sphere straddles the near plane, so it covers the whole screen.
+
+    rect.x = int((lo.x*0.5f + 0.5f)*width)/cellSize;
+    rect.y = int((lo.y*0.5f + 0.5f)*height)/cellSize;
+    rect.z = std::min(int((hi.x*0.5f + 0.5f)*width)/cellSize, tilesX-1);
+    rect.w = std::min(int((hi.y*0.5f + 0.5f)*height)/cellSize, tilesY-1);
+    return true;
+}
+
+// View space bounding box of cluster (x,y,z).  Slices are spaced
+// exponentially, so slice k spans depths front*(back/front)^(k/S) to
+// front*(back/front)^((k+1)/S).  This must agree with clusterLights.comp.
+void LightGrid::ClusterBox(const int x, const int y, const int z, const glm::vec2& cellNdc,
+                           const glm::vec2& tanHalf, const float front, const float back,
+                           glm::vec3& lo, glm::vec3& hi)
+{
+    glm::vec2 n0 = glm::vec2(x, y)*cellNdc - 1.0f;
+    glm::vec2 n1 = glm::min(glm::vec2(x+1, y+1)*cellNdc - 1.0f, glm::vec2(1.0f));
+    float d0 = front*powf(back/front, float(z)/clusterSlices);
+    float d1 = front*powf(back/front, float(z+1)/clusterSlices);
+
+    lo = glm::vec3(1e30f);
+    hi = glm::vec3(-1e30f);
+    for (int i=0;  i<8;  i++) {
+        glm::vec2 n((i&1) ? n1.x : n0.x, (i&2) ? n1.y : n0.y);
+        float d = (i&4) ? d1 : d0;
+        glm::vec3 p(n.x*tanHalf.x*d, n.y*tanHalf.y*d, -d);
+        lo = glm::min(lo, p);
+        hi = glm::max(hi, p); }
+}
+
+// Bins every light into the tiles its bounding sphere covers, then
+// uploads the per-tile ranges and the flattened index list.  Uses a
+// counting sort (count, prefix sum, scatter) so no per-tile
+// containers are allocated.
+void LightGrid::Build(const std::vector<glm::vec3>& positions,
+                      const std::vector<float>& radii,
+                      const glm::mat4& WorldView, const glm::mat4& WorldProj,
+                      const float front, const int width, const int height)
+{
+    tilesX = (width + tileSize - 1)/tileSize;
+    tilesY = (height + tileSize - 1)/tileSize;
+    const int tileCount = tilesX*tilesY;
+    if (tileCount == 0) return; // Minimized window
+
+    lightCount = positions.size();
+    rects.resize(lightCount);
+    ranges.assign(tileCount, glm::uvec2(0, 0));
+
+    // Count the lights touching each tile.
+    visibleLights = 0;
+    for (int i=0;  i<lightCount;  i++) {
+        glm::ivec4& r = rects[i];
+        glm::vec3 c = glm::vec3(WorldView*glm::vec4(positions[i], 1.0f));
+        if (!TileRect(c, radii[i], WorldProj, front, tileSize, width, height, r)) {
+            r = glm::ivec4(0, 0, -1, -1);
+            continue; }
+        visibleLights++;
+        for (int y=r.y;  y<=r.w;  y++)
+            for (int x=r.x;  x<=r.z;  x++)
+                ranges[y*tilesX + x].y++; }
+
+    // Prefix sum for the offsets
+    unsigned int total = 0;
+    maxLightsPerTile = 0;
+    for (int t=0;  t<tileCount;  t++) {
+        ranges[t].x = total;
+        total += ranges[t].y;
+        maxLightsPerTile = std::max(maxLightsPerTile, int(ranges[t].y));
+        ranges[t].y = 0; }
+    averageLightsPerTile = float(total)/tileCount;
+
+    // Scatter the light indices, restoring the counts as we go.
+    indices.resize(std::max(total, 1u));
+    for (int i=0;  i<lightCount;  i++) {
+        const glm::ivec4& r = rects[i];
+        for (int y=r.y;  y<=r.w;  y++)
+            for (int x=r.x;  x<=r.z;  x++) {
+                glm::uvec2& range = ranges[y*tilesX + x];
+                indices[range.x + range.y++] = i; } }
+
+    Upload();
+}
+
+// Assigns every light to the clusters its bounding sphere intersects.
+void LightGrid::BuildClusters(const std::vector<glm::vec3>& positions,
+                              const std::vector<float>& radii,
+                              const glm::mat4& WorldView, const glm::mat4& WorldProj,
+                              const int width, const int height,
+                              const unsigned int lightStorage)
+{
+    tilesX = (width + clusterTileSize - 1)/clusterTileSize;
+    tilesY = (height + clusterTileSize - 1)/clusterTileSize;
+    const int clusterCount = tilesX*tilesY*clusterSlices;
+    if (clusterCount == 0) return; // Minimized window
+
+    // Recover the front and back planes and the field of view from
+    // the projection built by Perspective().
+    const float front = WorldProj[3][2]/(WorldProj[2][2] - 1.0f);
+    const float back = WorldProj[3][2]/(WorldProj[2][2] + 1.0f);
+    const glm::vec2 tanHalf(1.0f/WorldProj[0][0], 1.0f/WorldProj[1][1]);
+    const glm::vec2 cellNdc(2.0f*clusterTileSize/width, 2.0f*clusterTileSize/height);
+    sliceScale = clusterSlices/logf(back/front);
+    sliceBias = -logf(front)*sliceScale;
+
+    lightCount = positions.size();
+
+    if (useCompute && lightStorage != 0) {
+        // Collect the overflow of every earlier dispatch whose fence
+        // has signalled, oldest first; a zero timeout never waits on
+        // the GPU, and unfinished ones keep the old statistics.  On
+        // overflow, grow the capacity to the next power of two that
+        // would have fit.
+        for (int k=1;  k<=overflowRing;  k++) {
+            const int i = (overflowIndex + k) % overflowRing;
+            if (overflowFences[i] == 0) continue;
+            GLenum status = glClientWaitSync(overflowFences[i], GL_NONE_BIT, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) continue;
+            glDeleteSync(overflowFences[i]);
+            overflowFences[i] = 0;
+
+            glm::uvec3 overflow;
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, overflowBuffers[i]);
+            glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(overflow), &overflow[0]);
+            overflowClusters = overflow[0];
+            droppedLights = overflow[1];
+            maxClusterLights = overflow[2];
+            while (maxLightsPerCluster < maxClusterLights)
+                maxLightsPerCluster *= 2; }
+
+        // Write this dispatch's overflow into a free buffer.  If every
+        // buffer is still in flight, reuse the oldest one and drop its
+        // counts rather than wait.
+        overflowIndex = (overflowIndex + 1) % overflowRing;
+        if (overflowFences[overflowIndex] != 0) {
+            glDeleteSync(overflowFences[overflowIndex]);
+            overflowFences[overflowIndex] = 0; }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, overflowBuffers[overflowIndex]);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+
+        // Each cluster owns a fixed slice of the index buffer.
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, gridBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::uvec2)*clusterCount, NULL, GL_STREAM_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, indexBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(unsigned int)*clusterCount*maxLightsPerCluster,
+                     NULL, GL_STREAM_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, gridBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, indexBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, overflowBuffers[overflowIndex]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, lightStorage);
+
+        clusterProgram->UseShader();
+        clusterProgram->Set(clusterUniforms.WorldView, WorldView);
+        clusterProgram->Set(clusterUniforms.clusterDims, glm::ivec3(tilesX, tilesY, clusterSlices));
+        clusterProgram->Set(clusterUniforms.cellNdc, cellNdc);
+        clusterProgram->Set(clusterUniforms.tanHalf, tanHalf);
+        clusterProgram->Set(clusterUniforms.front, front);
+        clusterProgram->Set(clusterUniforms.back, back);
+        clusterProgram->Set(clusterUniforms.lightCount, lightCount);
+        clusterProgram->Set(clusterUniforms.maxLightsPerCluster, maxLightsPerCluster);
+        glDispatchCompute((clusterCount + clusterGroupSize - 1)/clusterGroupSize, 1, 1);
+        clusterProgram->UnuseShader();
+
+        // The lighting pass reads the results through texture buffers,
+        // and a later Build the overflow counters once the fence has
+        // signalled.
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+        overflowFences[overflowIndex] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, GL_NONE_BIT);
+        CHECKERROR;
+        return; }
+
+    // CPU fallback: collect (cluster, light) pairs, then counting sort
+    // them by cluster.
+    ranges.assign(clusterCount, glm::uvec2(0, 0));
+    pairs.clear();
+    visibleLights = 0;
+    for (int i=0;  i<lightCount;  i++) {
+        glm::vec3 c = glm::vec3(WorldView*glm::vec4(positions[i], 1.0f));
+        float r = radii[i];
+        glm::ivec4 rect;
+        if (-c.z - r > back) continue;
+        if (!TileRect(c, r, WorldProj, front, clusterTileSize, width, height, rect)) continue;
+
+        // Depth slices spanned by the sphere
+        float dmin = std::max(-c.z - r, front);
+        float dmax = std::min(-c.z + r, back);
+        int z0 = glm::clamp(int(floorf(logf(dmin)*sliceScale + sliceBias)), 0, clusterSlices-1);
+        int z1 = glm::clamp(int(floorf(logf(dmax)*sliceScale + sliceBias)), 0, clusterSlices-1);
+
+        bool touched = false;
+        for (int z=z0;  z<=z1;  z++)
+            for (int y=rect.y;  y<=rect.w;  y++)
+                for (int x=rect.x;  x<=rect.z;  x++) {
+                    // Exact sphere/box test against this cluster
+                    glm::vec3 lo, hi;
+                    ClusterBox(x, y, z, cellNdc, tanHalf, front, back, lo, hi);
+                    glm::vec3 d = glm::clamp(c, lo, hi) - c;
+                    if (glm::dot(d, d) > r*r) continue;
+                    unsigned int cell = (z*tilesY + y)*tilesX + x;
+                    pairs.push_back(glm::uvec2(cell, i));
+                    ranges[cell].y++;
+                    touched = true; }
+        if (touched) visibleLights++; }
+
+    unsigned int total = 0;
+    maxLightsPerTile = 0;
+    for (int t=0;  t<clusterCount;  t++) {
+        ranges[t].x = total;
+        total += ranges[t].y;
+        maxLightsPerTile = std::max(maxLightsPerTile, int(ranges[t].y));
+        ranges[t].y = 0; }
+    averageLightsPerTile = float(total)/clusterCount;
+
+    indices.resize(std::max(total, 1u));
+    for (size_t p=0;  p<pairs.size();  p++) {
+        glm::uvec2& range = ranges[pairs[p].x];
+        indices[range.x + range.y++] = pairs[p].y; }
+
+    Upload();
+}
+
+// Orphan and refill both texture buffers from the CPU side arrays.
+void LightGrid::Upload()
+{
+    glBindBuffer(GL_TEXTURE_BUFFER, gridBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::uvec2)*ranges.size(), &ranges[0], GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, indexBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(unsigned int)*indices.size(), &indices[0], GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    CHECKERROR;
+}
+
+void LightGrid::BindTextures(const int gridUnit, const int indexUnit)
+{
+    glActiveTexture((gl::GLenum)((int)GL_TEXTURE0 + gridUnit));
+    glBindTexture(GL_TEXTURE_BUFFER, gridTexture);
+    glActiveTexture((gl::GLenum)((int)GL_TEXTURE0 + indexUnit));
+    glBindTexture(GL_TEXTURE_BUFFER, indexTexture);
+}
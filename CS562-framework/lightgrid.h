@@ -0,0 +1,107 @@
+///////////////////////////////////////////////////////////////////////
+// Light binning for the deferred lighting pass.
+//
+// Tiled:  The screen is split into square tiles, each light's
+// bounding sphere is projected to a screen rectangle, and the light's
+// index is appended to every tile that rectangle touches.
+//
+// Clustered: The view frustum is additionally split into depth slices
+// (exponentially spaced between the front and back planes), and a
+// light is only appended to the clusters (froxels) whose view space
+// bounding box its sphere actually intersects.  On a GL 4.3 context
+// the assignment runs in a compute shader; otherwise it runs on the
+// CPU.
+//
+// Either way the per-cell (offset, count) pairs and the flattened
+// index list are stored in two texture buffers which the lighting
+// shader reads with texelFetch, so the shading side works on a plain
+// GL 3.3 context.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _LIGHTGRID
+#define _LIGHTGRID
+
+#include <vector>
+
+class ShaderProgram;
+
+class LightGrid
+{
+public:
+    int tileSize;               // Tile edge in pixels (tiled mode)
+    int clusterTileSize;        // Cluster edge in pixels (clustered mode)
+    int clusterSlices;          // Number of depth slices (clustered mode)
+    int tilesX, tilesY;         // Screen grid dimensions of the last Build
+    float sliceScale, sliceBias;// slice = log(viewDepth)*sliceScale + sliceBias
+
+    // Texture buffers read by the lighting shader:
+    //   gridTexture:  RG32UI, (offset, count) for each tile or cluster
+    //   indexTexture: R32UI, light indices referenced by the offsets
+    unsigned int gridBuffer, gridTexture;
+    unsigned int indexBuffer, indexTexture;
+
+    // Compute path: the assignment program.  useCompute is false on GL < 4.3.
+    bool computeAvailable, useCompute;
+    int maxLightsPerCluster;    // Per-cluster capacity of the compute path
+    ShaderProgram* clusterProgram;
+    struct { int WorldView, clusterDims, cellNdc, tanHalf, front, back,
+                 lightCount, maxLightsPerCluster; } clusterUniforms;
+
+    // Overflow counters of clusterLights.comp, in a small ring.  Each
+    // Build writes one buffer and fences it; a buffer is read back only
+    // once its fence has signalled, so the readback never stalls.
+    static const int overflowRing = 3;
+    unsigned int overflowBuffers[overflowRing];
+    gl::GLsync overflowFences[overflowRing];
+    int overflowIndex;
+
+    // Overflow of the compute path, from the latest finished Build.
+    // Lights past a cluster's capacity are not shaded there, so the
+    // capacity is then raised to fit for later frames.
+    int overflowClusters;       // Clusters that dropped lights
+    int droppedLights;          // Lights dropped over all clusters
+    int maxClusterLights;       // Most lights touching one cluster
+
+    // Statistics from the most recent Build (CPU paths only)
+    int lightCount;             // Lights submitted
+    int visibleLights;          // Lights that touched at least one cell
+    int maxLightsPerTile;
+    float averageLightsPerTile;
+
+    LightGrid(const int _tileSize=16, const int _clusterTileSize=64, const int _clusterSlices=24);
+
+    // Bin the lights into screen tiles for a viewport of size width by height.
+    void Build(const std::vector<glm::vec3>& positions,
+               const std::vector<float>& radii,
+               const glm::mat4& WorldView, const glm::mat4& WorldProj,
+               const float front, const int width, const int height);
+
+    // Assign the lights to view frustum clusters, on the GPU if
+    // possible, else on the CPU.  The GPU path reads the lights from
+    // lightStorage, a LightBuffer storage buffer already holding the
+    // same lights; pass 0 if there is none.
+    void BuildClusters(const std::vector<glm::vec3>& positions,
+                       const std::vector<float>& radii,
+                       const glm::mat4& WorldView, const glm::mat4& WorldProj,
+                       const int width, const int height,
+                       const unsigned int lightStorage=0);
+
+    // Bind the grid and index texture buffers to two texture units.
+    void BindTextures(const int gridUnit, const int indexUnit);
+
+private:
+    std::vector<glm::ivec4> rects;      // Per-light cell rectangle (x0,y0,x1,y1), inclusive
+    std::vector<glm::uvec2> ranges;     // Per-cell (offset, count)
+    std::vector<unsigned int> indices;  // Flattened per-cell light lists
+    std::vector<glm::uvec2> pairs;      // (cluster, light) scratch for the CPU cluster path
+
+    bool TileRect(const glm::vec3& c, const float radius, const glm::mat4& WorldProj,
+                  const float front, const int cellSize, const int width, const int height,
+                  glm::ivec4& rect);
+    void ClusterBox(const int x, const int y, const int z, const glm::vec2& cellNdc,
+                    const glm::vec2& tanHalf, const float front, const float back,
+                    glm::vec3& lo, glm::vec3& hi);
+    void Upload();
+};
+
+#endif
@@ -1,5 +1,9 @@
 /////////////////////////////////////////////////////////////////////////
 // Pixel shader for lighting
+//
+// Compiled with LIGHT_VOLUME defined, this shades a single light
+// (lightIndex) for the pixels covered by that light's sphere, and
+// the results are blended additively.
 ////////////////////////////////////////////////////////////////////////
 #version 330
 
@@ -35,51 +39,151 @@ uniform sampler2D gPosition;
 uniform sampler2D gNormal;
 uniform sampler2D gDiffuse;
 uniform sampler2D gSpecular;
+uniform sampler2D gDepth;
 
+// Packed G-buffer (see fbo.h): position is reconstructed from gDepth,
+// gNormal is octahedral encoded, and gDiffuse.a holds the specular.
+uniform bool packedGBuffer;
+uniform mat4 WorldInverse;      // View to world
+uniform mat4 ProjInverse;       // Clip to view
+
+// All lights, with the global light last.  The layout agrees with
+// LightData in lightbuffer.h; LightBuffer::Defines selects a storage
+// block (GL 4.3) or a uniform block of MAX_LIGHTS.
 struct Light {
     vec3 Position;
+    float Radius;
     vec3 Color;
-    
     float Linear;
     float Quadratic;
-    float Radius;
 };
-const int NR_LIGHTS = 33;
-uniform Light lights[NR_LIGHTS];
+#ifdef LIGHT_STORAGE
+layout (std430) buffer LightBlock { Light lights[]; };
+#else
+#ifndef MAX_LIGHTS
+#define MAX_LIGHTS 256
+#endif
+layout (std140) uniform LightBlock { Light lights[MAX_LIGHTS]; };
+#endif
+uniform int lightCount;
 uniform vec3 viewPos;
 
+// These definitions agree with the LightingModes enum in scene.h
+const int     lightAll	= 0;
+const int     lightTiled	= 1;
+const int     lightClustered	= 2;
+const int     lightVolumes	= 3;
+uniform int lightingMode;
+
+// Light volume mode: the light being drawn and the viewport size
+uniform int lightIndex;
+uniform vec2 screenSize;
+
+// Tiled and clustered modes: per-cell (offset,count) and the
+// flattened light index list, both built by LightGrid.
+uniform usamplerBuffer tileGrid;
+uniform usamplerBuffer tileLights;
+uniform int tileSize;
+uniform int tilesX, tilesY;
+
+// Clustered mode: slice = log(viewDepth)*sliceScale + sliceBias
+uniform mat4 WorldView;
+uniform int clusterSlices;
+uniform float sliceScale, sliceBias;
+
+vec3 OctDecode(vec2 e)
+{
+    e = e*2.0 - 1.0;
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = clamp(-n.z, 0.0, 1.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+// Fetch the surface at G-buffer coordinate uv, in either layout.
+void ReadGBuffer(vec2 uv, out vec3 FragPos, out vec3 Normal, out vec3 Diffuse, out float Specular)
+{
+    if (packedGBuffer) {
+        float depth = texture(gDepth, uv).r;
+        vec4 view = ProjInverse*vec4(uv*2.0 - 1.0, depth*2.0 - 1.0, 1.0);
+        FragPos = (WorldInverse*vec4(view.xyz/view.w, 1.0)).xyz;
+        Normal = OctDecode(texture(gNormal, uv).rg);
+        vec4 albedoSpec = texture(gDiffuse, uv);
+        Diffuse = albedoSpec.rgb;
+        Specular = albedoSpec.a;
+    }
+    else {
+        FragPos = texture(gPosition, uv).rgb;
+        Normal = texture(gNormal, uv).rgb;
+        Diffuse = texture(gDiffuse, uv).rgb;
+        Specular = texture(gSpecular, uv).r;
+    }
+}
+
+// Diffuse + specular contribution of light i
+vec3 Shade(int i, vec3 FragPos, vec3 Normal, vec3 Diffuse, float Specular, vec3 viewDir)
+{
+    float distance = length(lights[i].Position - FragPos);
+    if(distance >= lights[i].Radius)
+        return vec3(0.0);
+
+    // diffuse
+    vec3 lightDir = normalize(lights[i].Position - FragPos);
+    vec3 diffuse = max(dot(Normal, lightDir), 0.0) * Diffuse * lights[i].Color;
+    // specular
+    vec3 halfwayDir = normalize(lightDir + viewDir);  
+    float spec = pow(max(dot(Normal, halfwayDir), 0.0), 16.0);
+    vec3 specular = lights[i].Color * spec * Specular;
+    // attenuation
+    float attenuation = 1.0 / (1.0 + lights[i].Linear * distance + lights[i].Quadratic * distance * distance);
+    return (diffuse + specular) * attenuation;
+}
+
 void main()
 {
-    vec3 FragPos = texture(gPosition, TexCoords).rgb;
-    vec3 Normal = texture(gNormal, TexCoords).rgb;
-    vec3 Diffuse = texture(gDiffuse, TexCoords).rgb;
-    float Specular = texture(gSpecular, TexCoords).a;
+#ifdef LIGHT_VOLUME
+    vec2 uv = gl_FragCoord.xy / screenSize;
+#else
+    vec2 uv = TexCoords;
+#endif
+    vec3 FragPos, Normal, Diffuse;
+    float Specular;
+    ReadGBuffer(uv, FragPos, Normal, Diffuse, Specular);
+    vec3 viewDir  = normalize(viewPos - FragPos);
 
+#ifdef LIGHT_VOLUME
+    // Only this light's contribution; ambient comes from the full-screen pass.
+    FragColor = vec4(Shade(lightIndex, FragPos, Normal, Diffuse, Specular, viewDir), 1.0);
+#else
     // then calculate lighting as usual
     vec3 ambient  = Diffuse * 0.2; // hard-coded ambient component
-    vec3 viewDir  = normalize(viewPos - FragPos);
 
-    for(int i = 0; i < NR_LIGHTS; ++i)
-    {
-        // diffuse
-        vec3 lightDir = normalize(lights[i].Position - FragPos);
-        vec3 diffuse = max(dot(Normal, lightDir), 0.0) * Diffuse * lights[i].Color;
-        // specular
-        vec3 halfwayDir = normalize(lightDir + viewDir);  
-        float spec = pow(max(dot(Normal, halfwayDir), 0.0), 16.0);
-        vec3 specular = lights[i].Color * spec * Specular;
-        // attenuation
-        float distance = length(lights[i].Position - FragPos);
-        if(distance < lights[i].Radius)
+    if (lightingMode == lightTiled || lightingMode == lightClustered) {
+        ivec2 tile = ivec2(gl_FragCoord.xy) / tileSize;
+        int cell = tile.y*tilesX + tile.x;
+        if (lightingMode == lightClustered) {
+            float depth = -(WorldView*vec4(FragPos, 1.0)).z;
+            int slice = clamp(int(floor(log(max(depth, 1e-4))*sliceScale + sliceBias)), 0, clusterSlices-1);
+            cell += slice*tilesX*tilesY;
+        }
+        uvec2 range = texelFetch(tileGrid, cell).xy;
+        for(uint k = 0u; k < range.y; ++k)
         {
-            float attenuation = 1.0 / (1.0 + lights[i].Linear * distance + lights[i].Quadratic * distance * distance);
-            diffuse *= attenuation;
-            specular *= attenuation;
-            ambient += diffuse + specular;        
+            int i = int(texelFetch(tileLights, int(range.x + k)).r);
+            ambient += Shade(i, FragPos, Normal, Diffuse, Specular, viewDir);
         }
-        
+    }
+    else if (lightingMode == lightVolumes) {
+        // Local lights are drawn as volumes; only the global light is left.
+        ambient += Shade(lightCount-1, FragPos, Normal, Diffuse, Specular, viewDir);
+    }
+    else {
+        for(int i = 0; i < lightCount; ++i)
+            ambient += Shade(i, FragPos, Normal, Diffuse, Specular, viewDir);
     }
     FragColor = vec4(ambient, 1.0);
+#endif
 }
 
 
@@ -0,0 +1,192 @@
+///////////////////////////////////////////////////////////////////////
+// A cooked binary mesh cache.  See meshcache.h.
+////////////////////////////////////////////////////////////////////////
+
+#include "math.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define GLM_FORCE_CTOR_INIT
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+
+#include "shapes.h"
+#include "meshcache.h"
+
+const char meshCacheMagic[8] = { 'C', 'S', 'M', 'E', 'S', 'H', '0', '3' };
+
+struct MeshCacheHeader
+{
+    char magic[8];
+    unsigned long long key;
+    unsigned long long hash;    // Of everything after the header
+    long long sourceSize, sourceTime; // Of the source file; -1 for none
+    unsigned int pntCount, nrmCount, texCount, tanCount, someCount, triCount;
+    float minP[3], maxP[3];
+    float cacheBefore[2], cacheAfter[2]; // ACMR and ATVR
+};
+
+unsigned long long HashBytes(const void* data, const size_t size, unsigned long long hash)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    for (size_t i=0;  i<size;  i++)
+        hash = (hash ^ p[i])*1099511628211ull;
+    return hash;
+}
+
+MappedFile::MappedFile(const char* path)
+    : data(NULL), size(0), file(NULL), mapping(NULL), fd(-1)
+{
+#ifdef _WIN32
+    HANDLE h = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE) return;
+    file = h;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(h, &fileSize) || fileSize.QuadPart == 0) return;
+    mapping = CreateFileMappingA(h, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping) return;
+    data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (data) size = fileSize.QuadPart;
+#else
+    fd = open(path, O_RDONLY);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) return;
+    void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) return;
+    data = (const unsigned char*)p;
+    size = st.st_size;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+    if (data) UnmapViewOfFile(data);
+    if (mapping) CloseHandle(mapping);
+    if (file) CloseHandle(file);
+#else
+    if (data) munmap((void*)data, size);
+    if (fd >= 0) close(fd);
+#endif
+}
+
+// Copies count elements of T from p into v, advancing p.
+template <typename T>
+static void ReadArray(std::vector<T>& v, const unsigned int count, const unsigned char*& p)
+{
+    v.resize(count);
+    if (count) memcpy((void*)&v[0], p, sizeof(T)*count);
+    p += sizeof(T)*count;
+}
+
+template <typename T>
+static void WriteArray(const std::vector<T>& v, FILE* f, unsigned long long& hash)
+{
+    if (v.empty()) return;
+    fwrite(&v[0], sizeof(T), v.size(), f);
+    hash = HashBytes(&v[0], sizeof(T)*v.size(), hash);
+}
+
+bool LoadMeshCache(Shape* shape, const char* path, const unsigned long long key, const char* source)
+{
+    MappedFile file(path);
+    if (!file.data || file.size < sizeof(MeshCacheHeader)) return false;
+    MeshCacheHeader header;
+    memcpy(&header, file.data, sizeof(header));
+    if (memcmp(header.magic, meshCacheMagic, sizeof(meshCacheMagic)) != 0 || header.key != key)
+        return false;
+
+    // Any change to the source, even one back to an older copy,
+    // changes its size or time.
+    struct stat sourceStat;
+    if (source && stat(source, &sourceStat) == 0
+        && (header.sourceSize != (long long)sourceStat.st_size
+            || header.sourceTime != (long long)sourceStat.st_mtime)) {
+        printf("MeshCache: %s was made from another version of %s\n", path, source);
+        return false; }
+
+    const size_t payload = sizeof(glm::vec4)*header.pntCount + sizeof(glm::vec3)*header.nrmCount
+        + sizeof(glm::vec2)*header.texCount + sizeof(glm::vec3)*header.tanCount
+        + sizeof(glm::vec2)*header.someCount + sizeof(glm::ivec3)*header.triCount;
+    const unsigned char* p = file.data + sizeof(header);
+    if (file.size != sizeof(header) + payload || HashBytes(p, payload) != header.hash) {
+        printf("MeshCache: %s is damaged\n", path);
+        return false; }
+
+    ReadArray(shape->Pnt, header.pntCount, p);
+    ReadArray(shape->Nrm, header.nrmCount, p);
+    ReadArray(shape->Tex, header.texCount, p);
+    ReadArray(shape->Tan, header.tanCount, p);
+    ReadArray(shape->Some, header.someCount, p);
+    ReadArray(shape->Tri, header.triCount, p);
+    shape->minP = glm::vec3(header.minP[0], header.minP[1], header.minP[2]);
+    shape->maxP = glm::vec3(header.maxP[0], header.maxP[1], header.maxP[2]);
+    shape->center = 0.5f*(shape->minP + shape->maxP);
+    shape->size = glm::length(shape->maxP - shape->minP);
+    shape->cacheBefore.acmr = header.cacheBefore[0];
+    shape->cacheBefore.atvr = header.cacheBefore[1];
+    shape->cacheAfter.acmr = header.cacheAfter[0];
+    shape->cacheAfter.atvr = header.cacheAfter[1];
+    shape->cooked = true;
+    printf("MeshCache: loaded %s\n", path);
+    return true;
+}
+
+bool SaveMeshCache(const Shape* shape, const char* path, const unsigned long long key, const char* source)
+{
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        printf("MeshCache: cannot write %s\n", path);
+        return false; }
+
+    MeshCacheHeader header;
+    memcpy(header.magic, meshCacheMagic, sizeof(meshCacheMagic));
+    header.key = key;
+    header.hash = 0;
+    header.sourceSize = header.sourceTime = -1;
+    struct stat sourceStat;
+    if (source && stat(source, &sourceStat) == 0) {
+        header.sourceSize = sourceStat.st_size;
+        header.sourceTime = sourceStat.st_mtime; }
+    header.pntCount = shape->Pnt.size();
+    header.nrmCount = shape->Nrm.size();
+    header.texCount = shape->Tex.size();
+    header.tanCount = shape->Tan.size();
+    header.someCount = shape->Some.size();
+    header.triCount = shape->Tri.size();
+    for (int c=0;  c<3;  c++) {
+        header.minP[c] = shape->minP[c];
+        header.maxP[c] = shape->maxP[c]; }
+    header.cacheBefore[0] = shape->cacheBefore.acmr;
+    header.cacheBefore[1] = shape->cacheBefore.atvr;
+    header.cacheAfter[0] = shape->cacheAfter.acmr;
+    header.cacheAfter[1] = shape->cacheAfter.atvr;
+
+    // The header goes in last, once the hash is known.
+    fwrite(&header, sizeof(header), 1, f);
+    unsigned long long hash = HashBytes(NULL, 0);
+    WriteArray(shape->Pnt, f, hash);
+    WriteArray(shape->Nrm, f, hash);
+    WriteArray(shape->Tex, f, hash);
+    WriteArray(shape->Tan, f, hash);
+    WriteArray(shape->Some, f, hash);
+    WriteArray(shape->Tri, f, hash);
+    header.hash = hash;
+    fseek(f, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, f);
+    const bool ok = ferror(f) == 0;
+    fclose(f);
+    if (!ok) remove(path);
+    return ok;
+}
@@ -0,0 +1,63 @@
+///////////////////////////////////////////////////////////////////////
+// A cooked binary mesh cache.  A cache file holds a Shape's final
+// Pnt, Nrm, Tex, Tan, Some and Tri arrays (after normal and tangent
+// generation and mesh optimization), its bounds and vertex cache
+// statistics, the key of the parameters it was made with, the size
+// and modification time of the file it was made from (if any), and a
+// hash of the data:
+//
+//   MeshCacheHeader
+//   Pnt  (glm::vec4  x pntCount)
+//   Nrm  (glm::vec3  x nrmCount)
+//   Tex  (glm::vec2  x texCount)
+//   Tan  (glm::vec3  x tanCount)
+//   Some (glm::vec2  x someCount)
+//   Tri  (glm::ivec3 x triCount)
+//
+// LoadMeshCache maps the file and copies the arrays out in one pass,
+// and marks the Shape cooked, so MakeVAO goes straight to uploading.
+// A file made from another version of its source (a different size or
+// modification time, in either direction), made with another key, or
+// that fails its hash, is ignored (and rewritten by the next
+// SaveMeshCache).
+// The files use the machine's byte order; they are a local cache, not
+// an interchange format.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _MESHCACHE
+#define _MESHCACHE
+
+class Shape;
+
+// A read-only mapping of a whole file; data is NULL if that failed.
+class MappedFile
+{
+public:
+    const unsigned char* data;
+    size_t size;
+
+    MappedFile(const char* path);
+    ~MappedFile();
+
+private:
+    void* file;                 // Windows handles
+    void* mapping;
+    int fd;                     // POSIX file descriptor
+};
+
+// FNV-1a, over bytes; chain calls by passing the previous result.
+unsigned long long HashBytes(const void* data, const size_t size,
+                             unsigned long long hash=14695981039346656037ull);
+
+// Loads path into shape if it exists, was made with key, passes its
+// hash, and (if source is given and exists) was made from the file
+// source as it is now.
+bool LoadMeshCache(Shape* shape, const char* path, const unsigned long long key,
+                   const char* source=NULL);
+
+// Writes shape's arrays to path, tagged with key and with the size and
+// modification time of the file source, if given.
+bool SaveMeshCache(const Shape* shape, const char* path, const unsigned long long key,
+                   const char* source=NULL);
+
+#endif
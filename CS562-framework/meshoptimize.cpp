@@ -0,0 +1,305 @@
+///////////////////////////////////////////////////////////////////////
+// Vertex cache, overdraw and vertex fetch optimization.  See
+// meshoptimize.h.
+////////////////////////////////////////////////////////////////////////
+
+#include "math.h"
+#include <stdio.h>
+#include <algorithm>
+
+#define GLM_FORCE_CTOR_INIT
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+
+#include "shapes.h"
+#include "meshoptimize.h"
+
+// Forsyth's scoring: a vertex's score rises with how recently the
+// cache used it and with how few unemitted triangles it has left.
+const int forsythCacheSize = 32;
+const float lastTriScore = 0.75f;
+const float cacheDecayPower = 1.5f;
+const float valenceBoostScale = 2.0f;
+const float valenceBoostPower = 0.5f;
+
+static float VertexScore(const int cachePosition, const int liveTriangles)
+{
+    if (liveTriangles == 0) return -1.0f;
+
+    float score = 0.0f;
+    if (cachePosition >= 0) {
+        if (cachePosition < 3)
+            score = lastTriScore;   // Just used: no extra credit for the last triangle's own vertices
+        else {
+            const float scaler = 1.0f/(forsythCacheSize - 3);
+            score = powf(1.0f - (cachePosition - 3)*scaler, cacheDecayPower); } }
+    return score + valenceBoostScale*powf(float(liveTriangles), -valenceBoostPower);
+}
+
+// A FIFO cache simulated with timestamps: vertex v is cached while
+// fewer than cacheSize misses happened since its own.  Advancing the
+// clock by cacheSize empties it.
+struct FifoCache
+{
+    std::vector<unsigned int> stamps;
+    unsigned int clock;
+    int cacheSize;
+
+    FifoCache(const int vertexCount, const int _cacheSize)
+        : stamps(vertexCount, 0), clock(_cacheSize + 1), cacheSize(_cacheSize) {}
+
+    // Misses for triangle t
+    int Access(const glm::ivec3& t)
+    {
+        int misses = 0;
+        for (int c=0;  c<3;  c++)
+            if (clock - stamps[t[c]] > (unsigned int)cacheSize) {
+                stamps[t[c]] = clock++;
+                misses++; }
+        return misses;
+    }
+    void Flush() { clock += cacheSize + 1; }
+};
+
+VertexCacheStats AnalyzeVertexCache(const std::vector<glm::ivec3>& Tri, const int vertexCount,
+                                    const int cacheSize)
+{
+    VertexCacheStats stats = { 0.0f, 0.0f };
+    if (Tri.empty() || vertexCount == 0) return stats;
+
+    FifoCache cache(vertexCount, cacheSize);
+    std::vector<char> used(vertexCount, 0);
+    int misses = 0, usedCount = 0;
+    for (size_t t=0;  t<Tri.size();  t++) {
+        misses += cache.Access(Tri[t]);
+        for (int c=0;  c<3;  c++)
+            if (!used[Tri[t][c]]) {
+                used[Tri[t][c]] = 1;
+                usedCount++; } }
+    stats.acmr = float(misses)/Tri.size();
+    stats.atvr = float(misses)/std::max(usedCount, 1);
+    return stats;
+}
+
+void OptimizeVertexCache(std::vector<glm::ivec3>& Tri, const int vertexCount)
+{
+    const int triCount = Tri.size();
+    if (triCount == 0) return;
+
+    // Triangles around each vertex, in compressed rows
+    std::vector<int> live(vertexCount, 0), offsets(vertexCount + 1, 0), adjacency(3*triCount);
+    for (int t=0;  t<triCount;  t++)
+        for (int c=0;  c<3;  c++)
+            live[Tri[t][c]]++;
+    for (int v=0;  v<vertexCount;  v++)
+        offsets[v+1] = offsets[v] + live[v];
+    std::vector<int> fill(offsets.begin(), offsets.end() - 1);
+    for (int t=0;  t<triCount;  t++)
+        for (int c=0;  c<3;  c++)
+            adjacency[fill[Tri[t][c]]++] = t;
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> vertexScore(vertexCount), triScore(triCount, 0.0f);
+    for (int v=0;  v<vertexCount;  v++)
+        vertexScore[v] = VertexScore(-1, live[v]);
+    for (int t=0;  t<triCount;  t++)
+        for (int c=0;  c<3;  c++)
+            triScore[t] += vertexScore[Tri[t][c]];
+
+    std::vector<char> emitted(triCount, 0);
+    std::vector<glm::ivec3> result;
+    result.reserve(triCount);
+    std::vector<int> cache, next;
+    cache.reserve(forsythCacheSize + 3);
+    next.reserve(forsythCacheSize + 3);
+
+    int best = 0, cursor = 0;
+    float bestScore = triScore[0];
+    for (int t=1;  t<triCount;  t++)
+        if (triScore[t] > bestScore) {
+            bestScore = triScore[t];
+            best = t; }
+
+    while (best >= 0) {
+        const glm::ivec3 tri = Tri[best];
+        emitted[best] = 1;
+        result.push_back(tri);
+
+        // The triangle's vertices move to the front of the LRU cache.
+        next.clear();
+        for (int c=0;  c<3;  c++) {
+            const int v = tri[c];
+            next.push_back(v);
+            // Remove the emitted triangle from the vertex's live list.
+            int* row = &adjacency[offsets[v]];
+            for (int i=0;  i<live[v];  i++)
+                if (row[i] == best) {
+                    row[i] = row[live[v]-1];
+                    break; }
+            live[v]--; }
+        for (size_t i=0;  i<cache.size();  i++)
+            if (cache[i] != tri[0] && cache[i] != tri[1] && cache[i] != tri[2])
+                next.push_back(cache[i]);
+        // Evicted vertices lose their cache score, and so do their
+        // remaining triangles.
+        for (size_t i=forsythCacheSize;  i<next.size();  i++) {
+            const int v = next[i];
+            cachePosition[v] = -1;
+            const float score = VertexScore(-1, live[v]);
+            const float delta = score - vertexScore[v];
+            vertexScore[v] = score;
+            for (int k=0;  k<live[v];  k++)
+                triScore[adjacency[offsets[v] + k]] += delta; }
+        if (next.size() > size_t(forsythCacheSize)) next.resize(forsythCacheSize);
+        cache.swap(next);
+
+        // Rescore the cached vertices and their remaining triangles,
+        // picking the best of those as the next to emit.
+        for (size_t i=0;  i<cache.size();  i++) {
+            const int v = cache[i];
+            cachePosition[v] = i;
+            const float score = VertexScore(i, live[v]);
+            const float delta = score - vertexScore[v];
+            vertexScore[v] = score;
+            for (int k=0;  k<live[v];  k++)
+                triScore[adjacency[offsets[v] + k]] += delta; }
+        best = -1;
+        bestScore = -1.0f;
+        for (size_t i=0;  i<cache.size();  i++) {
+            const int v = cache[i];
+            for (int k=0;  k<live[v];  k++) {
+                const int t = adjacency[offsets[v] + k];
+                if (triScore[t] > bestScore) {
+                    bestScore = triScore[t];
+                    best = t; } } }
+
+        // Nothing adjacent to the cache left: continue with the next
+        // unemitted triangle in the original order.
+        if (best < 0) {
+            while (cursor < triCount && emitted[cursor]) cursor++;
+            if (cursor < triCount) best = cursor; } }
+
+    Tri.swap(result);
+}
+
+void OptimizeOverdraw(std::vector<glm::ivec3>& Tri, const std::vector<glm::vec4>& Pnt,
+                      const float threshold, const int cacheSize)
+{
+    const int triCount = Tri.size();
+    if (triCount == 0) return;
+
+    // Hard boundaries: triangles that miss on all three vertices start
+    // over from a cold cache anyway.
+    std::vector<int> hard;
+    {
+        FifoCache cache(Pnt.size(), cacheSize);
+        for (int t=0;  t<triCount;  t++)
+            if (cache.Access(Tri[t]) == 3)
+                hard.push_back(t); }
+    if (hard.empty() || hard[0] != 0) hard.insert(hard.begin(), 0);
+    hard.push_back(triCount);
+
+    // Soft boundaries: within each hard cluster, end a cluster as soon
+    // as its cold-start miss ratio is within threshold of the whole
+    // hard cluster's.
+    std::vector<int> starts;
+    FifoCache cache(Pnt.size(), cacheSize);
+    for (size_t h=0;  h+1<hard.size();  h++) {
+        const int first = hard[h], end = hard[h+1];
+        cache.Flush();
+        int misses = 0;
+        for (int t=first;  t<end;  t++)
+            misses += cache.Access(Tri[t]);
+        const float limit = threshold*float(misses)/(end - first);
+
+        cache.Flush();
+        int start = first;
+        misses = 0;
+        for (int t=first;  t<end;  t++) {
+            misses += cache.Access(Tri[t]);
+            if (float(misses)/(t - start + 1) <= limit) {
+                starts.push_back(start);
+                start = t + 1;
+                misses = 0;
+                cache.Flush(); } }
+        if (start < end) starts.push_back(start); }
+    starts.push_back(triCount);
+
+    // Outward-facing clusters, relative to the mesh's centroid, first
+    glm::vec3 meshCenter(0.0f);
+    float meshArea = 0.0f;
+    std::vector<glm::vec3> centers, normals;
+    for (size_t k=0;  k+1<starts.size();  k++) {
+        glm::vec3 center(0.0f), normal(0.0f);
+        float area = 0.0f;
+        for (int t=starts[k];  t<starts[k+1];  t++) {
+            const glm::vec3 a = Pnt[Tri[t][0]].xyz(), b = Pnt[Tri[t][1]].xyz(), c = Pnt[Tri[t][2]].xyz();
+            const glm::vec3 n = glm::cross(b - a, c - a);
+            const float w = glm::length(n);
+            center += w*(a + b + c)/3.0f;
+            normal += n;
+            area += w; }
+        meshCenter += center;
+        meshArea += area;
+        centers.push_back(area > 0.0f ? center/area : center);
+        normals.push_back(normal); }
+    if (meshArea > 0.0f) meshCenter /= meshArea;
+
+    std::vector<std::pair<float,int> > order;
+    for (size_t k=0;  k<centers.size();  k++) {
+        const float len = glm::length(normals[k]);
+        const glm::vec3 n = len > 0.0f ? normals[k]/len : normals[k];
+        order.push_back(std::make_pair(-glm::dot(centers[k] - meshCenter, n), int(k))); }
+    std::stable_sort(order.begin(), order.end());
+
+    std::vector<glm::ivec3> result;
+    result.reserve(triCount);
+    for (size_t i=0;  i<order.size();  i++) {
+        const int k = order[i].second;
+        result.insert(result.end(), Tri.begin() + starts[k], Tri.begin() + starts[k+1]); }
+    Tri.swap(result);
+}
+
+template <typename T>
+static void Remap(std::vector<T>& data, const std::vector<int>& newIndex, const int newCount)
+{
+    if (data.size() != newIndex.size()) return;
+    std::vector<T> result(newCount);
+    for (size_t v=0;  v<data.size();  v++)
+        result[newIndex[v]] = data[v];
+    data.swap(result);
+}
+
+// Unreferenced vertices keep their relative order, after the rest.
+void OptimizeVertexFetch(Shape& shape)
+{
+    const int n = shape.Pnt.size();
+    std::vector<int> newIndex(n, -1);
+    int next = 0;
+    for (size_t t=0;  t<shape.Tri.size();  t++)
+        for (int c=0;  c<3;  c++) {
+            int& i = newIndex[shape.Tri[t][c]];
+            if (i < 0) i = next++;
+            shape.Tri[t][c] = i; }
+    for (int v=0;  v<n;  v++)
+        if (newIndex[v] < 0) newIndex[v] = next++;
+
+    Remap(shape.Pnt, newIndex, n);
+    Remap(shape.Nrm, newIndex, n);
+    Remap(shape.Tex, newIndex, n);
+    Remap(shape.Tan, newIndex, n);
+    Remap(shape.Some, newIndex, n);
+}
+
+void OptimizeMesh(Shape& shape)
+{
+    const int n = shape.Pnt.size();
+    if (shape.Tri.empty() || n == 0) return;
+
+    shape.cacheBefore = AnalyzeVertexCache(shape.Tri, n);
+    OptimizeVertexCache(shape.Tri, n);
+    OptimizeOverdraw(shape.Tri, shape.Pnt);
+    OptimizeVertexFetch(shape);
+    shape.cacheAfter = AnalyzeVertexCache(shape.Tri, n);
+}
@@ -0,0 +1,49 @@
+///////////////////////////////////////////////////////////////////////
+// Mesh optimization, run on every Shape by MakeVAO before upload:
+//
+//   1. OptimizeVertexCache reorders the triangles for the GPU's
+//      post-transform vertex cache (Forsyth's linear-speed algorithm),
+//      so each transformed vertex is reused by as many triangles as
+//      possible before it is evicted.
+//   2. OptimizeOverdraw splits that order into clusters at points
+//      where restarting with a cold cache costs little (Sander et
+//      al.'s "Tipsify" soft boundaries), then draws outward-facing
+//      clusters first, so they tend to occlude the rest.  No cluster's
+//      cache efficiency gets worse than threshold times its old one.
+//   3. OptimizeVertexFetch renumbers the vertices in the order the
+//      triangles first use them, so vertex fetch walks memory
+//      linearly.
+//
+// AnalyzeVertexCache simulates a FIFO cache and reports the average
+// cache miss ratio (ACMR, transformed vertices per triangle; 0.5 is
+// ideal for large regular meshes) and the average transformed to
+// vertex ratio (ATVR, 1 is ideal).  OptimizeMesh records both, before
+// and after, on the Shape.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _MESHOPTIMIZE
+#define _MESHOPTIMIZE
+
+#include <vector>
+#include <glm/glm.hpp>
+
+class Shape;
+
+struct VertexCacheStats
+{
+    float acmr, atvr;
+};
+
+VertexCacheStats AnalyzeVertexCache(const std::vector<glm::ivec3>& Tri, const int vertexCount,
+                                    const int cacheSize=16);
+
+void OptimizeVertexCache(std::vector<glm::ivec3>& Tri, const int vertexCount);
+void OptimizeOverdraw(std::vector<glm::ivec3>& Tri, const std::vector<glm::vec4>& Pnt,
+                      const float threshold=1.05f, const int cacheSize=16);
+void OptimizeVertexFetch(Shape& shape);
+
+// All three, in order, recording ACMR and ATVR in the Shape's
+// cacheBefore and cacheAfter.
+void OptimizeMesh(Shape& shape);
+
+#endif
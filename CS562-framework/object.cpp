@@ -32,13 +32,30 @@ using namespace gl;
 
 Object::Object(Shape* _shape, const int _objectId,
                const glm::vec3 _diffuseColor, const glm::vec3 _specularColor, const float _shininess)
-    : diffuseColor(_diffuseColor), specularColor(_specularColor), shininess(_shininess),
-      shape(_shape), objectId(_objectId), drawMe(true)
-     
+    : shape(_shape), animTr(1.0f), animDirty(false), objectId(_objectId), drawMe(true),
+      diffuseColor(_diffuseColor), specularColor(_specularColor), shininess(_shininess)
 {}
 
+void ObjectUniforms::Resolve(ShaderProgram* program)
+{
+    diffuse = program->Uniform("diffuse");
+    specular = program->Uniform("specular");
+    shininess = program->Uniform("shininess");
+    objectId = program->Uniform("objectId");
+    ModelTr = program->Uniform("ModelTr");
+    NormalTr = program->Uniform("NormalTr");
+}
 
+// Resolves the per-object uniform handles once, then draws the
+// hierarchy.
 void Object::Draw(ShaderProgram* program, glm::mat4& objectTr)
+{
+    ObjectUniforms u;
+    u.Resolve(program);
+    DrawTree(program, u, objectTr);
+}
+
+void Object::DrawTree(ShaderProgram* program, const ObjectUniforms& u, glm::mat4& objectTr)
 {
     CHECKERROR;
     // @@ The object specific parameters (uniform variables) used by
@@ -49,29 +66,21 @@ void Object::Draw(ShaderProgram* program, glm::mat4& objectTr)
     // are also set here.  Call texture->Bind in texture.cpp to do so.
     
     // Inform the shader of the surface values Kd, Ks, and alpha.
-    int loc = glGetUniformLocation(program->programId, "diffuse");
-    glUniform3fv(loc, 1, &diffuseColor[0]);
-
-    loc = glGetUniformLocation(program->programId, "specular");
-    glUniform3fv(loc, 1, &specularColor[0]);
-
-    loc = glGetUniformLocation(program->programId, "shininess");
-    glUniform1f(loc, shininess);
+    program->Set(u.diffuse, diffuseColor);
+    program->Set(u.specular, specularColor);
+    program->Set(u.shininess, shininess);
 
     // Inform the shader of which object is being drawn so it can make
     // object specific decisions.
-    loc = glGetUniformLocation(program->programId, "objectId");
-    glUniform1i(loc, objectId);
+    program->Set(u.objectId, objectId);
 
     // Inform the shader of this object's model transformation.  The
     // inverse of the model transformation, needed for transforming
     // normals, is calculated and passed to the shader here.
-    loc = glGetUniformLocation(program->programId, "ModelTr");
-    glUniformMatrix4fv(loc, 1, GL_FALSE, Pntr(objectTr));
+    program->Set(u.ModelTr, objectTr);
     
-    glm::mat4 inv = glm::inverse(objectTr);
-    loc = glGetUniformLocation(program->programId, "NormalTr");
-    glUniformMatrix4fv(loc, 1, GL_FALSE, Pntr(inv));
+    if (u.NormalTr >= 0)
+        program->Set(u.NormalTr, glm::inverse(objectTr));
 
     // If this object has an associated texture, this is the place to
     // load the texture into a texture-unit of your choice and inform
@@ -94,7 +103,7 @@ void Object::Draw(ShaderProgram* program, glm::mat4& objectTr)
             CHECKERROR;
             glm::mat4 itr = objectTr*instances[i].second*animTr;
             CHECKERROR;
-            instances[i].first->Draw(program, itr);
+            instances[i].first->DrawTree(program, u, itr);
             CHECKERROR; }
     
     CHECKERROR;
@@ -21,12 +21,21 @@ class Object;
 
 typedef std::pair<Object*,glm::mat4> INSTANCE;
 
+// Handles (see ShaderProgram::Uniform) of the uniforms Object::Draw sets.
+struct ObjectUniforms
+{
+    int diffuse, specular, shininess, objectId, ModelTr, NormalTr;
+
+    void Resolve(ShaderProgram* program);
+};
+
 // Object:: A shape, and its transformations, colors, and textures and sub-objects.
 class Object
 {
  public:
     Shape* shape;               // Polygons 
-    glm::mat4 animTr;                // This model's animation transformation
+    glm::mat4 animTr;                // This model's animation transformation (applied to its children)
+    bool animDirty;             // animTr changed since the last ObjectHierarchy::Update
     int objectId;               // Object id to be sent to the shader
     bool drawMe;                // Toggle specifies if this object (and children) are drawn.
 
@@ -45,8 +54,12 @@ class Object
     // Object::Draw.
     
     void Draw(ShaderProgram* program, glm::mat4& objectTr);
+    void DrawTree(ShaderProgram* program, const ObjectUniforms& u, glm::mat4& objectTr);
 
     void add(Object* m, glm::mat4 tr=glm::mat4(1.0)) { instances.push_back(std::make_pair(m,tr)); }
+
+    // Set animTr this way so an ObjectHierarchy notices the change.
+    void SetAnimTr(const glm::mat4& tr) { animTr = tr;  animDirty = true; }
 };
 
 #endif
@@ -0,0 +1,177 @@
+///////////////////////////////////////////////////////////////////////
+// GPU occlusion culling.  See occlusion.h.
+////////////////////////////////////////////////////////////////////////
+
+#include "math.h"
+#include <stdlib.h>
+#include <algorithm>
+
+#include <glbinding/gl/gl.h>
+#include <glbinding/Binding.h>
+using namespace gl;
+
+#define GLM_FORCE_CTOR_INIT
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+
+#include "shader.h"
+#include "shapes.h"
+#include "occlusion.h"
+
+#include <glu.h>                // For gluErrorString
+#define CHECKERROR {GLenum err = glGetError(); if (err != GL_NO_ERROR) { fprintf(stderr, "OpenGL error (at line occlusion.cpp:%d): %s\n", __LINE__, gluErrorString(err)); exit(-1);} }
+
+// Work group sizes of hiZ.comp and occlusionCull.comp
+const int pyramidGroupSize = 8;
+const int cullGroupSize = 64;
+
+OcclusionCuller::OcclusionCuller()
+    : available(false), enabled(false), readStats(false), tested(0), occluded(0), recovered(0),
+      commandBuffer(0), culledBuffer(0), pyramidProgram(NULL), cullProgram(NULL),
+      pyramid(0), pyramidWidth(0), pyramidHeight(0), pyramidLevels(0), hasPyramid(false),
+      rejectedBuffer(0), statsBuffer(0), instanceCapacity(0), commandCapacity(0)
+{
+    int major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    available = major > 4 || (major == 4 && minor >= 3);
+    if (!available) return;
+
+    pyramidProgram = new ShaderProgram();
+    pyramidProgram->AddShader("hiZ.comp", GL_COMPUTE_SHADER);
+    pyramidProgram->LinkProgram();
+    pyramidUniforms.copyLevel = pyramidProgram->Uniform("copyLevel");
+    pyramidUniforms.srcLevel = pyramidProgram->Uniform("srcLevel");
+    pyramidUniforms.src = pyramidProgram->Uniform("src");
+    cullProgram = new ShaderProgram();
+    cullProgram->AddShader("occlusionCull.comp", GL_COMPUTE_SHADER);
+    cullProgram->LinkProgram();
+    cullUniforms.viewProj = cullProgram->Uniform("viewProj");
+    cullUniforms.instanceCount = cullProgram->Uniform("instanceCount");
+    cullUniforms.phase = cullProgram->Uniform("phase");
+    cullUniforms.commandOffset = cullProgram->Uniform("commandOffset");
+    cullUniforms.hasPyramid = cullProgram->Uniform("hasPyramid");
+    cullUniforms.pyramidLevels = cullProgram->Uniform("pyramidLevels");
+    cullUniforms.hiZ = cullProgram->Uniform("hiZ");
+
+    glGenBuffers(1, &commandBuffer);
+    glGenBuffers(1, &culledBuffer);
+    glGenBuffers(1, &rejectedBuffer);
+    glGenBuffers(1, &statsBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, statsBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, 2*sizeof(unsigned int), NULL, GL_DYNAMIC_READ);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    enabled = true;
+    CHECKERROR;
+}
+
+void OcclusionCuller::BuildPyramid(const unsigned int depthTexture, const int width, const int height)
+{
+    if (width != pyramidWidth || height != pyramidHeight) {
+        if (pyramid) glDeleteTextures(1, &pyramid);
+        pyramidWidth = width;
+        pyramidHeight = height;
+        pyramidLevels = 1;
+        while ((std::max(width, height) >> pyramidLevels) > 0)
+            pyramidLevels++;
+        glGenTextures(1, &pyramid);
+        glBindTexture(GL_TEXTURE_2D, pyramid);
+        glTexStorage2D(GL_TEXTURE_2D, pyramidLevels, GL_R32F, width, height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, (int)GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, (int)GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, (int)GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, (int)GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0); }
+
+    pyramidProgram->UseShader();
+    pyramidProgram->Set(pyramidUniforms.src, 0);
+    glActiveTexture(GL_TEXTURE0);
+
+    // Each level reads the one below, so wait for it between dispatches.
+    for (int level=0;  level<pyramidLevels;  level++) {
+        const int w = std::max(width >> level, 1);
+        const int h = std::max(height >> level, 1);
+        glBindTexture(GL_TEXTURE_2D, level == 0 ? depthTexture : pyramid);
+        pyramidProgram->Set(pyramidUniforms.copyLevel, int(level == 0));
+        pyramidProgram->Set(pyramidUniforms.srcLevel, std::max(level-1, 0));
+        glBindImageTexture(0, pyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        glDispatchCompute((w + pyramidGroupSize - 1)/pyramidGroupSize,
+                          (h + pyramidGroupSize - 1)/pyramidGroupSize, 1);
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT); }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    pyramidProgram->UnuseShader();
+    hasPyramid = true;
+    CHECKERROR;
+}
+
+void OcclusionCuller::Cull(const int phase, const unsigned int instances, const unsigned int bounds,
+                           const int instanceCount, const std::vector<DrawElementsCommand>& batches,
+                           const glm::mat4& viewProj)
+{
+    const int batchCount = batches.size();
+
+    // Both phases' outputs live side by side; phase 0 resets everything.
+    if (phase == 0) {
+        if (instanceCount > instanceCapacity) {
+            instanceCapacity = std::max(instanceCount, 2*instanceCapacity);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, culledBuffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, 2*sizeof(InstanceData)*instanceCapacity, NULL, GL_DYNAMIC_DRAW);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, rejectedBuffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(unsigned int)*instanceCapacity, NULL, GL_DYNAMIC_DRAW); }
+
+        commands.resize(2*batchCount);
+        for (int p=0;  p<2;  p++)
+            for (int b=0;  b<batchCount;  b++) {
+                DrawElementsCommand& c = commands[p*batchCount + b];
+                c = batches[b];
+                c.instanceCount = 0;
+                c.baseInstance += p*instanceCapacity; }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+        if (int(commands.size()) > commandCapacity) {
+            commandCapacity = commands.size();
+            glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(DrawElementsCommand)*commandCapacity, NULL, GL_DYNAMIC_DRAW); }
+        if (!commands.empty())
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(DrawElementsCommand)*commands.size(), &commands[0]);
+
+        // Fetch the previous frame's counts before resetting them.
+        if (readStats) {
+            unsigned int stats[2];
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, statsBuffer);
+            glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(stats), stats);
+            occluded = stats[0];
+            recovered = stats[1]; }
+        unsigned int zero[2] = { 0, 0 };
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, statsBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zero), zero);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        tested = instanceCount; }
+
+    if (instanceCount == 0) return;
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instances);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, bounds);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, commandBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, culledBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, rejectedBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, statsBuffer);
+
+    cullProgram->UseShader();
+    cullProgram->Set(cullUniforms.viewProj, viewProj);
+    cullProgram->Set(cullUniforms.instanceCount, instanceCount);
+    cullProgram->Set(cullUniforms.phase, phase);
+    cullProgram->Set(cullUniforms.commandOffset, phase*batchCount);
+    cullProgram->Set(cullUniforms.hasPyramid, int(hasPyramid));
+    cullProgram->Set(cullUniforms.pyramidLevels, pyramidLevels);
+    cullProgram->Set(cullUniforms.hiZ, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, pyramid);
+    glDispatchCompute((instanceCount + cullGroupSize - 1)/cullGroupSize, 1, 1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    cullProgram->UnuseShader();
+
+    // The draws read the commands and the compacted instances.
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+    CHECKERROR;
+}
@@ -0,0 +1,71 @@
+///////////////////////////////////////////////////////////////////////
+// GPU occlusion culling against a hierarchical depth (Hi-Z) pyramid.
+//
+// The pyramid is an R32F texture whose level 0 copies the G-buffer
+// depth and whose higher levels keep the farthest depth of each 2x2
+// block (hiZ.comp).  occlusionCull.comp tests each instance's bounding
+// box against it and compacts the survivors into an instance buffer
+// and per-batch indirect draw commands (the DrawElementsIndirect
+// layout), so the CPU never learns, or pays for, what was occluded.
+//
+// A frame runs in two phases (see ObjectHierarchy::DrawOccluded):
+//   0. Cull everything against last frame's pyramid, and draw.
+//   1. Rebuild the pyramid from the depth just drawn, recull only what
+//      phase 0 rejected, and draw what turned out visible.
+// Phase 0 may miss objects that just came into view; phase 1 catches
+// them, so nothing pops in.
+//
+// Needs GL 4.3 (compute shaders, storage buffers, base instances);
+// available is false otherwise.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _OCCLUSION
+#define _OCCLUSION
+
+#include <vector>
+
+class ShaderProgram;
+
+class OcclusionCuller
+{
+public:
+    bool available;             // GL 4.3
+    bool enabled;
+    bool readStats;             // Read the counts back (stalls; debug only)
+    int tested, occluded, recovered; // Instances culled, occluded after both phases, found by phase 1
+
+    // The outputs of Cull: batch b of phase p is drawn by command
+    // p*batchCount + b, from instances starting at its baseInstance.
+    unsigned int commandBuffer, culledBuffer;
+
+    OcclusionCuller();
+
+    // Rebuild the pyramid from a depth texture of the given size.
+    void BuildPyramid(const unsigned int depthTexture, const int width, const int height);
+
+    // Run phase 0 or 1 over instanceCount instances.  instances holds
+    // InstanceData, bounds two vec4s per instance (min with the batch
+    // index in w, max).  Batch b is drawn as batches[b] describes
+    // (count, firstIndex, baseVertex), and its instances start at
+    // batches[b].baseInstance; Cull fills in the instance counts.
+    void Cull(const int phase, const unsigned int instances, const unsigned int bounds,
+              const int instanceCount, const std::vector<DrawElementsCommand>& batches,
+              const glm::mat4& viewProj);
+
+    // Forget the pyramid, so phase 0 keeps everything.
+    void Invalidate() { hasPyramid = false; }
+
+private:
+    ShaderProgram* pyramidProgram;
+    ShaderProgram* cullProgram;
+    struct { int copyLevel, srcLevel, src; } pyramidUniforms;
+    struct { int viewProj, instanceCount, phase, commandOffset, hasPyramid, pyramidLevels, hiZ; } cullUniforms;
+    unsigned int pyramid;
+    int pyramidWidth, pyramidHeight, pyramidLevels;
+    bool hasPyramid;
+    unsigned int rejectedBuffer, statsBuffer;
+    int instanceCapacity, commandCapacity;
+    std::vector<DrawElementsCommand> commands;
+};
+
+#endif
@@ -0,0 +1,9 @@
+/////////////////////////////////////////////////////////////////////////
+// Pixel shader for occlusion query proxies.  Only the samples passed
+// matter; color writes are masked off.
+////////////////////////////////////////////////////////////////////////
+#version 330
+
+void main()
+{
+}
@@ -0,0 +1,15 @@
+/////////////////////////////////////////////////////////////////////////
+// Vertex shader for occlusion query proxies: stretches the +-1 Box
+// over a world space bounding box.
+////////////////////////////////////////////////////////////////////////
+#version 330
+
+in vec4 vertex;
+
+uniform mat4 viewProj;
+uniform vec3 boxMin, boxMax;
+
+void main()
+{
+    gl_Position = viewProj*vec4(mix(boxMin, boxMax, vertex.xyz*0.5 + 0.5), 1.0);
+}
@@ -0,0 +1,31 @@
+///////////////////////////////////////////////////////////////////////
+// A minimal parallel loop.  See parallel.h.
+////////////////////////////////////////////////////////////////////////
+
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+#include "parallel.h"
+
+size_t ParallelChunks(const size_t count, const size_t minChunk)
+{
+    const size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    return std::max(size_t(1), std::min(threads, (count + minChunk - 1)/minChunk));
+}
+
+void ParallelFor(const size_t count, const std::function<void(size_t, size_t)>& body, const size_t minChunk)
+{
+    const size_t threads = ParallelChunks(count, minChunk);
+    if (threads <= 1) {
+        body(0, count);
+        return; }
+
+    std::vector<std::thread> pool;
+    const size_t chunk = (count + threads - 1)/threads;
+    for (size_t t=1;  t<threads;  t++)
+        pool.push_back(std::thread(body, std::min(t*chunk, count), std::min((t+1)*chunk, count)));
+    body(0, chunk);
+    for (size_t t=0;  t<pool.size();  t++)
+        pool[t].join();
+}
@@ -0,0 +1,19 @@
+///////////////////////////////////////////////////////////////////////
+// A minimal parallel loop over an index range, on std::thread.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _PARALLEL
+#define _PARALLEL
+
+#include <functional>
+
+// Runs body(first, end) over [0, count) in contiguous chunks, one per
+// hardware thread, and returns when all are done.  Ranges shorter than
+// minChunk per thread are not worth starting threads for.
+void ParallelFor(const size_t count, const std::function<void(size_t, size_t)>& body,
+                 const size_t minChunk=16384);
+
+// The number of chunks ParallelFor would use for count.
+size_t ParallelChunks(const size_t count, const size_t minChunk=16384);
+
+#endif
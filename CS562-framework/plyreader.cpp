@@ -0,0 +1,419 @@
+///////////////////////////////////////////////////////////////////////
+// A bulk PLY reader.  See plyreader.h.
+////////////////////////////////////////////////////////////////////////
+
+#include "math.h"
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <atomic>
+
+#define GLM_FORCE_CTOR_INIT
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+
+#include "shapes.h"
+#include "meshcache.h"
+#include "parallel.h"
+#include "plyreader.h"
+
+enum PlyFormat { plyAscii, plyLittleEndian, plyBigEndian };
+enum PlyType { plyNone, plyInt8, plyUint8, plyInt16, plyUint16, plyInt32, plyUint32, plyFloat32, plyFloat64 };
+
+// Where each vertex property goes: array (0 Pnt, 1 Nrm, 2 Tex, 3 Some)
+// and component, or array -1 to skip it.
+struct PlyProperty
+{
+    PlyType type, countType;    // countType is plyNone except for lists
+    std::string name;
+    int array, component;
+};
+
+struct PlyElement
+{
+    std::string name;
+    size_t count;
+    std::vector<PlyProperty> properties;
+};
+
+static PlyType TypeOf(const std::string& name)
+{
+    if (name == "char" || name == "int8") return plyInt8;
+    if (name == "uchar" || name == "uint8") return plyUint8;
+    if (name == "short" || name == "int16") return plyInt16;
+    if (name == "ushort" || name == "uint16") return plyUint16;
+    if (name == "int" || name == "int32") return plyInt32;
+    if (name == "uint" || name == "uint32") return plyUint32;
+    if (name == "float" || name == "float32") return plyFloat32;
+    if (name == "double" || name == "float64") return plyFloat64;
+    return plyNone;
+}
+
+static int SizeOf(const PlyType type)
+{
+    static const int sizes[] = { 0, 1, 1, 2, 2, 4, 4, 4, 8 };
+    return sizes[type];
+}
+
+static void Route(PlyProperty& p)
+{
+    static const char* names[] = { "x", "y", "z", "nx", "ny", "nz", "s", "t", "confidence", "intensity" };
+    static const int arrays[] =  {  0,   0,   0,   1,    1,    1,    2,   2,   3,            3 };
+    static const int components[] = { 0, 1,   2,   0,    1,    2,    0,   1,   0,            1 };
+    p.array = -1;
+    for (int i=0;  i<10;  i++)
+        if (p.name == names[i]) {
+            p.array = arrays[i];
+            p.component = components[i]; }
+}
+
+////////////////////////////////////////////////////////////////////////
+// ASCII
+
+// Locale-free parsing of a number at p, which advances past it and
+// the spaces after it; false if there is no number.
+static bool ParseNumber(const char*& p, const char* end, double& value)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    const char* start = p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+
+    double mantissa = 0.0;
+    int exponent = 0;
+    bool digits = false;
+    while (p < end && *p >= '0' && *p <= '9') {
+        mantissa = mantissa*10.0 + (*p++ - '0');
+        digits = true; }
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && *p >= '0' && *p <= '9') {
+            mantissa = mantissa*10.0 + (*p++ - '0');
+            exponent--;
+            digits = true; } }
+    if (!digits) {
+        p = start;
+        return false; }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char* e = p++;
+        bool negativeExp = false;
+        if (p < end && (*p == '-' || *p == '+')) negativeExp = *p++ == '-';
+        int exp = 0;
+        if (p < end && *p >= '0' && *p <= '9') {
+            while (p < end && *p >= '0' && *p <= '9')
+                exp = exp*10 + (*p++ - '0');
+            exponent += negativeExp ? -exp : exp; }
+        else
+            p = e; }
+
+    value = exponent ? mantissa*pow(10.0, exponent) : mantissa;
+    if (negative) value = -value;
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    return true;
+}
+
+// The offset just past the lineCount'th newline from begin, or -1.
+static long long SkipLines(const char* data, const size_t begin, const size_t end, size_t lineCount)
+{
+    const char* p = data + begin;
+    const char* e = data + end;
+    while (lineCount > 0) {
+        const char* nl = (const char*)memchr(p, '\n', e - p);
+        if (!nl) return lineCount == 1 && p < e ? (long long)end : -1;
+        p = nl + 1;
+        lineCount--; }
+    return p - data;
+}
+
+// Calls parseLines(chunk, firstLine, lineStart, sectionEnd) for chunks
+// of whole lines of data[begin, end) in parallel, each with the index
+// of its first line.
+static void ParseLines(const char* data, const size_t begin, const size_t end,
+                       const std::function<void(size_t, size_t, const char*, const char*)>& parseLines)
+{
+    const size_t chunks = ParallelChunks(end - begin, 1 << 20);
+    std::vector<size_t> starts(chunks + 1, end);
+    starts[0] = begin;
+    for (size_t c=1;  c<chunks;  c++) {
+        size_t s = std::max(begin + (end - begin)*c/chunks, starts[c-1]);
+        const char* nl = (const char*)memchr(data + s, '\n', end - s);
+        starts[c] = nl ? nl + 1 - data : end; }
+
+    std::vector<size_t> firstLine(chunks + 1, 0);
+    ParallelFor(chunks, [&](size_t first, size_t last) {
+            for (size_t c=first;  c<last;  c++) {
+                size_t lines = 0;
+                for (const char* p=data+starts[c];  p<data+starts[c+1];  p++)
+                    lines += *p == '\n';
+                firstLine[c+1] = lines; } }, 1);
+    for (size_t c=0;  c<chunks;  c++)
+        firstLine[c+1] += firstLine[c];
+
+    ParallelFor(chunks, [&](size_t first, size_t last) {
+            for (size_t c=first;  c<last;  c++)
+                parseLines(c, firstLine[c], data + starts[c], data + starts[c+1]); }, 1);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Binary
+
+static bool bigEndianMachine()
+{
+    const unsigned int one = 1;
+    return *(const unsigned char*)&one == 0;
+}
+
+static double ReadBinary(const unsigned char* p, const PlyType type, const bool swap)
+{
+    unsigned char b[8];
+    const int size = SizeOf(type);
+    if (swap)
+        for (int i=0;  i<size;  i++) b[i] = p[size-1-i];
+    else
+        memcpy(b, p, size);
+    switch (type) {
+    case plyInt8:    return *(signed char*)b;
+    case plyUint8:   return *(unsigned char*)b;
+    case plyInt16:   return *(short*)b;
+    case plyUint16:  return *(unsigned short*)b;
+    case plyInt32:   return *(int*)b;
+    case plyUint32:  return *(unsigned int*)b;
+    case plyFloat32: return *(float*)b;
+    case plyFloat64: return *(double*)b;
+    default:         return 0.0; }
+}
+
+// Bulk conversion of one float32 property at offset, stride bytes
+// apart, into dst (floats, dstStride apart).
+static void CopyFloats(const unsigned char* src, const size_t stride, const size_t count,
+                       float* dst, const size_t dstStride, const bool swap)
+{
+    for (size_t i=0;  i<count;  i++, src+=stride, dst+=dstStride) {
+        if (!swap)
+            memcpy(dst, src, 4);
+        else {
+            unsigned int u;
+            memcpy(&u, src, 4);
+            u = (u >> 24) | ((u >> 8) & 0xff00) | ((u << 8) & 0xff0000) | (u << 24);
+            memcpy(dst, &u, 4); } }
+}
+
+////////////////////////////////////////////////////////////////////////
+
+// Appends the triangles of polygon v[0..n) as a fan, as Ply's
+// face_cb does for triangles and quads.
+static void PushPolygon(std::vector<glm::ivec3>& tris, const int* v, const int n)
+{
+    for (int i=2;  i<n;  i++)
+        tris.push_back(glm::ivec3(v[0], v[i-1], v[i]));
+}
+
+bool ReadPly(const char* name, Shape* shape)
+{
+    MappedFile file(name);
+    if (!file.data) return false;
+    const char* data = (const char*)file.data;
+    const size_t size = file.size;
+
+    // The header, up to and including the end_header line
+    const char* marker = NULL;
+    for (const char* p=data;  p+10<=data+size && !marker;  p++) {
+        p = (const char*)memchr(p, 'e', data + size - p);
+        if (!p || size_t(data + size - p) < 10) break;
+        if (memcmp(p, "end_header", 10) == 0 && (p == data || p[-1] == '\n')) marker = p; }
+    if (!marker || size < 3 || memcmp(data, "ply", 3) != 0) return false;
+    const char* nl = (const char*)memchr(marker, '\n', data + size - marker);
+    const size_t bodyStart = nl ? nl + 1 - data : size;
+
+    std::istringstream header(std::string(data, marker));
+    std::string line, word;
+    PlyFormat format = plyAscii;
+    std::vector<PlyElement> elements;
+    while (std::getline(header, line)) {
+        std::istringstream words(line);
+        words >> word;
+        if (word == "format") {
+            words >> word;
+            if (word == "ascii") format = plyAscii;
+            else if (word == "binary_little_endian") format = plyLittleEndian;
+            else if (word == "binary_big_endian") format = plyBigEndian;
+            else return false; }
+        else if (word == "element") {
+            PlyElement e;
+            words >> e.name >> e.count;
+            elements.push_back(e); }
+        else if (word == "property") {
+            if (elements.empty()) return false;
+            PlyProperty p;
+            words >> word;
+            p.countType = plyNone;
+            if (word == "list") {
+                words >> word;
+                p.countType = TypeOf(word);
+                words >> word;
+                if (p.countType == plyNone) return false; }
+            p.type = TypeOf(word);
+            words >> p.name;
+            if (p.type == plyNone) return false;
+            Route(p);
+            elements.back().properties.push_back(p); } }
+
+    // Only vertex scalars and face lists of indices are understood.
+    const PlyElement* vertex = NULL;
+    const PlyElement* face = NULL;
+    for (size_t e=0;  e<elements.size();  e++) {
+        if (elements[e].name == "vertex") vertex = &elements[e];
+        if (elements[e].name == "face") face = &elements[e]; }
+    if (!vertex) return false;
+    for (size_t i=0;  i<vertex->properties.size();  i++)
+        if (vertex->properties[i].countType != plyNone) return false;
+    int faceList = -1;
+    if (face)
+        for (size_t i=0;  i<face->properties.size();  i++)
+            if (face->properties[i].name == "vertex_indices" || face->properties[i].name == "vertex_index") {
+                if (face->properties[i].countType == plyNone) return false;
+                faceList = i; }
+
+    bool has[4] = { false, false, false, false };
+    for (size_t i=0;  i<vertex->properties.size();  i++)
+        if (vertex->properties[i].array >= 0) has[vertex->properties[i].array] = true;
+    if (!has[0]) return false;
+
+    const size_t n = vertex->count;
+    std::vector<glm::vec4> Pnt(n, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+    std::vector<glm::vec3> Nrm(has[1] ? n : 0);
+    std::vector<glm::vec2> Tex(has[2] ? n : 0), Some(has[3] ? n : 0);
+    std::vector<glm::ivec3> Tri;
+    float* arrays[4] = { &Pnt[0][0], has[1] ? &Nrm[0][0] : NULL, has[2] ? &Tex[0][0] : NULL,
+                         has[3] ? &Some[0][0] : NULL };
+    const int strides[4] = { 4, 3, 2, 2 };
+    std::atomic<bool> ok(true);
+
+    size_t offset = bodyStart;
+    for (size_t e=0;  e<elements.size() && ok;  e++) {
+        const PlyElement& element = elements[e];
+
+        if (format == plyAscii) {
+            const long long sectionEnd = SkipLines(data, offset, size, element.count);
+            if (sectionEnd < 0) return false;
+
+            if (&element == vertex) {
+                ParseLines(data, offset, sectionEnd, [&](size_t, size_t first, const char* p, const char* end) {
+                        for (size_t v=first;  p<end;  v++) {
+                            const char* eol = (const char*)memchr(p, '\n', end - p);
+                            if (!eol) eol = end;
+                            for (size_t i=0;  i<element.properties.size();  i++) {
+                                double value;
+                                if (!ParseNumber(p, eol, value)) { ok = false;  return; }
+                                const PlyProperty& prop = element.properties[i];
+                                if (prop.array >= 0)
+                                    arrays[prop.array][strides[prop.array]*v + prop.component] = float(value); }
+                            p = eol + 1; } }); }
+
+            else if (&element == face && faceList >= 0) {
+                std::vector<std::vector<glm::ivec3> > chunkTris(ParallelChunks(sectionEnd - offset, 1 << 20));
+                ParseLines(data, offset, sectionEnd, [&](size_t chunk, size_t, const char* p, const char* end) {
+                        std::vector<glm::ivec3>& tris = chunkTris[chunk];
+                        tris.reserve((end - p)/8);
+                        std::vector<int> v;
+                        while (p < end) {
+                            const char* eol = (const char*)memchr(p, '\n', end - p);
+                            if (!eol) eol = end;
+                            for (size_t i=0;  i<element.properties.size();  i++) {
+                                double value;
+                                if (!ParseNumber(p, eol, value)) { ok = false;  return; }
+                                if (element.properties[i].countType == plyNone) continue;
+                                // Each item takes a character and a separator at least.
+                                if (value < 0.0 || value > double(eol - p)) { ok = false;  return; }
+                                const int count = int(value);
+                                v.resize(count);
+                                for (int k=0;  k<count;  k++) {
+                                    if (!ParseNumber(p, eol, value)) { ok = false;  return; }
+                                    v[k] = int(value); }
+                                if (int(i) == faceList) PushPolygon(tris, v.data(), count); }
+                            p = eol + 1; } });
+                size_t total = 0;
+                for (size_t c=0;  c<chunkTris.size();  c++) total += chunkTris[c].size();
+                Tri.reserve(total);
+                for (size_t c=0;  c<chunkTris.size();  c++)
+                    Tri.insert(Tri.end(), chunkTris[c].begin(), chunkTris[c].end()); }
+            offset = sectionEnd; }
+
+        else {
+            const bool swap = (format == plyBigEndian) != bigEndianMachine();
+            bool fixed = true;
+            size_t stride = 0;
+            for (size_t i=0;  i<element.properties.size();  i++) {
+                if (element.properties[i].countType != plyNone) fixed = false;
+                stride += SizeOf(element.properties[i].type); }
+
+            if (fixed) {
+                if (offset + stride*element.count > size) return false;
+                const unsigned char* base = file.data + offset;
+                if (&element == vertex) {
+                    // A property at a time, float32 in bulk, in parallel
+                    size_t at = 0;
+                    for (size_t i=0;  i<element.properties.size();  i++) {
+                        const PlyProperty& prop = element.properties[i];
+                        if (prop.array >= 0) {
+                            float* dst = arrays[prop.array] + prop.component;
+                            const int dstStride = strides[prop.array];
+                            ParallelFor(n, [&](size_t first, size_t last) {
+                                    if (prop.type == plyFloat32)
+                                        CopyFloats(base + first*stride + at, stride, last - first,
+                                                   dst + first*dstStride, dstStride, swap);
+                                    else
+                                        for (size_t v=first;  v<last;  v++)
+                                            dst[v*dstStride] = float(ReadBinary(base + v*stride + at, prop.type, swap)); }); }
+                        at += SizeOf(prop.type); } }
+                offset += stride*element.count; }
+
+            else {
+                // Variable length records go one at a time.
+                const unsigned char* p = file.data + offset;
+                const unsigned char* end = file.data + size;
+                std::vector<int> v;
+                if (&element == face) Tri.reserve(element.count);
+                for (size_t r=0;  r<element.count && ok;  r++)
+                    for (size_t i=0;  i<element.properties.size() && ok;  i++) {
+                        const PlyProperty& prop = element.properties[i];
+                        if (prop.countType == plyNone) {
+                            p += SizeOf(prop.type);
+                            continue; }
+                        if (p + SizeOf(prop.countType) > end) { ok = false;  break; }
+                        const int count = int(ReadBinary(p, prop.countType, swap));
+                        p += SizeOf(prop.countType);
+                        const int itemSize = SizeOf(prop.type);
+                        if (count < 0 || p + size_t(count)*itemSize > end) { ok = false;  break; }
+                        if (&element == face && int(i) == faceList) {
+                            v.resize(count);
+                            if (prop.type == plyInt32 || prop.type == plyUint32) {
+                                memcpy(v.data(), p, 4*count);
+                                if (swap)
+                                    for (int k=0;  k<count;  k++) {
+                                        unsigned int u = v[k];
+                                        v[k] = (u >> 24) | ((u >> 8) & 0xff00) | ((u << 8) & 0xff0000) | (u << 24); } }
+                            else
+                                for (int k=0;  k<count;  k++)
+                                    v[k] = int(ReadBinary(p + k*itemSize, prop.type, swap));
+                            PushPolygon(Tri, v.data(), count); }
+                        p += size_t(count)*itemSize; }
+                offset = p - file.data; } } }
+    if (!ok) return false;
+
+    // Indices must name vertices.
+    for (size_t t=0;  t<Tri.size();  t++)
+        for (int c=0;  c<3;  c++)
+            if (Tri[t][c] < 0 || size_t(Tri[t][c]) >= n) return false;
+
+    shape->Pnt.swap(Pnt);
+    shape->Nrm.swap(Nrm);
+    shape->Tex.swap(Tex);
+    shape->Some.swap(Some);
+    shape->Tri.swap(Tri);
+    shape->Tan.assign(n, glm::vec3());
+    return true;
+}
@@ -0,0 +1,28 @@
+///////////////////////////////////////////////////////////////////////
+// A bulk PLY reader, for the large scans rply's one-callback-per-
+// scalar interface is too slow for.
+//
+// ReadPly maps the file, parses the header, and preallocates the
+// arrays from its element counts.  ASCII bodies are split into chunks
+// at line boundaries and parsed in parallel with a locale-free number
+// parser; binary bodies (either byte order) are converted a property
+// at a time, swapping bytes when the file's order is not the
+// machine's.  Like Ply's rply callbacks, it reads
+//   vertex x, y, z             into Pnt
+//   vertex nx, ny, nz          into Nrm
+//   vertex s, t                into Tex
+//   vertex confidence, intensity  into Some
+//   face vertex_indices        into Tri, quads as two triangles
+// (larger polygons as fans).  It returns false, leaving the Shape
+// untouched, for anything it does not handle, so the caller can fall
+// back to rply.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _PLYREADER
+#define _PLYREADER
+
+class Shape;
+
+bool ReadPly(const char* name, Shape* shape);
+
+#endif
@@ -0,0 +1,70 @@
+/////////////////////////////////////////////////////////////////////////
+// Pixel shader for the point splat resolve: fills the G-buffer, in
+// either layout (see gBuffer.frag), from the point pointSplat.comp
+// picked for this pixel, and moves the fragment to that point's depth.
+////////////////////////////////////////////////////////////////////////
+#version 430
+
+layout (location = 0) out vec4 gTarget0;
+layout (location = 1) out vec4 gTarget1;
+layout (location = 2) out vec4 gTarget2;
+layout (location = 3) out vec4 gTarget3;
+uniform bool packedGBuffer;
+
+layout (std430, binding = 0) readonly buffer Positions { vec4 positions[]; };    // w: confidence
+layout (std430, binding = 1) readonly buffer Attributes { uvec2 attributes[]; }; // normal, intensity
+layout (std430, binding = 2) readonly buffer Pixels { uint pixels[]; };          // depth, index
+
+uniform mat4 ModelTr, NormalTr, WorldView;
+uniform int screenWidth;
+uniform bool intensityShading;
+
+uniform vec3 diffuse;
+uniform vec3 specular;
+
+// As in gBuffer.frag, but from [-1,1]^2
+vec2 OctEncode(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 e = n.xy;
+    if (n.z < 0.0)
+        e = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return e*0.5 + 0.5;
+}
+
+vec3 OctDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
+
+void main()
+{
+    ivec2 p = ivec2(gl_FragCoord.xy);
+    uint k = 2u*uint(p.y*screenWidth + p.x);
+    uint index = pixels[k + 1u];
+    if (index == 0xffffffffu)
+        discard;
+
+    vec3 FragPos = (ModelTr*vec4(positions[index].xyz, 1.0)).xyz;
+    uvec2 a = attributes[index];
+    vec3 N;
+    if (a.x == 0x80008000u)     // No normal (see pointsplats.cpp): face the eye
+        N = normalize((inverse(WorldView)*vec4(0.0, 0.0, 0.0, 1.0)).xyz - FragPos);
+    else
+        N = normalize(OctDecode(unpackSnorm2x16(a.x))*mat3(NormalTr));
+    vec3 Diffuse = intensityShading ? vec3(uintBitsToFloat(a.y)) : diffuse;
+    gl_FragDepth = uintBitsToFloat(pixels[k]);
+
+    if (packedGBuffer) {
+        gTarget0 = vec4(OctEncode(N), 0.0, 0.0);
+        gTarget1 = vec4(Diffuse, specular.x);
+        return;
+    }
+    gTarget0 = vec4(FragPos, 1.0);
+    gTarget1 = vec4(N, 0.0);
+    gTarget2 = vec4(Diffuse, 1.0);
+    gTarget3 = vec4(specular.x);
+}
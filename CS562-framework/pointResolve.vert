@@ -0,0 +1,11 @@
+/////////////////////////////////////////////////////////////////////////
+// Vertex shader for the point splat resolve: one triangle covering
+// the screen, from gl_VertexID alone.
+////////////////////////////////////////////////////////////////////////
+#version 430
+
+void main()
+{
+    vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(p*2.0 - 1.0, 0.0, 1.0);
+}
@@ -0,0 +1,164 @@
+///////////////////////////////////////////////////////////////////////
+// Point cloud splatting.  See pointsplats.h.
+////////////////////////////////////////////////////////////////////////
+
+#include "math.h"
+#include <stdlib.h>
+#include <algorithm>
+
+#include <glbinding/gl/gl.h>
+#include <glbinding/Binding.h>
+using namespace gl;
+
+#define GLM_FORCE_CTOR_INIT
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+
+#include "shader.h"
+#include "shapes.h"
+#include "parallel.h"
+#include "pointsplats.h"
+
+#include <glu.h>                // For gluErrorString
+#define CHECKERROR {GLenum err = glGetError(); if (err != GL_NO_ERROR) { fprintf(stderr, "OpenGL error (at line pointsplats.cpp:%d): %s\n", __LINE__, gluErrorString(err)); exit(-1);} }
+
+// Work group size of pointSplat.comp
+const int splatGroupSize = 256;
+
+const unsigned int noNormal = 0x80008000u;
+
+PointSplats::PointSplats()
+    : available(false), minConfidence(0.0f), intensityShading(false), pointCount(0),
+      splatProgram(NULL), resolveProgram(NULL), positionBuffer(0), attributeBuffer(0),
+      pixelBuffer(0), pixelCapacity(0), emptyVAO(0)
+{
+    int major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    available = major > 4 || (major == 4 && minor >= 3);
+    if (!available) return;
+
+    splatProgram = new ShaderProgram();
+    splatProgram->AddShader("pointSplat.comp", GL_COMPUTE_SHADER);
+    splatProgram->LinkProgram();
+    splatUniforms.ModelViewProj = splatProgram->Uniform("ModelViewProj");
+    splatUniforms.screenSize = splatProgram->Uniform("screenSize");
+    splatUniforms.minConfidence = splatProgram->Uniform("minConfidence");
+    splatUniforms.pointCount = splatProgram->Uniform("pointCount");
+    splatUniforms.gDepth = splatProgram->Uniform("gDepth");
+    splatUniforms.phase = splatProgram->Uniform("phase");
+    resolveProgram = new ShaderProgram();
+    resolveProgram->AddShader("pointResolve.vert", GL_VERTEX_SHADER);
+    resolveProgram->AddShader("pointResolve.frag", GL_FRAGMENT_SHADER);
+    resolveProgram->LinkProgram();
+    resolveUniforms.ModelTr = resolveProgram->Uniform("ModelTr");
+    resolveUniforms.NormalTr = resolveProgram->Uniform("NormalTr");
+    resolveUniforms.WorldView = resolveProgram->Uniform("WorldView");
+    resolveUniforms.screenWidth = resolveProgram->Uniform("screenWidth");
+    resolveUniforms.packedGBuffer = resolveProgram->Uniform("packedGBuffer");
+    resolveUniforms.intensityShading = resolveProgram->Uniform("intensityShading");
+    resolveUniforms.diffuse = resolveProgram->Uniform("diffuse");
+    resolveUniforms.specular = resolveProgram->Uniform("specular");
+
+    glGenBuffers(1, &positionBuffer);
+    glGenBuffers(1, &attributeBuffer);
+    glGenBuffers(1, &pixelBuffer);
+    glGenVertexArrays(1, &emptyVAO);
+    CHECKERROR;
+}
+
+// Maps a unit vector onto the octahedron, as gBuffer.frag does, but
+// into [-1,1]^2 for packSnorm2x16.
+static glm::vec2 OctEncode(glm::vec3 n)
+{
+    n /= fabs(n.x) + fabs(n.y) + fabs(n.z);
+    if (n.z >= 0.0f)
+        return n.xy();
+    return (1.0f - glm::abs(n.yx())) * glm::vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+}
+
+void PointSplats::Upload(const Shape* points)
+{
+    if (!available) return;
+    pointCount = points->Pnt.size();
+    const bool normals = points->Nrm.size() == points->Pnt.size();
+    const bool some = points->Some.size() == points->Pnt.size();
+
+    // A normal of noNormal tells pointResolve.frag to face the point to
+    // the eye.  (packSnorm2x16 writes -1 as 0x8001, never 0x8000.)
+    std::vector<glm::vec4> positions(pointCount);
+    std::vector<glm::uvec2> attributes(pointCount);
+    ParallelFor(pointCount, [&](size_t begin, size_t end) {
+        for (size_t i=begin;  i<end;  i++) {
+            const glm::vec3 n = normals ? points->Nrm[i] : glm::vec3(0.0f);
+            const float len = glm::length(n);
+            positions[i] = glm::vec4(points->Pnt[i].xyz(), some ? points->Some[i][0] : 1.0f);
+            attributes[i].x = len > 0.0f ? glm::packSnorm2x16(OctEncode(n/len)) : noNormal;
+            attributes[i].y = glm::floatBitsToUint(some ? points->Some[i][1] : 1.0f); } });
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, positionBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::vec4)*std::max(pointCount, 1),
+                 pointCount ? &positions[0] : NULL, GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, attributeBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::uvec2)*std::max(pointCount, 1),
+                 pointCount ? &attributes[0] : NULL, GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    CHECKERROR;
+}
+
+void PointSplats::Draw(const glm::mat4& ModelTr, const glm::mat4& WorldView, const glm::mat4& WorldProj,
+                       const unsigned int gDepth, const int width, const int height, const bool packed,
+                       const glm::vec3& diffuse, const glm::vec3& specular)
+{
+    if (!available || pointCount == 0) return;
+    CHECKERROR;
+
+    // Empty pixels: the farthest depth, and no point
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, pixelBuffer);
+    if (pixelCapacity < width*height) {
+        pixelCapacity = width*height;
+        glBufferData(GL_SHADER_STORAGE_BUFFER, 2*sizeof(unsigned int)*pixelCapacity, NULL, GL_DYNAMIC_COPY); }
+    const unsigned int empty = 0xffffffffu;
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &empty);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, positionBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, attributeBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, pixelBuffer);
+
+    splatProgram->UseShader();
+    splatProgram->Set(splatUniforms.ModelViewProj, WorldProj*WorldView*ModelTr);
+    splatProgram->Set(splatUniforms.screenSize, glm::vec2(width, height));
+    splatProgram->Set(splatUniforms.minConfidence, minConfidence);
+    splatProgram->Set(splatUniforms.pointCount, pointCount);
+    splatProgram->Set(splatUniforms.gDepth, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, gDepth);
+    const unsigned int groups = (pointCount + splatGroupSize - 1)/splatGroupSize;
+    for (int p=0;  p<2;  p++) {
+        splatProgram->Set(splatUniforms.phase, p);
+        glDispatchCompute(groups, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT); }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    splatProgram->UnuseShader();
+
+    // One full screen triangle, depth tested against the G-buffer
+    resolveProgram->UseShader();
+    resolveProgram->Set(resolveUniforms.ModelTr, ModelTr);
+    resolveProgram->Set(resolveUniforms.NormalTr, glm::inverse(ModelTr));
+    resolveProgram->Set(resolveUniforms.WorldView, WorldView);
+    resolveProgram->Set(resolveUniforms.screenWidth, width);
+    resolveProgram->Set(resolveUniforms.packedGBuffer, int(packed));
+    resolveProgram->Set(resolveUniforms.intensityShading, int(intensityShading));
+    resolveProgram->Set(resolveUniforms.diffuse, diffuse);
+    resolveProgram->Set(resolveUniforms.specular, specular);
+    glBindVertexArray(emptyVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    resolveProgram->UnuseShader();
+
+    for (int b=0;  b<3;  b++)
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, b, 0);
+    CHECKERROR;
+}
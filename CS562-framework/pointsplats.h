@@ -0,0 +1,64 @@
+///////////////////////////////////////////////////////////////////////
+// Point cloud rendering into the G-buffer by compute shader splatting,
+// for vertex-only scans and for clouds too large for the point
+// primitive to rasterize quickly.
+//
+// Each point is a position with its PLY confidence, and an octahedral
+// normal with its intensity.  A frame runs pointSplat.comp twice over
+// all points, one thread per point, into a per-pixel buffer:
+//   0. atomicMin of the point's window depth (its float bits order
+//      like the floats themselves, being positive).
+//   1. Each point at the pixel's winning depth offers its index, and
+//      atomicMin picks one, so the result does not depend on thread
+//      order.
+// Core GL has no 64 bit atomics, so depth and index can't be packed
+// into one atomicMin; the second pass takes its place.  Points below
+// minConfidence, off screen, or behind the depth already in the
+// G-buffer are dropped on the spot.  pointResolve.frag then fills the
+// G-buffer from the winning point of each pixel, in either layout, and
+// writes its depth, so lightingPhong.frag lights points like any other
+// surface.
+//
+// Needs GL 4.3 (compute shaders, storage buffers); available is false
+// otherwise.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _POINTSPLATS
+#define _POINTSPLATS
+
+class ShaderProgram;
+class Shape;
+
+class PointSplats
+{
+public:
+    bool available;             // GL 4.3
+    float minConfidence;        // Points below this are not drawn
+    bool intensityShading;      // Diffuse color from the scan's intensity
+    int pointCount;
+
+    PointSplats();
+
+    // Copies the points (Pnt, with Nrm and Some where present) of a shape.
+    void Upload(const Shape* points);
+
+    // Splats the points at ModelTr into the bound G-buffer (of either
+    // layout) with the given surface values, behind nothing already
+    // in its depth texture gDepth.
+    void Draw(const glm::mat4& ModelTr, const glm::mat4& WorldView, const glm::mat4& WorldProj,
+              const unsigned int gDepth, const int width, const int height, const bool packed,
+              const glm::vec3& diffuse, const glm::vec3& specular);
+
+private:
+    ShaderProgram* splatProgram;
+    ShaderProgram* resolveProgram;
+    struct { int ModelViewProj, screenSize, minConfidence, pointCount, gDepth, phase; } splatUniforms;
+    struct { int ModelTr, NormalTr, WorldView, screenWidth, packedGBuffer, intensityShading,
+                 diffuse, specular; } resolveUniforms;
+    unsigned int positionBuffer, attributeBuffer; // vec4s, uvec2s
+    unsigned int pixelBuffer;   // Depth and index per pixel
+    int pixelCapacity;
+    unsigned int emptyVAO;      // For the full screen triangle
+};
+
+#endif
@@ -0,0 +1,195 @@
+///////////////////////////////////////////////////////////////////////
+// Occlusion culling with occlusion queries.  See queries.h.
+////////////////////////////////////////////////////////////////////////
+
+#include "math.h"
+#include <stdlib.h>
+
+#include <glbinding/gl/gl.h>
+#include <glbinding/Binding.h>
+using namespace gl;
+
+#define GLM_FORCE_CTOR_INIT
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+
+#include "shader.h"
+#include "shapes.h"
+#include "queries.h"
+
+#include <glu.h>                // For gluErrorString
+#define CHECKERROR {GLenum err = glGetError(); if (err != GL_NO_ERROR) { fprintf(stderr, "OpenGL error (at line queries.cpp:%d): %s\n", __LINE__, gluErrorString(err)); exit(-1);} }
+
+OcclusionQueries::OcclusionQueries()
+    : enabled(false), retestInterval(8), conditionalTriangles(20000),
+      issued(0), skipped(0), pending(0)
+{
+    boxProgram = new ShaderProgram();
+    boxProgram->AddShader("occlusionBox.vert", GL_VERTEX_SHADER);
+    boxProgram->AddShader("occlusionBox.frag", GL_FRAGMENT_SHADER);
+    glBindAttribLocation(boxProgram->programId, 0, "vertex");
+    boxProgram->LinkProgram();
+    viewProjUniform = boxProgram->Uniform("viewProj");
+    boxMinUniform = boxProgram->Uniform("boxMin");
+    boxMaxUniform = boxProgram->Uniform("boxMax");
+    box = new Box();
+    CHECKERROR;
+}
+
+void OcclusionQueries::Reset(const int nodeCount)
+{
+    for (size_t i=0;  i<waiting.size();  i++)
+        freeQueries.push_back(state[waiting[i]].query);
+    waiting.clear();
+    NodeState visible = { false, false, -1000000, 0 };
+    state.assign(nodeCount, visible);
+}
+
+void OcclusionQueries::Poll(const std::vector<int>& parents, const std::vector<int>& subtreeEnd,
+                            const std::vector<char>& hasShape)
+{
+    issued = skipped = 0;
+    size_t kept = 0;
+    for (size_t w=0;  w<waiting.size();  w++) {
+        const int node = waiting[w];
+        NodeState& s = state[node];
+        GLuint available = 0;
+        glGetQueryObjectuiv(s.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            waiting[kept++] = node;
+            continue; }
+
+        GLuint samples = 0;
+        glGetQueryObjectuiv(s.query, GL_QUERY_RESULT, &samples);
+        freeQueries.push_back(s.query);
+        s.query = 0;
+
+        if (samples) {
+            // Pull up: the ancestors are visible too.  A subtree that
+            // just reappeared is drawn whole next frame, and its
+            // leaves are queried right away.
+            for (int p=node;  p>=0 && state[p].occluded;  p=parents[p])
+                state[p].occluded = false;
+            if (s.boxQuery)
+                for (int d=node+1;  d<subtreeEnd[node];  d++) {
+                    state[d].occluded = false;
+                    state[d].lastTested = -1000000; } }
+        else {
+            // Pull down: everything under an occluded box is occluded.
+            const int end = s.boxQuery ? subtreeEnd[node] : node+1;
+            for (int d=node;  d<end;  d++)
+                state[d].occluded = true; } }
+    waiting.resize(kept);
+    pending = waiting.size();
+
+    // An interior node whose children are all occluded is occluded,
+    // unless it draws a shape, which is never queried on its own.
+    // Children follow their parent, so a reverse sweep sees them first.
+    anyVisible.assign(state.size(), 0);
+    for (int i=state.size()-1;  i>=0;  i--) {
+        if (subtreeEnd[i] > i+1 && !hasShape[i] && !anyVisible[i])
+            state[i].occluded = true;
+        if (!state[i].occluded && parents[i] >= 0)
+            anyVisible[parents[i]] = 1; }
+}
+
+// Visible leaves are retested every retestInterval frames, each in a
+// different frame, so the queries spread out evenly.
+bool OcclusionQueries::Due(const int node, const int frame)
+{
+    return frame - state[node].lastTested >= retestInterval
+        || (frame + node) % retestInterval == 0;
+}
+
+unsigned int OcclusionQueries::StartQuery(const int node, const int frame, const bool boxQuery)
+{
+    if (freeQueries.empty()) {
+        GLuint q;
+        glGenQueries(1, &q);
+        freeQueries.push_back(q); }
+    NodeState& s = state[node];
+    s.query = freeQueries.back();
+    freeQueries.pop_back();
+    s.boxQuery = boxQuery;
+    s.lastTested = frame;
+    waiting.push_back(node);
+    issued++;
+    glBeginQuery(GL_ANY_SAMPLES_PASSED, s.query);
+    return s.query;
+}
+
+void OcclusionQueries::Begin(const int node, const int frame)
+{
+    StartQuery(node, frame, false);
+}
+
+void OcclusionQueries::End()
+{
+    glEndQuery(GL_ANY_SAMPLES_PASSED);
+}
+
+// Boxes are drawn depth tested but without writing anything, and from
+// both sides, so a box cut by the near plane still produces samples.
+void OcclusionQueries::BeginBoxState()
+{
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    glDisable(GL_CULL_FACE);
+    boxProgram->UseShader();
+}
+
+void OcclusionQueries::EndBoxState()
+{
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDepthMask(GL_TRUE);
+    glEnable(GL_CULL_FACE);
+}
+
+void OcclusionQueries::DrawBox(const glm::mat4& viewProj, const glm::vec3& boxMin, const glm::vec3& boxMax)
+{
+    boxProgram->Set(viewProjUniform, viewProj);
+    boxProgram->Set(boxMinUniform, boxMin);
+    boxProgram->Set(boxMaxUniform, boxMax);
+    box->DrawVAO();
+}
+
+void OcclusionQueries::BeginConditional(const int node, const int frame, const glm::mat4& viewProj,
+                                        const glm::vec3& boxMin, const glm::vec3& boxMax,
+                                        ShaderProgram* program)
+{
+    BeginBoxState();
+    GLuint q = StartQuery(node, frame, true);
+    DrawBox(viewProj, boxMin, boxMax);
+    glEndQuery(GL_ANY_SAMPLES_PASSED);
+    EndBoxState();
+    program->UseShader();
+    glBeginConditionalRender(q, GL_QUERY_NO_WAIT);
+}
+
+void OcclusionQueries::EndConditional()
+{
+    glEndConditionalRender();
+}
+
+void OcclusionQueries::QueueBox(const int node, const glm::vec3& boxMin, const glm::vec3& boxMax)
+{
+    boxNodes.push_back(node);
+    boxBounds.push_back(boxMin);
+    boxBounds.push_back(boxMax);
+}
+
+void OcclusionQueries::FlushBoxes(const int frame, const glm::mat4& viewProj, ShaderProgram* program)
+{
+    if (boxNodes.empty()) return;
+    BeginBoxState();
+    for (size_t i=0;  i<boxNodes.size();  i++) {
+        StartQuery(boxNodes[i], frame, true);
+        DrawBox(viewProj, boxBounds[2*i], boxBounds[2*i+1]);
+        glEndQuery(GL_ANY_SAMPLES_PASSED); }
+    EndBoxState();
+    program->UseShader();
+    boxNodes.clear();
+    boxBounds.clear();
+    CHECKERROR;
+}
@@ -0,0 +1,100 @@
+///////////////////////////////////////////////////////////////////////
+// Occlusion culling with hardware occlusion queries, in the style of
+// coherent hierarchical culling (CHC++), for GL 3.3 contexts without
+// compute shaders.
+//
+// Each ObjectHierarchy node remembers whether it was occluded when
+// last tested.  While drawing (ObjectHierarchy::DrawQueried):
+//   * an occluded node is skipped with its whole subtree, and its
+//     bounding box is queued for a GL_ANY_SAMPLES_PASSED query; the
+//     queued boxes are queried together after all visible geometry is
+//     drawn, with a single program and state switch,
+//   * a visible leaf is drawn, and only every retestInterval frames
+//     (staggered across nodes) wrapped in a query of its own,
+//   * a visible shape of more than conditionalTriangles triangles gets
+//     a box query immediately before it, and is drawn under
+//     conditional rendering on that query, so the GPU skips it when
+//     the box turns out hidden.
+// Results are collected at the start of the next frames only once
+// GL_QUERY_RESULT_AVAILABLE says so; the CPU never waits.  A visible
+// result marks the node's ancestors visible, an occluded one its
+// descendants occluded, and an interior node without a shape of its
+// own becomes occluded once all its children are.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _QUERIES
+#define _QUERIES
+
+#include <vector>
+
+class ShaderProgram;
+class Shape;
+
+class OcclusionQueries
+{
+public:
+    bool enabled;
+    int retestInterval;         // Frames between queries of a visible leaf
+    int conditionalTriangles;   // Shapes larger than this use conditional rendering
+
+    // Statistics from the most recent frame
+    int issued;                 // Queries begun
+    int skipped;                // Shape nodes not drawn because occluded
+    int pending;                // Queries whose results are not back yet
+
+    OcclusionQueries();
+
+    // Size the per-node state for a hierarchy of nodeCount nodes; all
+    // nodes start out visible.
+    void Reset(const int nodeCount);
+    int Size() { return state.size(); }
+
+    // Collect every available result, without waiting.  parents and
+    // subtreeEnd describe the hierarchy (see ObjectHierarchy), and
+    // hasShape marks the nodes that draw something themselves.
+    void Poll(const std::vector<int>& parents, const std::vector<int>& subtreeEnd,
+              const std::vector<char>& hasShape);
+
+    bool Occluded(const int node) { return state[node].occluded; }
+    void SetVisible(const int node) { state[node].occluded = false; }
+    bool Pending(const int node) { return state[node].query != 0; }
+    bool Due(const int node, const int frame);
+
+    // Wrap a draw in a query for node (Begin ... End).
+    void Begin(const int node, const int frame);
+    void End();
+
+    // Query node's box now, and make the next draw conditional on it
+    // (BeginConditional ... EndConditional).  program is restored.
+    void BeginConditional(const int node, const int frame, const glm::mat4& viewProj,
+                          const glm::vec3& boxMin, const glm::vec3& boxMax, ShaderProgram* program);
+    void EndConditional();
+
+    // Queue node's box to be queried by FlushBoxes.
+    void QueueBox(const int node, const glm::vec3& boxMin, const glm::vec3& boxMax);
+    void FlushBoxes(const int frame, const glm::mat4& viewProj, ShaderProgram* program);
+
+private:
+    struct NodeState {
+        bool occluded;
+        bool boxQuery;          // The pending query covers the subtree's box
+        int lastTested;         // Frame of the last query
+        unsigned int query;     // Pending query, or 0
+    };
+    std::vector<NodeState> state;
+    std::vector<int> waiting;           // Nodes with pending queries
+    std::vector<unsigned int> freeQueries;
+    std::vector<int> boxNodes;          // Queued by QueueBox
+    std::vector<glm::vec3> boxBounds;   // Two per queued node
+    std::vector<char> anyVisible;       // Poll's scratch
+    ShaderProgram* boxProgram;
+    int viewProjUniform, boxMinUniform, boxMaxUniform;
+    Shape* box;
+
+    unsigned int StartQuery(const int node, const int frame, const bool boxQuery);
+    void DrawBox(const glm::mat4& viewProj, const glm::vec3& boxMin, const glm::vec3& boxMax);
+    void BeginBoxState();
+    void EndBoxState();
+};
+
+#endif
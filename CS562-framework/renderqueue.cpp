@@ -0,0 +1,148 @@
+///////////////////////////////////////////////////////////////////////
+// A sorted render queue.  See renderqueue.h.
+////////////////////////////////////////////////////////////////////////
+
+#include "math.h"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#include <glbinding/gl/gl.h>
+#include <glbinding/Binding.h>
+using namespace gl;
+
+#define GLM_FORCE_CTOR_INIT
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+
+#include "framework.h"
+#include "shapes.h"
+#include "renderqueue.h"
+
+#include <glu.h>                // For gluErrorString
+#define CHECKERROR {GLenum err = glGetError(); if (err != GL_NO_ERROR) { fprintf(stderr, "OpenGL error (at line renderqueue.cpp:%d): %s\n", __LINE__, gluErrorString(err)); exit(-1);} }
+
+bool RenderQueue::Material::operator==(const Material& m) const
+{
+    return memcmp(values, m.values, sizeof(values)) == 0;
+}
+
+// FNV-1a over the bytes
+size_t RenderQueue::MaterialHash::operator()(const Material& m) const
+{
+    const unsigned char* p = (const unsigned char*)m.values;
+    size_t h = 2166136261u;
+    for (size_t i=0;  i<sizeof(m.values);  i++)
+        h = (h ^ p[i])*16777619u;
+    return h;
+}
+
+void RenderQueue::Push(ShaderProgram* program, const Object* object, Shape* shape, const glm::mat4* ModelTr,
+                       const glm::mat4* NormalTr, const float viewDepth)
+{
+    // Small indices for programs and materials, stable across frames
+    size_t p = 0;
+    while (p < programs.size() && programs[p] != program) p++;
+    if (p == programs.size()) {
+        ProgramUniforms u;
+        u.Resolve(program);
+        u.instanced = program->Uniform("instanced");
+        programs.push_back(program);
+        programUniforms.push_back(u); }
+
+    Material m;
+    m.values[0] = object->diffuseColor.r;
+    m.values[1] = object->diffuseColor.g;
+    m.values[2] = object->diffuseColor.b;
+    m.values[3] = object->specularColor.r;
+    m.values[4] = object->specularColor.g;
+    m.values[5] = object->specularColor.b;
+    m.values[6] = object->shininess;
+    m.values[7] = float(object->objectId);
+    std::unordered_map<Material, int, MaterialHash>::iterator mi = materials.find(m);
+    if (mi == materials.end())
+        mi = materials.insert(std::make_pair(m, int(materials.size()))).first;
+
+    // Non-negative floats order like their bit patterns, so the top 24
+    // bits of the depth's bits are a monotonic 24 bit depth.
+    float depth = std::max(viewDepth, 0.0f);
+    unsigned int depthBits;
+    memcpy(&depthBits, &depth, sizeof(depthBits));
+
+    Packet packet = { program, object, shape, ModelTr, NormalTr, mi->second };
+    Entry entry;
+    entry.key = ((unsigned long long)(p & 0xff) << 56)
+        | ((unsigned long long)(shape->vaoID & 0xffff) << 40)
+        | ((unsigned long long)(mi->second & 0xffff) << 24)
+        | (unsigned long long)(depthBits >> 8);
+    entry.packet = packetData.size();
+    packetData.push_back(packet);
+    entries.push_back(entry);
+}
+
+// LSD radix sort on the key, a byte per pass, ping-ponging between
+// entries and scratch.  A byte that is the same in every key leaves
+// the order unchanged, so its pass is skipped.
+void RenderQueue::Sort()
+{
+    const size_t n = entries.size();
+    scratch.resize(n);
+    for (int shift=0;  shift<64;  shift+=8) {
+        size_t counts[256] = {0};
+        for (size_t i=0;  i<n;  i++)
+            counts[(entries[i].key >> shift) & 0xff]++;
+        if (counts[(entries[0].key >> shift) & 0xff] == n) continue;
+
+        size_t offset = 0;
+        for (int b=0;  b<256;  b++) {
+            size_t c = counts[b];
+            counts[b] = offset;
+            offset += c; }
+        for (size_t i=0;  i<n;  i++)
+            scratch[counts[(entries[i].key >> shift) & 0xff]++] = entries[i];
+        entries.swap(scratch); }
+}
+
+void RenderQueue::Submit()
+{
+    packets = entries.size();
+    drawCalls = vaoBinds = programBinds = materialChanges = 0;
+    if (entries.empty()) return;
+    Sort();
+
+    ShaderProgram* program = NULL;
+    const ProgramUniforms* u = NULL;
+    unsigned int vao = 0;
+    int material = -1;
+    for (size_t e=0;  e<entries.size();  e++) {
+        const Packet& packet = packetData[entries[e].packet];
+        const Object* object = packet.object;
+        if (packet.program != program) {
+            program = packet.program;
+            program->UseShader();
+            size_t p = 0;
+            while (programs[p] != program) p++;
+            u = &programUniforms[p];
+            program->Set(u->instanced, 0);
+            material = -1;
+            programBinds++; }
+        if (packet.shape->vaoID != vao) {
+            vao = packet.shape->vaoID;
+            glBindVertexArray(vao);
+            vaoBinds++; }
+        if (packet.material != material) {
+            material = packet.material;
+            program->Set(u->diffuse, object->diffuseColor);
+            program->Set(u->specular, object->specularColor);
+            program->Set(u->shininess, object->shininess);
+            program->Set(u->objectId, object->objectId);
+            materialChanges++; }
+        program->Set(u->ModelTr, *packet.ModelTr);
+        if (u->NormalTr >= 0)
+            program->Set(u->NormalTr, *packet.NormalTr);
+        packet.shape->DrawElements();
+        drawCalls++; }
+    glBindVertexArray(0);
+    CHECKERROR;
+}
@@ -0,0 +1,77 @@
+///////////////////////////////////////////////////////////////////////
+// A render queue: traversal pushes one packet per shape to draw, the
+// queue sorts them, then submits them skipping redundant binds.
+//
+// Each packet's 64 bit sort key is, from the most significant bits:
+//   program  (8 bits)  index of the ShaderProgram among those seen
+//   VAO     (16 bits)  Shape::vaoID
+//   material(16 bits)  index of the distinct (diffuse, specular,
+//                      shininess, objectId) combinations seen
+//   depth   (24 bits)  view space depth, nearest first, for early-Z
+// so sorting groups packets by program, then VAO, then material, and
+// orders each group front to back.  The keys are sorted with an LSD
+// radix sort, which skips the byte passes all keys agree on.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _RENDERQUEUE
+#define _RENDERQUEUE
+
+#include <vector>
+#include <unordered_map>
+#include "object.h"
+
+class RenderQueue
+{
+public:
+    // Statistics from the most recent Submit
+    int packets, drawCalls, vaoBinds, programBinds, materialChanges;
+
+    RenderQueue() : packets(0), drawCalls(0), vaoBinds(0), programBinds(0), materialChanges(0) {}
+
+    void Clear() { entries.clear();  packetData.clear(); }
+
+    // Queue shape (object's, or one of its levels of detail), drawn
+    // by program with object's materials and the given model
+    // transformation and its inverse.  The matrices must stay valid
+    // until Submit.  viewDepth is the distance in front of the eye.
+    void Push(ShaderProgram* program, const Object* object, Shape* shape, const glm::mat4* ModelTr,
+              const glm::mat4* NormalTr, const float viewDepth);
+
+    // Sort, then draw everything queued.  Leaves no VAO bound, and the
+    // last packet's program in use.
+    void Submit();
+
+private:
+    struct Packet {
+        ShaderProgram* program;
+        const Object* object;
+        Shape* shape;
+        const glm::mat4* ModelTr;
+        const glm::mat4* NormalTr;
+        int material;
+    };
+    struct Entry {
+        unsigned long long key;
+        unsigned int packet;
+    };
+    struct Material {
+        float values[8];
+        bool operator==(const Material& m) const;
+    };
+    struct MaterialHash {
+        size_t operator()(const Material& m) const;
+    };
+    struct ProgramUniforms : ObjectUniforms {
+        int instanced;
+    };
+
+    std::vector<Packet> packetData;
+    std::vector<Entry> entries, scratch;
+    std::unordered_map<Material, int, MaterialHash> materials;
+    std::vector<ShaderProgram*> programs;
+    std::vector<ProgramUniforms> programUniforms;
+
+    void Sort();
+};
+
+#endif
@@ -0,0 +1,100 @@
+///////////////////////////////////////////////////////////////////////
+// A pool of render target textures.  See rendertarget.h.
+////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <glbinding/gl/gl.h>
+#include <glbinding/Binding.h>
+using namespace gl;
+
+#include "rendertarget.h"
+
+#include <glu.h>                // For gluErrorString
+#define CHECKERROR {GLenum err = glGetError(); if (err != GL_NO_ERROR) { fprintf(stderr, "OpenGL error (at line rendertarget.cpp:%d): %s\n", __LINE__, gluErrorString(err)); exit(-1);} }
+
+// Pixel transfer format, type and size of the internal formats the
+// framework renders to.
+static bool FormatInfo(const GLenum internalFormat, GLenum& format, GLenum& type, int& bytes)
+{
+    switch (internalFormat) {
+    case GL_RGBA32F:            format = GL_RGBA;          type = GL_FLOAT;             bytes = 16; return true;
+    case GL_RGBA16F:            format = GL_RGBA;          type = GL_HALF_FLOAT;        bytes = 8;  return true;
+    case GL_RGBA8:              format = GL_RGBA;          type = GL_UNSIGNED_BYTE;     bytes = 4;  return true;
+    case GL_RG16:               format = GL_RG;            type = GL_UNSIGNED_SHORT;    bytes = 4;  return true;
+    case GL_R32F:               format = GL_RED;           type = GL_FLOAT;             bytes = 4;  return true;
+    case GL_R32UI:              format = GL_RED_INTEGER;   type = GL_UNSIGNED_INT;      bytes = 4;  return true;
+    case GL_DEPTH24_STENCIL8:   format = GL_DEPTH_STENCIL; type = GL_UNSIGNED_INT_24_8; bytes = 4;  return true;
+    case GL_DEPTH_COMPONENT24:  format = GL_DEPTH_COMPONENT; type = GL_UNSIGNED_INT;    bytes = 4;  return true;
+    case GL_DEPTH_COMPONENT32F: format = GL_DEPTH_COMPONENT; type = GL_FLOAT;           bytes = 4;  return true;
+    default: return false; }
+}
+
+unsigned int RenderTargetPool::Acquire(const int internalFormat, const int width, const int height)
+{
+    for (size_t i=0;  i<targets.size();  i++) {
+        Target& t = targets[i];
+        if (!t.inUse && t.internalFormat == internalFormat && t.width == width && t.height == height) {
+            t.inUse = true;
+            t.lastUsed = frame;
+            return t.id; } }
+
+    GLenum format, type;
+    int bytes;
+    if (!FormatInfo((GLenum)internalFormat, format, type, bytes)) {
+        printf("RenderTargetPool: unsupported internal format 0x%x\n", internalFormat);
+        return 0; }
+
+    Target t;
+    glGenTextures(1, &t.id);
+    glBindTexture(GL_TEXTURE_2D, t.id);
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, (int)GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, (int)GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, (int)GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, (int)GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    CHECKERROR;
+
+    t.internalFormat = internalFormat;
+    t.width = width;
+    t.height = height;
+    t.bytes = size_t(bytes)*width*height;
+    t.inUse = true;
+    t.lastUsed = frame;
+    targets.push_back(t);
+    return t.id;
+}
+
+void RenderTargetPool::Release(const unsigned int texture)
+{
+    if (texture == 0) return;
+    for (size_t i=0;  i<targets.size();  i++)
+        if (targets[i].id == texture) {
+            targets[i].inUse = false;
+            targets[i].lastUsed = frame;
+            return; }
+}
+
+void RenderTargetPool::BeginFrame()
+{
+    frame++;
+    size_t kept = 0;
+    for (size_t i=0;  i<targets.size();  i++) {
+        Target& t = targets[i];
+        if (!t.inUse && frame - t.lastUsed > keepFrames)
+            glDeleteTextures(1, &t.id);
+        else
+            targets[kept++] = t; }
+    targets.resize(kept);
+}
+
+size_t RenderTargetPool::Bytes()
+{
+    size_t total = 0;
+    for (size_t i=0;  i<targets.size();  i++)
+        total += targets[i].bytes;
+    return total;
+}
@@ -0,0 +1,50 @@
+///////////////////////////////////////////////////////////////////////
+// A pool of render target textures keyed by internal format and size.
+//
+// Acquire hands out a texture, reusing a released one of the same
+// format and size when there is one.  Release returns it to the pool.
+// Textures that stay unused for a few frames (for instance the old
+// size after a window resize) are deleted by BeginFrame, so resizing
+// does not leak, and a resize back to a recent size does not
+// reallocate.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _RENDERTARGET
+#define _RENDERTARGET
+
+#include <vector>
+
+class RenderTargetPool
+{
+public:
+    int frame;                  // Frames since creation
+    int keepFrames;             // Unused textures live this many frames
+
+    RenderTargetPool(const int _keepFrames=2) : frame(0), keepFrames(_keepFrames) {}
+
+    // A nearest-filtered, edge-clamped texture of the given
+    // GL internal format, not in use by anyone else.
+    unsigned int Acquire(const int internalFormat, const int width, const int height);
+
+    // Give back a texture from Acquire (0 is ignored).
+    void Release(const unsigned int texture);
+
+    // Call once per frame; frees textures unused for keepFrames frames.
+    void BeginFrame();
+
+    // Memory held by the pool, in use or not, in bytes and textures.
+    size_t Bytes();
+    int Count() { return targets.size(); }
+
+private:
+    struct Target {
+        unsigned int id;
+        int internalFormat, width, height;
+        size_t bytes;
+        bool inUse;
+        int lastUsed;           // Frame of the last Acquire or Release
+    };
+    std::vector<Target> targets;
+};
+
+#endif
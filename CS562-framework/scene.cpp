@@ -34,6 +34,8 @@ using namespace gl;
 #include "object.h"
 #include "texture.h"
 #include "transform.h"
+#include "simplify.h"
+#include "plyreader.h"
 const bool fullPolyCount = true; // Use false when emulating the graphics pipeline in software
 
 const float PI = 3.14159f;
@@ -47,6 +49,7 @@ const float grndFreq = 0.03;    // Number of hills per (approx) 50m
 const float grndPersistence = 0.03; // Terrain roughness: Slight:0.01  rough:0.05
 const float grndLow = -3.0;         // Lowest extent below sea level
 const float grndHigh = 5.0;        // Highest extent above sea level
+const int grndSeed = 500;          // Terrain choice, fixed so it is cached; -1 for a new one each run
 
 ////////////////////////////////////////////////////////////////////////
 // This macro makes it easy to sprinkle checks for OpenGL errors
@@ -223,6 +226,60 @@ Object* FramedPicture(const glm::mat4& modelTr, const int objectId,
     return frame;
 }
 
+void SceneUniforms::Resolve(ShaderProgram* program)
+{
+    WorldProj = program->Uniform("WorldProj");
+    WorldView = program->Uniform("WorldView");
+    WorldInverse = program->Uniform("WorldInverse");
+    ProjInverse = program->Uniform("ProjInverse");
+    packedGBuffer = program->Uniform("packedGBuffer");
+    viewPos = program->Uniform("viewPos");
+    lightPos = program->Uniform("lightPos");
+    lightingMode = program->Uniform("lightingMode");
+    lightCount = program->Uniform("lightCount");
+    tileSize = program->Uniform("tileSize");
+    tilesX = program->Uniform("tilesX");
+    tilesY = program->Uniform("tilesY");
+    clusterSlices = program->Uniform("clusterSlices");
+    sliceScale = program->Uniform("sliceScale");
+    sliceBias = program->Uniform("sliceBias");
+    screenSize = program->Uniform("screenSize");
+    ModelTr = program->Uniform("ModelTr");
+    lightIndex = program->Uniform("lightIndex");
+    projection = program->Uniform("projection");
+    view = program->Uniform("view");
+    model = program->Uniform("model");
+    lightColor = program->Uniform("lightColor");
+    lightPosition = program->Uniform("lightPosition");
+    lightRadius = program->Uniform("lightRadius");
+}
+
+////////////////////////////////////////////////////////////////////////
+// Places localLightCount randomly colored lights near the bunnies
+// (always the same ones for a given count), followed by the global
+// light.
+void Scene::GenerateLights()
+{
+    lightPositions.clear();
+    lightColors.clear();
+    srand(13);
+    for (int i = 0; i < localLightCount; i++)
+    {
+        // calculate slightly random offsets
+        float xPos = static_cast<float>(((rand() % 100) / 100.0) * 6.0 - 3.0);
+        float yPos = static_cast<float>(((rand() % 100) / 100.0) * 6.0 - 4.0);
+        float zPos = static_cast<float>(((rand() % 100) / 100.0) * 6.0 - 3.0);
+        lightPositions.push_back(glm::vec3(xPos, yPos, zPos));
+        // also calculate random color
+        float rColor = static_cast<float>(((rand() % 100) / 200.0f) + 0.5); // between 0.5 and 1.0
+        float gColor = static_cast<float>(((rand() % 100) / 200.0f) + 0.5); // between 0.5 and 1.0
+        float bColor = static_cast<float>(((rand() % 100) / 200.0f) + 0.5); // between 0.5 and 1.0
+        lightColors.push_back(glm::vec3(rColor, gColor, bColor));
+    }
+    lightPositions.push_back(glm::vec3(lightX, lightY, lightZ));
+    lightColors.push_back(glm::vec3(1.0, 1.0, 0.8));
+}
+
 ////////////////////////////////////////////////////////////////////////
 // InitializeScene is called once during setup to create all the
 // textures, shape VAOs, and shader programs as well as setting a
@@ -269,8 +326,16 @@ void Scene::InitializeScene()
     //createFBO
 
     //m_texture = new Texture("textures/6670-normal.jpg");
-    fbo = new FBO();
-    fbo->CreateFBO(width, height);
+    packedGBuffer = true;
+    targetPool = new RenderTargetPool();
+    fbo = new FBO(targetPool);
+    fbo->CreateFBO(width, height, packedGBuffer);
+    frameGraph = new FrameGraph(targetPool);
+
+    lightingMode = lightAll;
+    lightGrid = new LightGrid(16);
+    lightBuffer = new LightBuffer();
+    std::string lightDefines = lightBuffer->Defines();
 
 
     
@@ -288,7 +353,7 @@ void Scene::InitializeScene()
     //lighting
     lightingProgram = new ShaderProgram();
     lightingProgram->AddShader("lightingPhong.vert", GL_VERTEX_SHADER);
-    lightingProgram->AddShader("lightingPhong.frag", GL_FRAGMENT_SHADER);
+    lightingProgram->AddShader("lightingPhong.frag", GL_FRAGMENT_SHADER, lightDefines.c_str());
 
     //send
     glBindAttribLocation(lightingProgram->programId, 0, "vertex");
@@ -296,6 +361,7 @@ void Scene::InitializeScene()
     glBindAttribLocation(lightingProgram->programId, 2, "vertexTexture");
     glBindAttribLocation(lightingProgram->programId, 3, "vertexTangent");
     lightingProgram->LinkProgram();
+    lightBuffer->BindBlock(lightingProgram->programId);
 
     lightBoxProgram = new ShaderProgram();
     lightBoxProgram->AddShader("lightBox.vert", GL_VERTEX_SHADER);
@@ -306,11 +372,25 @@ void Scene::InitializeScene()
     glBindAttribLocation(lightBoxProgram->programId, 2, "vertexTexture");
     glBindAttribLocation(lightBoxProgram->programId, 3, "vertexTangent");
     lightBoxProgram->LinkProgram();
+
+    // The lighting shader again, shading one light per draw of its sphere
+    lightVolumeProgram = new ShaderProgram();
+    lightVolumeProgram->AddShader("lightVolume.vert", GL_VERTEX_SHADER);
+    lightVolumeProgram->AddShader("lightingPhong.frag", GL_FRAGMENT_SHADER,
+                                  ("#define LIGHT_VOLUME\n" + lightDefines).c_str());
+    glBindAttribLocation(lightVolumeProgram->programId, 0, "vertex");
+    lightVolumeProgram->LinkProgram();
+    lightBuffer->BindBlock(lightVolumeProgram->programId);
+
+    gBufferUniforms.Resolve(gBufferProgram);
+    lightingUniforms.Resolve(lightingProgram);
+    lightBoxUniforms.Resolve(lightBoxProgram);
+    lightVolumeUniforms.Resolve(lightVolumeProgram);
     
     // Create all the Polygon shapes
     proceduralground = new ProceduralGround(grndSize, 400,
                                      grndOctaves, grndFreq, grndPersistence,
-                                     grndLow, grndHigh);
+                                     grndLow, grndHigh, grndSeed);
     
     Shape* TeapotPolygons =  new Teapot(fullPolyCount?12:2);
     Shape* BoxPolygons = new Box();
@@ -320,7 +400,14 @@ void Scene::InitializeScene()
     Shape* QuadPolygons = new Quad();
     Shape* SeaPolygons = new Plane(2000.0, 50);
     Shape* GroundPolygons = proceduralground;
-    Shape* BunnyPolygons = new Ply("bunny_short.ply");
+    // Levels of a quarter of the triangles each, simplified from
+    // bunny.ply once and cached beside it
+    std::vector<LodChain> lodChains;
+    lodChains.push_back(LodChain(new Ply("bunny.ply", false, vertexCompressed), "bunny.ply"));
+    BuildLodChains(lodChains);
+    const float bunnySwitches[] = { 400.0f, 150.0f, 60.0f };
+    Shape* BunnyPolygons = new LodShape(lodChains[0].levels,
+                                        std::vector<float>(bunnySwitches, bunnySwitches + 3));
     //Shape* BunnyPolygons = new Ply("bunny.ply"); //Texcoord ݴ.
     Shape* lightSphere = new Sphere(16);
     // Various colors used in the subsequent models
@@ -365,25 +452,8 @@ void Scene::InitializeScene()
     bunny4      = new Object(BunnyPolygons, bunnyId, grassColor, brightSpec, 12);
     light      = new Object(lightSphere, SphereId, brassColor, brightSpec, 120);
 
-
-    srand(13);
-    for (unsigned int i = 0; i < NR_LIGHTS; i++)
-    {
-        // calculate slightly random offsets
-        float xPos = static_cast<float>(((rand() % 100) / 100.0) * 6.0 - 3.0);
-        float yPos = static_cast<float>(((rand() % 100) / 100.0) * 6.0 - 4.0);
-        float zPos = static_cast<float>(((rand() % 100) / 100.0) * 6.0 - 3.0);
-        lightPositions.push_back(glm::vec3(xPos, yPos, zPos));
-        // also calculate random color
-        float rColor = static_cast<float>(((rand() % 100) / 200.0f) + 0.5); // between 0.5 and 1.0
-        float gColor = static_cast<float>(((rand() % 100) / 200.0f) + 0.5); // between 0.5 and 1.0
-        float bColor = static_cast<float>(((rand() % 100) / 200.0f) + 0.5); // between 0.5 and 1.0
-        lightColors.push_back(glm::vec3(rColor, gColor, bColor));
-        //light = new Object(lightSphere, SphereId, lightColors[i], brightSpec, 1);
-        //objectRootLight->add(sky, Translate(lightPositions[i].x, lightPositions[i].y, lightPositions[i].z) * Scale(0.10, 0.10, 0.10));
-    }
-    lightPositions.push_back(glm::vec3(0.0, 0.0, 0.0));
-    lightColors.push_back(glm::vec3(1.0, 1.0, 0.8));
+    localLightCount = 32;
+    GenerateLights();
 
     leftFrame  = FramedPicture(Identity, lPicId, BoxPolygons, QuadPolygons);
     rightFrame = FramedPicture(Identity, rPicId, BoxPolygons, QuadPolygons); 
@@ -439,11 +509,43 @@ void Scene::InitializeScene()
 
     }
 
+    hierarchy = new ObjectHierarchy();
+    hierarchy->Compile(objectRoot);
+    geometryPool = new GeometryPool();
+    Shape* staticShapes[] = { TeapotPolygons, BoxPolygons, SpherePolygons, RoomPolygons, FloorPolygons,
+                              QuadPolygons, SeaPolygons, GroundPolygons, BunnyPolygons };
+    for (size_t s=0;  s<sizeof(staticShapes)/sizeof(staticShapes[0]);  s++)
+        geometryPool->Add(staticShapes[s]);
+    multiDraw = geometryPool->available;
+    instancing = true;
+    occlusion = new OcclusionCuller();
+    queries = new OcclusionQueries();
+    renderQueue = new RenderQueue();
+    sortedQueue = true;
+
+    // Opened, and its cluster file cooked if need be, when first
+    // switched on in the menu
+    streamedMesh = NULL;
+    clusterCook = NULL;
+    streamedTr = Translate(0.0, 6.0, 0.0) * Rotate(0, 90) * Scale(10, 10, 10);
+    streamedMaterial = new Object(NULL, bunnyId, brassColor, brightSpec, 70);
+    streaming = false;
+
+    pointSplats = new PointSplats(); // Filled when first turned on
+    splatTr = Translate(0.0, -6.0, 0.0) * Rotate(0, 90) * Scale(10, 10, 10);
+    splatMaterial = new Object(NULL, bunnyId, grassColor, brightSpec, 12);
+    splatting = false;
+
+    // Texture units of the G-buffer and light bins, fixed for good
+    const char* samplers[] = {"gPosition", "gNormal", "gDiffuse", "gSpecular", "gDepth",
+                              "tileGrid", "tileLights"};
     lightingProgram->UseShader();
-    glUniform1i(glGetUniformLocation(lightingProgram->programId, "gPosition"), 0);
-    glUniform1i(glGetUniformLocation(lightingProgram->programId, "gNormal"), 1);
-    glUniform1i(glGetUniformLocation(lightingProgram->programId, "gDiffuse"), 2);
-    glUniform1i(glGetUniformLocation(lightingProgram->programId, "gSpecular"), 3);
+    for (int i=0;  i<7;  i++)
+        lightingProgram->Set(lightingProgram->Uniform(samplers[i]), i);
+    lightVolumeProgram->UseShader();
+    for (int i=0;  i<5;  i++)
+        lightVolumeProgram->Set(lightVolumeProgram->Uniform(samplers[i]), i);
+    lightVolumeProgram->UnuseShader();
 
     CHECKERROR;
 
@@ -468,17 +570,138 @@ void Scene::DrawMenu()
     //ImGui::GetWindowDrawList()->AddImage((ImTextureID)fbo->gPosition, ImVec2(ImGui::GetCursorScreenPos()),
     //    ImVec2(ImGui::GetCursorScreenPos().x + width, ImGui::GetCursorScreenPos().y + height), ImVec2(0, 1), ImVec2(1, 0));
     ImGui::Begin("Dear ImGui Demo");
-    ImGui::Image((ImTextureID)fbo->gPosition, ImVec2(100, 100), ImVec2(0, 1), ImVec2(1, 0));
+    ImGui::Image((ImTextureID)(fbo->packed ? fbo->gDepth : fbo->gPosition), ImVec2(100, 100), ImVec2(0, 1), ImVec2(1, 0));
     ImGui::SameLine();
     ImGui::Image((ImTextureID)fbo->gDiffuse, ImVec2(100, 100), ImVec2(0, 1), ImVec2(1, 0));
     ImGui::Image((ImTextureID)fbo->gNormal, ImVec2(100, 100), ImVec2(0, 1), ImVec2(1, 0));
+    if (!fbo->packed) {
+        ImGui::SameLine();
+        ImGui::Image((ImTextureID)fbo->gSpecular, ImVec2(100, 100), ImVec2(0, 1), ImVec2(1, 0)); }
+    if (ImGui::Checkbox("Packed G-buffer", &packedGBuffer)) {
+        fbo->DeleteFBO();
+        fbo->CreateFBO(width, height, packedGBuffer); }
     ImGui::SameLine();
-    ImGui::Image((ImTextureID)fbo->gSpecular, ImVec2(100, 100), ImVec2(0, 1), ImVec2(1, 0));
+    ImGui::Text("Render targets: %d, %.1f MB", targetPool->Count(), targetPool->Bytes()/(1024.0*1024.0));
+    ImGui::Text("Frame graph: %d passes (%d culled), %d clears (%d skipped), %d state changes (%d skipped)",
+                frameGraph->passCount, frameGraph->culledPasses, frameGraph->clears, frameGraph->skippedClears,
+                frameGraph->stateChanges, frameGraph->skippedStateChanges);
 
     ImGui::DragFloat("DragFloat Light X", &lightX, 0.005f, -FLT_MAX, +FLT_MAX, "%.3f", 0);
     ImGui::DragFloat("DragFloat Light Y", &lightY, 0.005f, -FLT_MAX, +FLT_MAX, "%.3f", 0);
     ImGui::DragFloat("DragFloat Light Z", &lightZ, 0.005f, -FLT_MAX, +FLT_MAX, "%.3f", 0);
     ImGui::Checkbox("Layout Local Lights", &localLights);
+    ImGui::Checkbox("Instancing", &instancing);
+    ImGui::SameLine();
+    ImGui::Text("%d objects, %d draw calls, %d transforms updated",
+                hierarchy->Size(), hierarchy->drawCalls, hierarchy->updated);
+    ImGui::Checkbox("Frustum culling", &hierarchy->culling);
+    ImGui::SameLine();
+    ImGui::Checkbox("Levels of detail", &hierarchy->lod);
+    ImGui::SameLine();
+    ImGui::Text("%d shapes drawn, %d culled", hierarchy->drawnObjects, hierarchy->culledObjects);
+    if (hierarchy->lod) {
+        ImGui::Text("Bunny levels, in triangles:");
+        for (int l=0;  l<bunny->shape->LevelCount();  l++) {
+            ImGui::SameLine();
+            ImGui::Text("%d", (int)bunny->shape->Level(l)->Tri.size()); } }
+    ImGui::Text("Bunny vertex cache: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f",
+                bunny->shape->cacheBefore.acmr, bunny->shape->cacheAfter.acmr,
+                bunny->shape->cacheBefore.atvr, bunny->shape->cacheAfter.atvr);
+    ImGui::Checkbox("Occlusion queries", &queries->enabled);
+    if (queries->enabled)
+        ImGui::Text("%d queries issued, %d pending, %d objects skipped",
+                    queries->issued, queries->pending, queries->skipped);
+    else if (occlusion->available && instancing) {
+        if (geometryPool->available) {
+            ImGui::Checkbox("Multi-draw indirect", &multiDraw);
+            ImGui::SameLine();
+            ImGui::Text("%d shapes pooled, %d vertices, %d indices, %.1f MB more GPU memory",
+                        geometryPool->shapes, geometryPool->vertexCount, geometryPool->indexCount,
+                        geometryPool->Bytes()/(1024.0*1024.0)); }
+        if (ImGui::Checkbox("Occlusion culling", &occlusion->enabled))
+            occlusion->Invalidate();
+        ImGui::SameLine();
+        ImGui::Checkbox("Show occluded count", &occlusion->readStats);
+        if (occlusion->enabled && occlusion->readStats)
+            ImGui::Text("%d of %d instances occluded, %d caught by the second pass",
+                        occlusion->occluded, occlusion->tested, occlusion->recovered); }
+    else if (!instancing) {
+        ImGui::Checkbox("Sorted render queue", &sortedQueue);
+        if (sortedQueue)
+            ImGui::Text("%d draw calls, %d VAO binds, %d program binds, %d material changes",
+                        renderQueue->drawCalls, renderQueue->vaoBinds, renderQueue->programBinds,
+                        renderQueue->materialChanges); }
+    // The cluster file is cooked once, on a background thread, after
+    // which only the pages in view are ever read.
+    if (ImGui::Checkbox("Streamed scan", &streaming) && streaming && !streamedMesh && !clusterCook) {
+        streamedMesh = new StreamedMesh("bunny.ply.clusters");
+        if (!streamedMesh->loaded) {
+            delete streamedMesh;
+            streamedMesh = NULL;
+            clusterCook = new ClusterCook("bunny.ply", "bunny.ply.clusters", 1024); } }
+    if (clusterCook && clusterCook->Done()) {
+        delete clusterCook;
+        clusterCook = NULL;
+        streamedMesh = new StreamedMesh("bunny.ply.clusters"); }
+    if (streaming && clusterCook) {
+        ImGui::SameLine();
+        ImGui::Text("Cooking bunny.ply.clusters: %d%%", int(100.0f*clusterCook->Progress())); }
+    else if (streaming && !streamedMesh->loaded) {
+        ImGui::SameLine();
+        ImGui::Text("Cannot open bunny.ply.clusters"); }
+    else if (streaming) {
+        ImGui::SameLine();
+        ImGui::SliderFloat("Error (pixels)", &streamedMesh->errorThreshold, 0.25f, 16.0f);
+        ImGui::Text("%d of %d nodes resident, %d drawn (%d triangles), %d loads pending, %d evicted",
+                    streamedMesh->residentNodes, streamedMesh->nodeCount, streamedMesh->drawnNodes,
+                    streamedMesh->drawnTriangles, streamedMesh->pendingLoads, streamedMesh->evictions);
+        if (streamedMesh->failedNodes > 0)
+            ImGui::Text("%d nodes could not be read", streamedMesh->failedNodes); }
+    if (pointSplats->available) {
+        // Only the points go to the GPU, so the scan is read into a
+        // plain Shape rather than a Ply, which would upload a VAO.
+        if (ImGui::Checkbox("Point splats", &splatting) && splatting && pointSplats->pointCount == 0) {
+            Shape scan;
+            if (ReadPly("bunny.ply", &scan)) {
+                if (scan.Nrm.empty() && !scan.Tri.empty())
+                    scan.ComputeNRM();
+                pointSplats->Upload(&scan); }
+            else
+                printf("Point splats: cannot read bunny.ply\n"); }
+        if (splatting) {
+            ImGui::SameLine();
+            ImGui::Text("%d points", pointSplats->pointCount);
+            ImGui::SliderFloat("Min confidence", &pointSplats->minConfidence, 0.0f, 1.0f);
+            ImGui::SameLine();
+            ImGui::Checkbox("Intensity", &pointSplats->intensityShading); } }
+    if (ImGui::SliderInt("Local lights", &localLightCount, 0,
+                         lightBuffer->storage ? lightBuffer->capacity-1 : std::min(lightBuffer->capacity-1, 1024)))
+        GenerateLights();
+    ImGui::RadioButton("All lights", &lightingMode, lightAll);
+    ImGui::SameLine();
+    ImGui::RadioButton("Tiled", &lightingMode, lightTiled);
+    ImGui::SameLine();
+    ImGui::RadioButton("Clustered", &lightingMode, lightClustered);
+    ImGui::SameLine();
+    ImGui::RadioButton("Light volumes", &lightingMode, lightVolumes);
+    if (lightingMode == lightClustered && lightGrid->computeAvailable) {
+        ImGui::SameLine();
+        ImGui::Checkbox("Compute assignment", &lightGrid->useCompute); }
+    if (lightingMode == lightClustered && lightGrid->useCompute)
+        ImGui::Text("%dx%dx%d clusters, assigned on the GPU: max %d lights per cluster (capacity %d), "
+                    "%d lights dropped in %d clusters",
+                    lightGrid->tilesX, lightGrid->tilesY, lightGrid->clusterSlices,
+                    lightGrid->maxClusterLights, lightGrid->maxLightsPerCluster,
+                    lightGrid->droppedLights, lightGrid->overflowClusters);
+    else if (lightingMode == lightClustered)
+        ImGui::Text("%dx%dx%d clusters, lights per cluster: avg %.2f, max %d (%d of %d lights visible)",
+                    lightGrid->tilesX, lightGrid->tilesY, lightGrid->clusterSlices,
+                    lightGrid->averageLightsPerTile, lightGrid->maxLightsPerTile,
+                    lightGrid->visibleLights, lightGrid->lightCount);
+    else if (lightingMode == lightTiled)
+        ImGui::Text("%dx%d tiles, lights per tile: avg %.2f, max %d (%d of %d lights visible)",
+                    lightGrid->tilesX, lightGrid->tilesY, lightGrid->averageLightsPerTile,
+                    lightGrid->maxLightsPerTile, lightGrid->visibleLights, lightGrid->lightCount);
     ImGui::End();
     if (ImGui::BeginMainMenuBar()) {
         // This menu demonstrates how to provide the user a list of toggleable settings.
@@ -547,13 +770,15 @@ void Scene::BuildTransforms()
 // goals.)
 void Scene::DrawScene()
 {
-    glEnable(GL_DEPTH_TEST);
-    glDisable(GL_BLEND);
-    glEnable(GL_CULL_FACE);
     // Set the viewport
     glfwGetFramebufferSize(window, &width, &height);
     glViewport(0, 0, width, height);
 
+    // Keep the G-buffer the size of the viewport; replaced targets
+    // go back to the pool, which frees them after a few frames.
+    targetPool->BeginFrame();
+    fbo->Resize(width, height);
+
     CHECKERROR;
     // Calculate the light's position from lightSpin, lightTilt, lightDist
     lightPos = glm::vec3(lightDist*cos(lightSpin*rad)*sin(lightTilt*rad),
@@ -563,218 +788,320 @@ void Scene::DrawScene()
     // Update position of any continuously animating objects
     double atime = 360.0*glfwGetTime()/36;
     for (std::vector<Object*>::iterator m=animated.begin();  m<animated.end();  m++)
-        (*m)->animTr = Rotate(2, atime);
+        (*m)->SetAnimTr(Rotate(2, atime));
 
     BuildTransforms();
+    hierarchy->Update(Identity);
+    hierarchy->Cull(WorldProj*WorldView);
 
     // The lighting algorithm needs the inverse of the WorldView matrix
     WorldInverse = glm::inverse(WorldView);
+    hierarchy->SelectLevels((WorldInverse*glm::vec4(0.0, 0.0, 0.0, 1.0)).xyz(), height/(2.0f*ry));
 
 
     ////////////////////////////////////////////////////////////////////////////////
     // Anatomy of a pass:
+    //   Declare the resources it reads, writes and clears, and the
+    //   depth/blend/cull state it needs (the frame graph binds the
+    //   render target, sets the viewport and state, and clears)
     //   Choose a shader  (create the shader in InitializeScene above)
-    //   Choose and FBO/Render-Target (if needed; create the FBO in InitializeScene above)
-    //   Set the viewport (to the pixel size of the screen or FBO)
-    //   Clear the screen.
     //   Set the uniform variables required by the shader
     //   Draw the geometry
-    //   Unset the FBO (if one was used)
     //   Unset the shader
     ////////////////////////////////////////////////////////////////////////////////
 
     CHECKERROR;
-    int loc, programId;
-    ////////////////////////////////////////////////////////////////////////////////
-    //1. Geometry pass
-    ////////////////////////////////////////////////////////////////////////////////
-    // Choose the Geometry shader
-    programId = gBufferProgram->programId;
-    gBufferProgram->UseShader();
-
-    //glEnable(GL_CULL_FACE);
+    frameGraph->Reset();
+    const int gBuffer = frameGraph->ImportTarget("gBuffer", fbo->gNormal, fbo->fboID, false, width, height);
+    const int gDepth = frameGraph->ImportTarget("gDepth", fbo->gDepth, fbo->fboID, true, width, height);
+    const int backColor = frameGraph->ImportBackbuffer("backColor", false, width, height);
+    // Nothing reads the default framebuffer's depth after the frame.
+    const int backDepth = frameGraph->ImportBackbuffer("backDepth", true, width, height, false);
+    const int lightData = frameGraph->CreateVirtual("lightData");
+    const int lightBins = frameGraph->CreateVirtual("lightBins");
+    const bool binned = lightingMode == lightTiled || lightingMode == lightClustered;
 
-    //glEnable(GL_BLEND);
-
-
-
-
-    glViewport(0, 0, width, height);
     glClearColor(0.0, 0.0, 0.0, 1.0); // keep it black so it doesn't leak into g-buffer
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    fbo->BindFBO();
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glm::mat4 model = glm::mat4(1.0);
-
-    loc = glGetUniformLocation(programId, "WorldProj");
-    glUniformMatrix4fv(loc, 1, GL_FALSE, Pntr(WorldProj));
-    loc = glGetUniformLocation(programId, "WorldView");
-    glUniformMatrix4fv(loc, 1, GL_FALSE, Pntr(WorldView));
-
-
-    CHECKERROR;
-
-    objectRoot->Draw(gBufferProgram, Identity);//////
-    //bunny->Draw(gBufferProgram, Translate(-2.0, 2.0, 0.00) * Rotate(0, 90) * Scale(10, 10, 10));//////
-    //bunny->Draw(gBufferProgram, Translate(0.0, 0.0, 0.00) * Rotate(0, 90) * Scale(10, 10, 10));//////
-    //bunny->Draw(gBufferProgram, Translate(2.0, -2.0, 0.00) * Rotate(0, 90) * Scale(10, 10, 10));//////
-
-    CHECKERROR;
-
-    CHECKERROR;
-    fbo->UnbindFBO();
-    gBufferProgram->UnuseShader();
 
     ////////////////////////////////////////////////////////////////////////////////
-    //2. Lighting pass
+    //1. Geometry pass
     ////////////////////////////////////////////////////////////////////////////////
-    
-    // Choose the lighting shader
-    lightingProgram->UseShader();
-    programId = lightingProgram->programId;
-
-    //   Choose and FBO/Render-Target (if needed; create the FBO in InitializeScene above)
-    glClear(GL_COLOR_BUFFER_BIT| GL_DEPTH_BUFFER_BIT);
-    glEnable(GL_DEPTH_TEST);
-
-    // Set the viewport, and clear the screen
-    //glViewport(0, 0, width, height);
-    //glClearColor(0.0, 0.0, 0.0, 1.0);
-
+    frameGraph->AddPass("Geometry", {}, {gBuffer, gDepth}, {gBuffer, gDepth}, PassState(true, false, true), [this]() {
+        gBufferProgram->UseShader();
+        gBufferProgram->Set(gBufferUniforms.WorldProj, WorldProj);
+        gBufferProgram->Set(gBufferUniforms.WorldView, WorldView);
+        gBufferProgram->Set(gBufferUniforms.packedGBuffer, int(fbo->packed));
+        CHECKERROR;
+
+        if (queries->enabled)
+            hierarchy->DrawQueried(gBufferProgram, queries, WorldProj*WorldView, eye, front);
+        else if (instancing && occlusion->enabled)
+            hierarchy->DrawOccluded(gBufferProgram, occlusion, fbo->gDepth, width, height, WorldProj*WorldView,
+                                    multiDraw ? geometryPool : NULL);
+        else if (instancing)
+            hierarchy->DrawInstanced(gBufferProgram, multiDraw ? geometryPool : NULL);
+        else if (sortedQueue) {
+            renderQueue->Clear();
+            hierarchy->Enqueue(renderQueue, gBufferProgram, WorldView);
+            renderQueue->Submit(); }
+        else
+            hierarchy->Draw(gBufferProgram);
+
+        if (streaming && streamedMesh && streamedMesh->loaded) {
+            const glm::vec3 viewer = (WorldInverse*glm::vec4(0.0, 0.0, 0.0, 1.0)).xyz();
+            streamedMesh->Update(streamedTr, WorldProj*WorldView, viewer, height/(2.0f*ry));
+            streamedMaterial->Draw(gBufferProgram, streamedTr);
+            streamedMesh->Draw(gBufferProgram, streamedTr); }
+        CHECKERROR;
+        gBufferProgram->UnuseShader();
+
+        if (splatting)
+            pointSplats->Draw(splatTr, WorldView, WorldProj, fbo->gDepth, width, height, fbo->packed,
+                              splatMaterial->diffuseColor, splatMaterial->specularColor); });
 
-    // @@ The scene specific parameters (uniform variables) used by
-    // the shader are set here.  Object specific parameters are set in
-    // the Draw procedure in object.cpp
-    
-    loc = glGetUniformLocation(programId, "WorldProj");
-    glUniformMatrix4fv(loc, 1, GL_FALSE, Pntr(WorldProj));
-    loc = glGetUniformLocation(programId, "WorldView");
-    glUniformMatrix4fv(loc, 1, GL_FALSE, Pntr(WorldView));
-    loc = glGetUniformLocation(programId, "WorldInverse");
-    glUniformMatrix4fv(loc, 1, GL_FALSE, Pntr(WorldInverse));
-    loc = glGetUniformLocation(programId, "lightPos");
-    glUniform3fv(loc, 1, &(lightPos[0]));   
-    loc = glGetUniformLocation(programId, "mode");
-    glUniform1i(loc, mode);
-
-    CHECKERROR;
-    
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, fbo->gPosition);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, fbo->gNormal);
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, fbo->gDiffuse);
-    glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_2D, fbo->gSpecular);
-    //Sets depth - testing off, blending on for additive blending, and face culling on.
-    if (lightRadius.size() == 0)
+    ////////////////////////////////////////////////////////////////////////////////
+    //2. Lights: radii, and the upload of all lights in one buffer update
+    ////////////////////////////////////////////////////////////////////////////////
+    frameGraph->AddPass("Lights", {}, {lightData}, {}, PassState(), [this]() {
+        // The global light is the last one and follows the menu.
+        const unsigned int g = lightPositions.size()-1;
+        lightPositions[g] = glm::vec3(lightX, lightY, lightZ);
         lightRadius.resize(lightPositions.size(), 0);
-    //fbo->BindTexture(0, programId, "gPosition");
-    for (unsigned int i = 0; i < lightPositions.size(); i++)
-    {
-
-        glUniform3fv(glGetUniformLocation(programId, ("lights[" + std::to_string(i) + "].Position").c_str()), 1, &(lightPositions[i][0]));
-        glUniform3fv(glGetUniformLocation(programId, ("lights[" + std::to_string(i) + "].Color").c_str()), 1, &(lightColors[i][0]));
 
         // update attenuation parameters and calculate radius
         const float constant = 1.0f;
         const float linear = 0.7f;
         const float quadratic = 1.8f;
-        float lightMax = std::fmaxf(std::fmaxf(lightColors[i].r, lightColors[i].g), lightColors[i].b);
-        float radius =
-            0.1f * (-linear + std::sqrtf(linear * linear - 4 * quadratic * (constant - (256.0 / 5.0) * lightMax)))
-            / (2 * quadratic);
-        lightRadius[i] = radius;
-        if (i == lightPositions.size() - 1)
+        for (unsigned int i = 0; i < lightPositions.size(); i++)
         {
-            lightRadius[i] *= 5.f;
-            radius = lightRadius[i];
+            float lightMax = std::fmaxf(std::fmaxf(lightColors[i].r, lightColors[i].g), lightColors[i].b);
+            lightRadius[i] =
+                0.1f * (-linear + std::sqrtf(linear * linear - 4 * quadratic * (constant - (256.0 / 5.0) * lightMax)))
+                / (2 * quadratic);
+            if (i == g)
+                lightRadius[i] *= 5.f;
         }
-        glUniform1f(glGetUniformLocation(programId, ("lights[" + std::to_string(i) + "].Linear").c_str()), linear);
-        glUniform1f(glGetUniformLocation(programId, ("lights[" + std::to_string(i) + "].Quadratic").c_str()), quadratic);
-        glUniform1f(glGetUniformLocation(programId, ("lights[" + std::to_string(i) + "].Radius").c_str()), radius);
-    }
-    glUniform3fv(glGetUniformLocation(programId, "viewPos"), 1, &(eye[0]));
-    renderQuad();
 
-    // Draw all objects (This recursively traverses the object hierarchy.)
-    CHECKERROR;
+        lightBuffer->Upload(lightPositions, lightColors, lightRadius, linear, quadratic);
+        lightBuffer->Bind(); });
 
+    ////////////////////////////////////////////////////////////////////////////////
+    //3. Bin the light volumes into screen tiles or view frustum clusters
+    //   (culled unless the lighting pass reads the bins)
+    ////////////////////////////////////////////////////////////////////////////////
+    frameGraph->AddPass("Binning", {lightData}, {lightBins}, {}, PassState(), [this]() {
+        if (lightingMode == lightTiled)
+            lightGrid->Build(lightPositions, lightRadius, WorldView, WorldProj, front, width, height);
+        else
+            lightGrid->BuildClusters(lightPositions, lightRadius, WorldView, WorldProj, width, height,
+                                     lightBuffer->storage ? lightBuffer->bufferId : 0);
+        lightGrid->BindTextures(5, 6); });
 
+    ////////////////////////////////////////////////////////////////////////////////
+    //4. Copy the G-buffer's depth to the default framebuffer (culled
+    //   unless the light volumes, which are depth tested against the
+    //   scene, read it)
+    ////////////////////////////////////////////////////////////////////////////////
+    // Note that this may or may not work as the internal formats of both the FBO and default framebuffer have to match.
+    // the internal formats are implementation defined. This works on all of my systems, but if it doesn't on yours you'll likely have to write to the
+    // depth buffer in another shader stage (or somehow see to match the default framebuffer's internal format with the FBO's internal format).
+    frameGraph->AddPass("DepthBlit", {gDepth}, {backDepth}, {}, PassState(false, false, true), [this]() {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo->fboID);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0); });
 
+    ////////////////////////////////////////////////////////////////////////////////
+    //5. Lighting pass
+    ////////////////////////////////////////////////////////////////////////////////
+    std::vector<int> lightingReads = {gBuffer, gDepth, lightData};
+    if (binned) lightingReads.push_back(lightBins);
+    frameGraph->AddPass("Lighting", lightingReads, {backColor}, {backColor}, PassState(false, false, true), [this, binned]() {
+        // Choose the lighting shader
+        lightingProgram->UseShader();
+
+        // @@ The scene specific parameters (uniform variables) used by
+        // the shader are set here.  Object specific parameters are set in
+        // the Draw procedure in object.cpp
+        const SceneUniforms& u = lightingUniforms;
+        lightingProgram->Set(u.WorldProj, WorldProj);
+        lightingProgram->Set(u.WorldView, WorldView);
+        lightingProgram->Set(u.WorldInverse, WorldInverse);
+        lightingProgram->Set(u.ProjInverse, glm::inverse(WorldProj));
+        lightingProgram->Set(u.packedGBuffer, int(fbo->packed));
+        lightingProgram->Set(u.lightPos, lightPos);
+        CHECKERROR;
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, fbo->gPosition);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, fbo->gNormal);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, fbo->gDiffuse);
+        glActiveTexture(GL_TEXTURE3);
+        glBindTexture(GL_TEXTURE_2D, fbo->gSpecular);
+        glActiveTexture(GL_TEXTURE4);
+        glBindTexture(GL_TEXTURE_2D, fbo->gDepth);
+
+        if (binned) {
+            if (lightingMode == lightClustered) {
+                lightingProgram->Set(u.clusterSlices, lightGrid->clusterSlices);
+                lightingProgram->Set(u.sliceScale, lightGrid->sliceScale);
+                lightingProgram->Set(u.sliceBias, lightGrid->sliceBias); }
+            lightingProgram->Set(u.tileSize,
+                                 lightingMode == lightTiled ? lightGrid->tileSize : lightGrid->clusterTileSize);
+            lightingProgram->Set(u.tilesX, lightGrid->tilesX);
+            lightingProgram->Set(u.tilesY, lightGrid->tilesY); }
+        lightingProgram->Set(u.lightingMode, lightingMode);
+        lightingProgram->Set(u.lightCount, lightBuffer->count);
+        lightingProgram->Set(u.viewPos, eye);
+
+        renderQuad();
+        CHECKERROR;
+        lightingProgram->UnuseShader(); });
 
-    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo->fboID);
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0); // write to default framebuffer
-    // blit to default framebuffer. Note that this may or may not work as the internal formats of both the FBO and default framebuffer have to match.
-    // the internal formats are implementation defined. This works on all of my systems, but if it doesn't on yours you'll likely have to write to the 		
-    // depth buffer in another shader stage (or somehow see to match the default framebuffer's internal format with the FBO's internal format).
-    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    ///// <summary>
-    ///// /////////////////////////////////////
-    ///// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    //6. Light volumes, added over the lighting pass's output
+    ////////////////////////////////////////////////////////////////////////////////
+    if (lightingMode == lightVolumes)
+        frameGraph->AddPass("LightVolumes", {gBuffer, gDepth, backDepth, lightData}, {backColor}, {},
+                            PassState(false, false, true), [this]() { DrawLightVolumes(); });
 
-    //objectRootLight->Draw(lightBoxProgram, Identity);
-    CHECKERROR;
-    lightingProgram->UnuseShader();
+    ////////////////////////////////////////////////////////////////////////////////
+    //7. Light boxes, drawn additively in wireframe
+    ////////////////////////////////////////////////////////////////////////////////
+    frameGraph->AddPass("LightBoxes", {lightData}, {backColor}, {}, PassState(false, true, true), [this]() {
+        lightBoxProgram->UseShader();
+        glBlendFunc(GL_ONE, GL_ONE);
+        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+        lightBoxProgram->Set(lightBoxUniforms.projection, WorldProj);
+        lightBoxProgram->Set(lightBoxUniforms.view, WorldView);
+        lightBoxProgram->Set(lightBoxUniforms.viewPos, eye);
+        const int boxModel = lightBoxUniforms.model;
+        const int boxColor = lightBoxUniforms.lightColor;
+        const int boxPosition = lightBoxUniforms.lightPosition;
+        const int boxRadius = lightBoxUniforms.lightRadius;
+        CHECKERROR;
+
+        glm::mat4 model;
+        for (unsigned int i = 0; i < lightPositions.size()-1; i++)
+        {
+            model = glm::mat4(1.0f);
+            model = glm::translate(model, lightPositions[i]);
+            model = glm::scale(model, glm::vec3( lightRadius[i]));
+            lightBoxProgram->Set(boxModel, model);
+            lightBoxProgram->Set(boxColor, lightColors[i]);
+            lightBoxProgram->Set(boxPosition, lightPositions[i]);
+            lightBoxProgram->Set(boxRadius, lightRadius[i]);
+
+            if(localLights)
+                light->Draw(lightBoxProgram, Identity);
+        }
+        //Global Light
+        const unsigned int g = lightPositions.size()-1;
+        model = glm::mat4(1.0f);
+        model = glm::translate(model, lightPositions[g]);
+        model = glm::scale(model, glm::vec3(0.125f ));
+        lightBoxProgram->Set(boxModel, model);
+        lightBoxProgram->Set(boxColor, lightColors[g]);
+        lightBoxProgram->Set(boxPosition, lightPositions[g]);
+        lightBoxProgram->Set(boxRadius, lightRadius[g]);
+
+        light->Draw(lightBoxProgram, Identity);
+
+        CHECKERROR;
+        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+        lightBoxProgram->UnuseShader(); });
+
+    frameGraph->Execute();
     CHECKERROR;
+}
 
+////////////////////////////////////////////////////////////////////////
+// Shades each local light by drawing its bounding sphere over the
+// full-screen pass's output.  The default framebuffer must already
+// hold the G-buffer's depth.
+//
+// A stencil pass first marks the pixels whose scene depth lies inside
+// the sphere: back faces behind the scene increment, front faces
+// behind the scene decrement, so only pixels between the two faces
+// (including when the eye is inside the sphere) end up nonzero.  The
+// shading pass then draws the sphere's back faces with additive
+// blending, restricted to those pixels.
+void Scene::DrawLightVolumes()
+{
+    // Sphere(16)'s flat faces lie inside the unit sphere; enlarge it
+    // so the polygonal volume contains the light's whole range.
+    const float inflate = 1.05f;
+    glm::vec2 screenSize(width, height);
+    glm::mat4 model;
+
+    lightVolumeProgram->UseShader();
+    const SceneUniforms& u = lightVolumeUniforms;
+    lightVolumeProgram->Set(u.WorldProj, WorldProj);
+    lightVolumeProgram->Set(u.WorldView, WorldView);
+    lightVolumeProgram->Set(u.screenSize, screenSize);
+    lightVolumeProgram->Set(u.viewPos, eye);
+    lightVolumeProgram->Set(u.WorldInverse, WorldInverse);
+    lightVolumeProgram->Set(u.ProjInverse, glm::inverse(WorldProj));
+    lightVolumeProgram->Set(u.packedGBuffer, int(fbo->packed));
+    const int volumeModel = u.ModelTr;
+    const int volumeIndex = u.lightIndex;
 
     lightBoxProgram->UseShader();
-    glDisable(GL_DEPTH_TEST);
+    lightBoxProgram->Set(lightBoxUniforms.projection, WorldProj);
+    lightBoxProgram->Set(lightBoxUniforms.view, WorldView);
+    const int boxModel = lightBoxUniforms.model;
+    CHECKERROR;
+
+    // Each light's shading pass zeroes the stencil it covers, so one
+    // clear here leaves it zero for every light's stencil pass.
+    glEnable(GL_STENCIL_TEST);
+    glClear(GL_STENCIL_BUFFER_BIT);
+    glDepthMask(GL_FALSE);
     glBlendFunc(GL_ONE, GL_ONE);
-    glEnable(GL_BLEND);
-    glEnable(GL_CULL_FACE);
 
-    CHECKERROR;
-    glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-    programId = lightBoxProgram->programId;
-    glUniformMatrix4fv(glGetUniformLocation(programId, "projection"), 1, GL_FALSE, &WorldProj[0][0]);
-    glUniformMatrix4fv(glGetUniformLocation(programId, "view"), 1, GL_FALSE, &WorldView[0][0]);
-    glm::vec3 white(1.0, 1.0, 1.0);
+    // The last light is the global one, already shaded by the full-screen pass.
     for (unsigned int i = 0; i < lightPositions.size()-1; i++)
     {
         model = glm::mat4(1.0f);
         model = glm::translate(model, lightPositions[i]);
-        //model = glm::scale(model, glm::vec3(0.125f ));
-        model = glm::scale(model, glm::vec3( lightRadius[i]));
-        glUniformMatrix4fv(glGetUniformLocation(programId, "model"), 1, GL_FALSE, &model[0][0]);
-        glUniform3fv(glGetUniformLocation(programId, "lightColor"), 1, &lightColors[i][0]);
-        glUniform3fv(glGetUniformLocation(programId, "lightPosition"), 1, &lightPositions[i][0]);
-        glUniform1f(glGetUniformLocation(programId, "lightRadius"), lightRadius[i]);
-        glUniform3fv(glGetUniformLocation(programId, "viewPos"), 1, &(eye[0]));
-
-        //renderCube();
-        if(localLights)
-            light->Draw(lightBoxProgram, Identity);
+        model = glm::scale(model, glm::vec3(lightRadius[i]*inflate));
+
+        // Stencil pass: depth test only, no color writes.
+        lightBoxProgram->UseShader();
+        lightBoxProgram->Set(boxModel, model);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glEnable(GL_DEPTH_TEST);
+        glDepthFunc(GL_LESS);
+        glDisable(GL_CULL_FACE);
+        glDisable(GL_BLEND);
+        glStencilFunc(GL_ALWAYS, 0, 0);
+        glStencilOpSeparate(GL_BACK, GL_KEEP, GL_INCR_WRAP, GL_KEEP);
+        glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_DECR_WRAP, GL_KEEP);
+        light->shape->DrawVAO();
+
+        // Shading pass: back faces, so the eye may be inside the sphere.
+        lightVolumeProgram->UseShader();
+        lightVolumeProgram->Set(volumeModel, model);
+        lightVolumeProgram->Set(volumeIndex, int(i));
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glStencilFunc(GL_NOTEQUAL, 0, 0xFF);
+        glStencilOp(GL_KEEP, GL_ZERO, GL_ZERO);
+        glDisable(GL_DEPTH_TEST);
+        glEnable(GL_CULL_FACE);
+        glCullFace(GL_FRONT);
+        glEnable(GL_BLEND);
+        light->shape->DrawVAO();
     }
-    //Global Light
-    lightPositions[NR_LIGHTS].x = lightX;
-    lightPositions[NR_LIGHTS].y = lightY;
-    lightPositions[NR_LIGHTS].z = lightZ;
-    model = glm::mat4(1.0f);
-    model = glm::translate(model, lightPositions[NR_LIGHTS]);
-    model = glm::scale(model, glm::vec3(0.125f ));
-    //model = glm::scale(model, glm::vec3(1.f));
-    glUniformMatrix4fv(glGetUniformLocation(programId, "model"), 1, GL_FALSE, &model[0][0]);
-    glUniform3fv(glGetUniformLocation(programId, "lightColor"), 1, &lightColors[NR_LIGHTS][0]);
-    glUniform3fv(glGetUniformLocation(programId, "lightPosition"), 1, &lightPositions[NR_LIGHTS][0]);
-    glUniform1f(glGetUniformLocation(programId, "lightRadius"), lightRadius[NR_LIGHTS]);
-    glUniform3fv(glGetUniformLocation(programId, "viewPos"), 1, &(eye[0]));
-
-    light->Draw(lightBoxProgram, Identity);
-    //renderCube();
-
-    CHECKERROR; 
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-    //
-    //// Turn off the shader
-    lightBoxProgram->UnuseShader();
+    CHECKERROR;
 
-    ////////////////////////////////////////////////////////////////////////////////
-    // End of Lighting pass
-    ////////////////////////////////////////////////////////////////////////////////
+    glCullFace(GL_BACK);
+    glDisable(GL_STENCIL_TEST);
+    glDepthMask(GL_TRUE);
+    glDisable(GL_BLEND);
+    lightVolumeProgram->UnuseShader();
+
+    // Restore the full-screen lighting program for the caller.
+    lightingProgram->UseShader();
 }
 
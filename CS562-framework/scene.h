@@ -14,8 +14,27 @@
 
 #include "shapes.h"
 #include "object.h"
+#include "hierarchy.h"
+#include "occlusion.h"
+#include "queries.h"
+#include "renderqueue.h"
+#include "geometrypool.h"
+#include "streamedmesh.h"
+#include "pointsplats.h"
 #include "texture.h"
 #include "fbo.h"
+#include "rendertarget.h"
+#include "framegraph.h"
+#include "lightgrid.h"
+#include "lightbuffer.h"
+
+// How the lighting pass finds the lights affecting a pixel.
+enum LightingModes {
+    lightAll	= 0,    // Every pixel loops over every light
+    lightTiled	= 1,    // Every pixel loops over its screen tile's light list
+    lightClustered	= 2,    // Every pixel loops over its depth-sliced cluster's light list
+    lightVolumes	= 3,    // Each local light draws its sphere; only covered pixels are shaded
+};
 
 enum ObjectIds {
     nullId	= 0,
@@ -37,6 +56,18 @@ enum ObjectIds {
 
 class Shader;
 
+// Handles (see ShaderProgram::Uniform) of the per-frame uniforms of
+// the scene's programs, resolved once after linking.  Each program
+// has only some of them; the rest are -1, which Set ignores.
+struct SceneUniforms
+{
+    int WorldProj, WorldView, WorldInverse, ProjInverse, packedGBuffer, viewPos, lightPos;
+    int lightingMode, lightCount, tileSize, tilesX, tilesY, clusterSlices, sliceScale, sliceBias;
+    int screenSize, ModelTr, lightIndex;                        // Light volumes
+    int projection, view, model, lightColor, lightPosition, lightRadius; // Light boxes
+
+    void Resolve(ShaderProgram* program);
+};
 
 class Scene
 {
@@ -52,7 +83,8 @@ public:
     std::vector<glm::vec3> lightColors;
     std::vector<float> lightRadius;
     // @@ Perhaps declare additional scene lighting values here. (lightVal, lightAmb)
-    const unsigned int NR_LIGHTS = 32;
+    int localLightCount; // Number of random local lights; the global light follows them
+    LightBuffer* lightBuffer;
 
 
     bool drawReflective;
@@ -69,6 +101,8 @@ public:
     bool flatshade;
     int mode; // Extra mode indicator hooked up to number keys and sent to shader
     bool localLights = false;
+    int lightingMode; // One of LightingModes
+    LightGrid* lightGrid;
     // Viewport
     int width, height;
 
@@ -78,6 +112,23 @@ public:
     // All objects in the scene are children of this single root object.
     Object* objectRoot;
     Object* objectRootLight;
+    ObjectHierarchy* hierarchy; // objectRoot, flattened for drawing
+    bool instancing;            // Draw the hierarchy one instanced call per Shape
+    OcclusionCuller* occlusion; // Used with instancing, on GL 4.3
+    OcclusionQueries* queries;  // Occlusion queries instead, on any context
+    RenderQueue* renderQueue;   // Sorts the draws when not instancing
+    bool sortedQueue;
+    GeometryPool* geometryPool; // The static shapes, for multi-draw indirect on GL 4.3
+    bool multiDraw;
+    StreamedMesh* streamedMesh; // A scan streamed from disk, drawn at streamedTr
+    ClusterCook* clusterCook;   // Cooking its cluster file, if under way
+    bool streaming;
+    glm::mat4 streamedTr;
+    Object* streamedMaterial;   // No shape; supplies the scan's surface values
+    PointSplats* pointSplats;   // A scan's vertices as a point cloud, on GL 4.3
+    bool splatting;
+    glm::mat4 splatTr;
+    Object* splatMaterial;
     Object *central, *anim, *room, *floor, *teapot, *podium, *sky,*quad,
             *ground, *sea, *spheres, *leftFrame, *rightFrame, *bunny, *light,
         *bunny1, *bunny2, *bunny3, *bunny4;
@@ -89,8 +140,13 @@ public:
     ShaderProgram* gBufferProgram;
     ShaderProgram* lightingProgram;
     ShaderProgram* lightBoxProgram;
+    ShaderProgram* lightVolumeProgram;
+    SceneUniforms gBufferUniforms, lightingUniforms, lightBoxUniforms, lightVolumeUniforms;
     // @@ Declare additional shaders if necessary
+    RenderTargetPool* targetPool;
     FBO* fbo;
+    FrameGraph* frameGraph; // Sequences DrawScene's passes
+    bool packedGBuffer; // Depth + RG16 normal + RGBA8 G-buffer instead of four RGBA32F targets
     Texture* m_texture;
 
     // Options menu stuff
@@ -99,8 +155,10 @@ public:
     float lightY = 0;
     float lightZ = 0;
     void InitializeScene();
+    void GenerateLights();
     void BuildTransforms();
     void DrawMenu();
     void DrawScene();
+    void DrawLightVolumes();
 
 };
@@ -8,11 +8,18 @@
 ////////////////////////////////////////////////////////////////////////
 
 #include <fstream>
+#include <string>
+#include <string.h>
 
 #include <glbinding/gl/gl.h>
 #include <glbinding/Binding.h>
 using namespace gl;
 
+#define GLM_FORCE_CTOR_INIT
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+
 #include "shader.h"
 
 // Reads a specified file into a string and returns the string.  The
@@ -52,18 +59,31 @@ void ShaderProgram::UnuseShader()
 }
 
 // Read, send to OpenGL, and compile a single file into a shader
-// program.  In case of an error, retrieve and print the error log
-// string.
-void ShaderProgram::AddShader(const char* fileName, GLenum type)
+// program.  Optional defines (complete "#define ...\n" lines) are
+// inserted just after the file's #version line, so one source file
+// can be compiled into several variants.  In case of an error,
+// retrieve and print the error log string.
+void ShaderProgram::AddShader(const char* fileName, GLenum type, const char* defines)
 {
     // Read the source from the named file
     char* src = ReadFile(fileName);
-    const char* psrc[1] = {src};
+
+    // Split the source after the #version line (if any) and hand
+    // OpenGL the three pieces.
+    std::string head, tail(src);
+    if (defines) {
+        size_t v = tail.find("#version");
+        size_t eol = (v == std::string::npos) ? 0 : tail.find('\n', v);
+        if (eol != std::string::npos && v != std::string::npos) eol++;
+        else eol = 0;
+        head = tail.substr(0, eol);
+        tail = tail.substr(eol); }
+    const char* psrc[3] = {head.c_str(), defines ? defines : "", tail.c_str()};
 
     // Create a shader and attach, hand it the source, and compile it.
     int shader = glCreateShader(type);
     glAttachShader(programId, shader);
-    glShaderSource(shader, 1, psrc, NULL);
+    glShaderSource(shader, 3, psrc, NULL);
     glCompileShader(shader);
     delete src;
 
@@ -101,4 +121,101 @@ void ShaderProgram::LinkProgram()
         printf("Link log:\n%s\n", buffer);
         delete buffer;
     }
+
+    Reflect();
+}
+
+// Record a handle for every active uniform outside of uniform blocks.
+// An array gets a handle for each element ("a[2]"), and its first
+// element is also known by the bare name ("a").
+void ShaderProgram::Reflect()
+{
+    handles.clear();
+    slots.clear();
+
+    int count = 0, maxLength = 0;
+    glGetProgramiv(programId, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(programId, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+    std::vector<char> buffer(maxLength+1);
+
+    for (int i=0;  i<count;  i++) {
+        int size;
+        GLenum type;
+        glGetActiveUniform(programId, i, maxLength+1, NULL, &size, &type, &buffer[0]);
+        std::string name(&buffer[0]);
+        size_t bracket = name.find('[');
+        bool isArray = bracket != std::string::npos && name.compare(bracket, 3, "[0]") == 0
+            && bracket+3 == name.size();
+        if (isArray) name = name.substr(0, bracket);
+
+        for (int e=0;  e<size;  e++) {
+            std::string elem = isArray ? name + "[" + std::to_string(e) + "]" : name;
+            int location = glGetUniformLocation(programId, elem.c_str());
+            if (location < 0) continue; // In a uniform block
+            UniformSlot slot;
+            slot.location = location;
+            slot.valid = false;
+            handles[elem] = slots.size();
+            if (isArray && e == 0) handles[name] = slots.size();
+            slots.push_back(slot); } }
+}
+
+int ShaderProgram::Uniform(const char* name)
+{
+    std::unordered_map<std::string, int>::const_iterator it = handles.find(name);
+    return it == handles.end() ? -1 : it->second;
+}
+
+// True (and the value is remembered) if the uniform does not already
+// hold these bytes.
+bool ShaderProgram::Changed(const int handle, const void* v, const int size)
+{
+    if (handle < 0) return false;
+    UniformSlot& slot = slots[handle];
+    if (slot.valid && memcmp(slot.value, v, size) == 0) return false;
+    memcpy(slot.value, v, size);
+    slot.valid = true;
+    return true;
+}
+
+void ShaderProgram::Set(const int handle, const int v)
+{
+    if (Changed(handle, &v, sizeof(v)))
+        glUniform1i(slots[handle].location, v);
+}
+
+void ShaderProgram::Set(const int handle, const float v)
+{
+    if (Changed(handle, &v, sizeof(v)))
+        glUniform1f(slots[handle].location, v);
+}
+
+void ShaderProgram::Set(const int handle, const glm::vec2& v)
+{
+    if (Changed(handle, &v[0], sizeof(v)))
+        glUniform2fv(slots[handle].location, 1, &v[0]);
+}
+
+void ShaderProgram::Set(const int handle, const glm::vec3& v)
+{
+    if (Changed(handle, &v[0], sizeof(v)))
+        glUniform3fv(slots[handle].location, 1, &v[0]);
+}
+
+void ShaderProgram::Set(const int handle, const glm::vec4& v)
+{
+    if (Changed(handle, &v[0], sizeof(v)))
+        glUniform4fv(slots[handle].location, 1, &v[0]);
+}
+
+void ShaderProgram::Set(const int handle, const glm::ivec3& v)
+{
+    if (Changed(handle, &v[0], sizeof(v)))
+        glUniform3iv(slots[handle].location, 1, &v[0]);
+}
+
+void ShaderProgram::Set(const int handle, const glm::mat4& v)
+{
+    if (Changed(handle, &v[0][0], sizeof(v)))
+        glUniformMatrix4fv(slots[handle].location, 1, GL_FALSE, &v[0][0]);
 }
@@ -5,16 +5,52 @@
 // loaded (method "Use"), its vertex shader and pixel shader will be
 // invoked for all geometry passing through the graphics pipeline.
 // When done, unload it with method "Unuse".
+//
+// Linking also records every active uniform, so that uniforms can be
+// set through small integer handles (from method "Uniform") and the
+// typed "Set" methods, which skip values the program already holds.
 ////////////////////////////////////////////////////////////////////////
 
+#include <string>
+#include <vector>
+#include <unordered_map>
+
 class ShaderProgram
 {
 public:
     int programId;
     
     ShaderProgram();
-    void AddShader(const char* fileName, const GLenum type);
+    void AddShader(const char* fileName, const GLenum type, const char* defines=NULL);
     void LinkProgram();
     void UseShader();
     void UnuseShader();
+
+    // Handle of an active uniform, or -1 if the program has none by
+    // that name.  Look handles up once, outside of drawing loops.
+    int Uniform(const char* name);
+
+    // Set a uniform of this program, which must be the current one.
+    // The last value set through each handle is remembered, and
+    // setting the same value again does nothing.  (So don't mix these
+    // with raw glUniform calls on the same uniform.)
+    void Set(const int handle, const int v);
+    void Set(const int handle, const float v);
+    void Set(const int handle, const glm::vec2& v);
+    void Set(const int handle, const glm::vec3& v);
+    void Set(const int handle, const glm::vec4& v);
+    void Set(const int handle, const glm::ivec3& v);
+    void Set(const int handle, const glm::mat4& v);
+
+private:
+    struct UniformSlot {
+        int location;
+        bool valid;             // value holds what the program has
+        float value[16];
+    };
+    std::unordered_map<std::string, int> handles;
+    std::vector<UniformSlot> slots;
+
+    void Reflect();
+    bool Changed(const int handle, const void* v, const int size);
 };
@@ -4,14 +4,27 @@
 // This is the most efficient way to get geometry into the OpenGL
 // graphics pipeline.
 //
-// Each vertex is specified as four attributes which are made
-// available in a vertex shader in the following attribute slots.
+// Each vertex is specified as four attributes, interleaved in one
+// buffer, which are made available in a vertex shader in the
+// following attribute slots.
 //
-// position,        vec4,   attribute #0
+// position,        vec3,   attribute #0 (w reads as 1)
 // normal,          vec3,   attribute #1
 // texture coord,   vec3,   attribute #2
 // tangent,         vec3,   attribute #3
 //
+// Instanced draws (see DrawVAOInstanced) add per-instance attributes:
+//
+// model transform, mat4,   attributes #4-#7
+// diffuse+shine,   vec4,   attribute #8
+// specular+id,     vec4,   attribute #9
+//
+// Every draw also sets two constant attributes that decode compressed
+// positions (see Shape::quality) as offset + position*scale:
+//
+// position offset, vec3,   attribute #10
+// position scale,  vec3,   attribute #11
+//
 // An instance of any of these shapes is create with a single call:
 //    unsigned int obj = CreateSphere(divisions, &quadCount);
 // and drawn by:
@@ -23,6 +36,9 @@
 #include <vector>
 #include <fstream>
 #include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
 
 #include <glbinding/gl/gl.h>
 #include <glbinding/Binding.h>
@@ -41,6 +57,10 @@ using namespace gl;
 #include "shapes.h"
 #include "rply.h"
 #include "simplexnoise.h"
+#include "meshoptimize.h"
+#include "meshcache.h"
+#include "parallel.h"
+#include "plyreader.h"
 
 const float PI = 3.14159f;
 const float rad = PI/180.0f;
@@ -51,78 +71,172 @@ void pushquad(std::vector<glm::ivec3> &Tri, int i, int j, int k, int l)
     Tri.push_back(glm::ivec3(i,k,l));
 }
 
+// Fills a buffer object of the bound target with size bytes written
+// by fill, straight into mapped memory, with no staging copy.
+template <typename Fill>
+static void FillBuffer(const GLenum target, const size_t size, Fill fill)
+{
+    glBufferData(target, size, NULL, GL_STATIC_DRAW);
+    if (size == 0) return;
+    void* data = glMapBufferRange(target, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    fill(data);
+    glUnmapBuffer(target);
+}
+
+// Packs a vector of length at most 1 as GL_INT_2_10_10_10_REV,
+// normalized, with w = 0.
+static unsigned int PackSnorm1010102(const glm::vec3& v)
+{
+    unsigned int p = 0;
+    for (int c=0;  c<3;  c++) {
+        int q = int(floorf(glm::clamp(v[c], -1.0f, 1.0f)*511.0f + 0.5f));
+        p |= (unsigned int)(q & 0x3ff) << (10*c); }
+    return p;
+}
+
 // Batch up all the data defining a shape to be drawn (example: the
 // teapot) as a Vertex Array object (VAO) and send it to the graphics
 // card.  Return an OpenGL identifier for the created VAO.
-unsigned int VaoFromTris(std::vector<glm::vec4> Pnt,
-                         std::vector<glm::vec3> Nrm,
-                         std::vector<glm::vec2> Tex,
-                         std::vector<glm::vec3> Tan,
-                         std::vector<glm::ivec3> Tri)
+//
+// The attributes present are interleaved into a single tightly packed
+// vertex buffer (positions as vec3; attribute #0 still reads w as 1),
+// and the indices are 16 bit when the vertex count allows.  Both are
+// written directly into mapped buffers.  indexSize returns 2 or 4.
+//
+// Compressed vertices take 20 bytes instead of 44: positions are 16
+// bit normalized within the box minP..maxP (see Shape::decodeOffset),
+// normals and tangents GL_INT_2_10_10_10_REV, texture coordinates
+// half floats.
+unsigned int VaoFromTris(const std::vector<glm::vec4>& Pnt,
+                         const std::vector<glm::vec3>& Nrm,
+                         const std::vector<glm::vec2>& Tex,
+                         const std::vector<glm::vec3>& Tan,
+                         const std::vector<glm::ivec3>& Tri,
+                         const bool compressed, const glm::vec3& minP, const glm::vec3& maxP,
+                         unsigned int& indexSize)
 {
-    printf("VaoFromTris %ld %ld\n", Pnt.size(), Tri.size());
+    printf("VaoFromTris %ld %ld%s\n", Pnt.size(), Tri.size(), compressed ? " compressed" : "");
     unsigned int vaoID;
     glGenVertexArrays(1, &vaoID);
     glBindVertexArray(vaoID);
 
-    GLuint Pbuff;
-    glGenBuffers(1, &Pbuff);
-    glBindBuffer(GL_ARRAY_BUFFER, Pbuff);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float)*4*Pnt.size(),
-                 &Pnt[0][0], GL_STATIC_DRAW);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    // Bytes per vertex, and where each attribute starts
+    const bool hasN = Nrm.size() > 0, hasT = Tex.size() > 0, hasD = Tan.size() > 0;
+    const int sizeP = compressed ? 8 : 12, sizeN = compressed ? 4 : 12, sizeT = compressed ? 4 : 8;
+    const int offN = sizeP, offT = offN + (hasN ? sizeN : 0), offD = offT + (hasT ? sizeT : 0);
+    const int stride = offD + (hasD ? sizeN : 0);
+    const size_t n = Pnt.size();
+
+    // Positions map minP..maxP to 0..65535
+    glm::vec3 extent = maxP - minP;
+    glm::vec3 toUnit;
+    for (int c=0;  c<3;  c++)
+        toUnit[c] = extent[c] > 0.0f ? 1.0f/extent[c] : 0.0f;
+
+    GLuint Vbuff;
+    glGenBuffers(1, &Vbuff);
+    glBindBuffer(GL_ARRAY_BUFFER, Vbuff);
+    FillBuffer(GL_ARRAY_BUFFER, stride*n, [&](void* data) {
+            unsigned char* v = (unsigned char*)data;
+            for (size_t i=0;  i<n;  i++, v+=stride) {
+                if (!compressed) {
+                    memcpy(v, &Pnt[i][0], 12);
+                    if (hasN) memcpy(v+offN, &Nrm[i][0], 12);
+                    if (hasT) memcpy(v+offT, &Tex[i][0], 8);
+                    if (hasD) memcpy(v+offD, &Tan[i][0], 12);
+                    continue; }
+                unsigned short* p = (unsigned short*)v;
+                glm::vec3 unit = glm::clamp((Pnt[i].xyz() - minP)*toUnit, 0.0f, 1.0f);
+                for (int c=0;  c<3;  c++)
+                    p[c] = (unsigned short)(unit[c]*65535.0f + 0.5f);
+                p[3] = 0;
+                if (hasN) *(unsigned int*)(v+offN) = PackSnorm1010102(Nrm[i]);
+                if (hasT) *(unsigned int*)(v+offT) = glm::packHalf2x16(Tex[i]);
+                if (hasD) *(unsigned int*)(v+offD) = PackSnorm1010102(Tan[i]); } });
 
-    if (Nrm.size() > 0) {
-        GLuint Nbuff;
-        glGenBuffers(1, &Nbuff);
-        glBindBuffer(GL_ARRAY_BUFFER, Nbuff);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(float)*3*Nrm.size(),
-                     &Nrm[0][0], GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    if (compressed)
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride, 0);
+    else
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, 0);
+    if (hasN) {
         glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
-        glBindBuffer(GL_ARRAY_BUFFER, 0); }
-
-    if (Tex.size() > 0) {
-        GLuint Tbuff;
-        glGenBuffers(1, &Tbuff);
-        glBindBuffer(GL_ARRAY_BUFFER, Tbuff);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(float)*2*Tex.size(),
-                     &Tex[0][0], GL_STATIC_DRAW);
+        if (compressed)
+            glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)(size_t)offN);
+        else
+            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)(size_t)offN); }
+    if (hasT) {
         glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
-        glBindBuffer(GL_ARRAY_BUFFER, 0); }
-
-    if (Tan.size() > 0) {
-        GLuint Dbuff;
-        glGenBuffers(1, &Dbuff);
-        glBindBuffer(GL_ARRAY_BUFFER, Dbuff);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(float)*3*Tan.size(),
-                     &Tan[0][0], GL_STATIC_DRAW);
+        glVertexAttribPointer(2, 2, compressed ? GL_HALF_FLOAT : GL_FLOAT, GL_FALSE, stride, (void*)(size_t)offT); }
+    if (hasD) {
         glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 0, 0);
-        glBindBuffer(GL_ARRAY_BUFFER, 0); }
+        if (compressed)
+            glVertexAttribPointer(3, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)(size_t)offD);
+        else
+            glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, stride, (void*)(size_t)offD); }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 
+    indexSize = n <= 65536 ? 2 : 4;
     GLuint Ibuff;
     glGenBuffers(1, &Ibuff);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, Ibuff);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(int)*3*Tri.size(),
-                 &Tri[0][0], GL_STATIC_DRAW);
+    FillBuffer(GL_ELEMENT_ARRAY_BUFFER, indexSize*3*Tri.size(), [&](void* data) {
+            if (indexSize == 4)
+                memcpy(data, &Tri[0][0], sizeof(int)*3*Tri.size());
+            else {
+                unsigned short* d = (unsigned short*)data;
+                for (size_t t=0;  t<Tri.size();  t++)
+                    for (int c=0;  c<3;  c++)
+                        *d++ = (unsigned short)Tri[t][c]; } });
 
     glBindVertexArray(0);
+    CHECKERROR;
 
     return vaoID;
 }
 
-void Shape::MakeVAO()
+// The glDrawElements type of indices of indexSize bytes
+static GLenum IndexType(const unsigned int indexSize)
+{
+    return indexSize == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+// Everything MakeVAO does short of OpenGL, so it can run on any thread.
+void Shape::Cook()
 {
+    if (cooked) return;
     if(Nrm.size()==0)
         ComputeNRM();
     if (Tex.size() == 0)
         ComputeTEX();
-    vaoID = VaoFromTris(Pnt, Nrm, Tex, Tan, Tri);
+    OptimizeMesh(*this);
+    ComputeBounds();
+    cooked = true;
+}
+
+void Shape::MakeVAO()
+{
+    Cook();
+    const bool compressed = quality == vertexCompressed;
+    vaoID = VaoFromTris(Pnt, Nrm, Tex, Tan, Tri, compressed, minP, maxP, indexSize);
     count = Tri.size();
+    decodeOffset = compressed ? minP : glm::vec3(0.0f);
+    decodeScale = compressed ? maxP - minP : glm::vec3(1.0f);
+}
+
+// Axis aligned bounding box of the vertices, and the center and
+// diagonal length of that box.
+void Shape::ComputeBounds()
+{
+    minP = maxP = center = glm::vec3(0.0f);
+    size = 0.0f;
+    if (Pnt.empty()) return;
+    minP = maxP = Pnt[0].xyz();
+    for (size_t i=1;  i<Pnt.size();  i++) {
+        minP = glm::min(minP, Pnt[i].xyz());
+        maxP = glm::max(maxP, Pnt[i].xyz()); }
+    center = 0.5f*(minP + maxP);
+    size = glm::length(maxP - minP);
 }
 
 void Shape::DrawVAO()
@@ -130,70 +244,154 @@ void Shape::DrawVAO()
     CHECKERROR;
     glBindVertexArray(vaoID);
     CHECKERROR;
-    glDrawElements(GL_TRIANGLES, 3*count, GL_UNSIGNED_INT, 0);
+    DrawElements();
     CHECKERROR;
     glBindVertexArray(0);
 }
 
-void Shape::ComputeNRM()
+// Disabled attribute arrays read the current generic value, so these
+// hold for every vertex of the draws that follow.
+void SetPositionDecode(const glm::vec3& offset, const glm::vec3& scale)
 {
-    int size_ = Pnt.size();
-    int Facesize_ = Tri.size();
-    std::vector<int> nb_seen;
-    nb_seen.resize(size_, 0);
-    Nrm.resize(size_, glm::vec3());
-    std::vector<std::vector<glm::vec3>> prevNormal;
-    prevNormal.resize(size_, std::vector<glm::vec3>(0));
+    glVertexAttrib3f(10, offset.x, offset.y, offset.z);
+    glVertexAttrib3f(11, scale.x, scale.y, scale.z);
+}
 
+void Shape::DrawElements()
+{
+    SetPositionDecode(decodeOffset, decodeScale);
+    glDrawElements(GL_TRIANGLES, 3*count, IndexType(indexSize), 0);
+}
 
-    for (int i = 0; i < Facesize_; i++)
-    {
-        glm::vec3 vertex1 = Pnt[Tri[i].x].xyz;
-        glm::vec3 vertex2 = Pnt[Tri[i].y].xyz;
-        glm::vec3 vertex3 = Pnt[Tri[i].z].xyz;
-        glm::vec3 edge1 = vertex2 - vertex1;
-        glm::vec3 edge2 = vertex3 - vertex1;
-
-        glm::vec3 normal = glm::cross(edge1, edge2);
-        normal = glm::normalize(normal);
-        //Nrm.push_back(normal);
-
-        int v[3];
-        v[0] = Tri[i].x;
-        v[1] = Tri[i].y;
-        v[2] = Tri[i].z;
-
-        //Averaging normals
-        for (int j = 0; j < 3; j++)
-        {
-            bool IgnoreParrel = false;
-            int cur_v = v[j];
-            nb_seen[cur_v]++;
-            if (nb_seen[cur_v] == 1)
-            {
-                Nrm[cur_v] = normal;
-                prevNormal[cur_v].push_back(normal);
-            }
-            else
-            {
-                for (int k = 0; k < prevNormal[cur_v].size(); k++)
-                {
-                    if (prevNormal[cur_v][k] == normal)
-                        IgnoreParrel = true;
-                }
-                // average
-                if (IgnoreParrel != true)
-                {
-                     Nrm[cur_v].x = Nrm[cur_v].x * (1.f - 1.f / nb_seen[cur_v]) + normal.x * 1.f / nb_seen[cur_v];
-                     Nrm[cur_v].y =  Nrm[cur_v].y * (1.f - 1.f / nb_seen[cur_v]) + normal.y * 1.f / nb_seen[cur_v];
-                     Nrm[cur_v].z =  Nrm[cur_v].z * (1.f - 1.f / nb_seen[cur_v]) + normal.z * 1.f / nb_seen[cur_v];
-                     Nrm[cur_v] = glm::normalize(Nrm[cur_v]);
-                }
-            }
-        }
-    }
+// Points the per-instance attributes of the bound VAO at
+// instanceBuffer.  The pointers are set on every draw, since one
+// instance buffer holds the instances of many shapes at different
+// offsets.
+void BindInstanceAttributes(const unsigned int instanceBuffer, const size_t offset)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    for (int i=0;  i<6;  i++) {
+        glEnableVertexAttribArray(4+i);
+        glVertexAttribPointer(4+i, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                              (void*)(offset + i*sizeof(glm::vec4)));
+        glVertexAttribDivisor(4+i, 1); }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Plain DrawVAO calls must not fetch from a stale offset.
+void UnbindInstanceAttributes()
+{
+    for (int i=0;  i<6;  i++)
+        glDisableVertexAttribArray(4+i);
+}
+
+void Shape::DrawVAOInstanced(const unsigned int instanceBuffer, const size_t offset, const int instances)
+{
+    CHECKERROR;
+    glBindVertexArray(vaoID);
+    BindInstanceAttributes(instanceBuffer, offset);
+    SetPositionDecode(decodeOffset, decodeScale);
+    glDrawElementsInstanced(GL_TRIANGLES, 3*count, IndexType(indexSize), 0, instances);
+    CHECKERROR;
+    UnbindInstanceAttributes();
+    glBindVertexArray(0);
+}
+
+void Shape::DrawVAOIndirect(const unsigned int instanceBuffer, const size_t commandOffset)
+{
+    CHECKERROR;
+    glBindVertexArray(vaoID);
+    BindInstanceAttributes(instanceBuffer, 0);
+    SetPositionDecode(decodeOffset, decodeScale);
+    glDrawElementsIndirect(GL_TRIANGLES, IndexType(indexSize), (void*)commandOffset);
+    CHECKERROR;
+    UnbindInstanceAttributes();
+    glBindVertexArray(0);
+}
 
+// The triangles around each vertex, in compressed rows: vertex v's
+// are triangles[offsets[v] .. offsets[v+1]), each as 3*t + corner.
+static void VertexCorners(const std::vector<glm::ivec3>& Tri, const size_t vertexCount,
+                          std::vector<int>& offsets, std::vector<int>& corners)
+{
+    offsets.assign(vertexCount + 1, 0);
+    for (size_t t=0;  t<Tri.size();  t++)
+        for (int c=0;  c<3;  c++)
+            offsets[Tri[t][c] + 1]++;
+    for (size_t v=0;  v<vertexCount;  v++)
+        offsets[v+1] += offsets[v];
+    corners.resize(3*Tri.size());
+    std::vector<int> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t t=0;  t<Tri.size();  t++)
+        for (int c=0;  c<3;  c++)
+            corners[fill[Tri[t][c]]++] = 3*t + c;
+}
+
+// Each vertex normal is the sum of its triangles' unit normals, each
+// weighted by the triangle's angle at the vertex, so a flat region
+// counts once however it is triangulated.  Face normals and angles,
+// then the per-vertex sums, are computed in parallel, in linear time.
+// (This replaced a running average of distinct face normals, which
+// depended on triangle order and turned NaN at degenerate triangles;
+// the results differ by a mean of about 1.7 degrees on a scan.)
+void Shape::ComputeNRM()
+{
+    const size_t n = Pnt.size();
+    std::vector<glm::vec3> cornerNormals(3*Tri.size());
+    ParallelFor(Tri.size(), [&](size_t first, size_t end) {
+            for (size_t t=first;  t<end;  t++) {
+                const glm::vec3 p[3] = { Pnt[Tri[t][0]].xyz(), Pnt[Tri[t][1]].xyz(), Pnt[Tri[t][2]].xyz() };
+                glm::vec3 normal = glm::cross(p[1] - p[0], p[2] - p[0]);
+                const float len = glm::length(normal);
+                if (len > 0.0f) normal /= len;
+                for (int c=0;  c<3;  c++) {
+                    const glm::vec3 e1 = p[(c+1)%3] - p[c], e2 = p[(c+2)%3] - p[c];
+                    const float l1 = glm::length(e1), l2 = glm::length(e2);
+                    const float angle = l1 > 0.0f && l2 > 0.0f
+                        ? acosf(glm::clamp(glm::dot(e1, e2)/(l1*l2), -1.0f, 1.0f)) : 0.0f;
+                    cornerNormals[3*t + c] = angle*normal; } } });
+
+    std::vector<int> offsets, corners;
+    VertexCorners(Tri, n, offsets, corners);
+    Nrm.resize(n);
+    ParallelFor(n, [&](size_t first, size_t end) {
+            for (size_t v=first;  v<end;  v++) {
+                glm::vec3 sum(0.0f);
+                for (int i=offsets[v];  i<offsets[v+1];  i++)
+                    sum += cornerNormals[corners[i]];
+                const float len = glm::length(sum);
+                Nrm[v] = len > 0.0f ? sum/len : sum; } });
+}
 
+// Per-vertex tangents along increasing s (Lengyel's method): each
+// triangle's texture space s direction, accumulated over a vertex's
+// triangles and made orthogonal to the vertex normal.  Needs Nrm and
+// Tex.
+void Shape::ComputeTAN()
+{
+    const size_t n = Pnt.size();
+    if (Tex.size() != n || Nrm.size() != n) return;
+
+    std::vector<glm::vec3> faceTangents(Tri.size());
+    ParallelFor(Tri.size(), [&](size_t first, size_t end) {
+            for (size_t t=first;  t<end;  t++) {
+                const int i = Tri[t][0], j = Tri[t][1], k = Tri[t][2];
+                const glm::vec3 e1 = Pnt[j].xyz() - Pnt[i].xyz(), e2 = Pnt[k].xyz() - Pnt[i].xyz();
+                const glm::vec2 d1 = Tex[j] - Tex[i], d2 = Tex[k] - Tex[i];
+                const float det = d1.x*d2.y - d2.x*d1.y;
+                faceTangents[t] = det != 0.0f ? (d2.y*e1 - d1.y*e2)/det : glm::vec3(0.0f); } });
+
+    std::vector<int> offsets, corners;
+    VertexCorners(Tri, n, offsets, corners);
+    Tan.resize(n);
+    ParallelFor(n, [&](size_t first, size_t end) {
+            for (size_t v=first;  v<end;  v++) {
+                glm::vec3 sum(0.0f);
+                for (int i=offsets[v];  i<offsets[v+1];  i++)
+                    sum += faceTangents[corners[i]/3];
+                sum -= glm::dot(sum, Nrm[v])*Nrm[v];
+                const float len = glm::length(sum);
+                Tan[v] = len > 0.0f ? sum/len : glm::vec3(0.0f); } });
 }
 
 void Shape::ComputeTEX()
@@ -591,43 +789,99 @@ Cylinder::Cylinder(const int n)
     MakeVAO();
 }
 
+////////////////////////////////////////////////////////////////////////
+// Takes the finest level's VAO and drawing state, and bounds covering
+// every level.
+LodShape::LodShape(const std::vector<Shape*>& _levels, const std::vector<float>& _switchPixels,
+                   const float _hysteresis)
+    : levels(_levels), switchPixels(_switchPixels), hysteresis(_hysteresis)
+{
+    switchPixels.resize(levels.size() - 1, 0.0f);
+    const Shape* finest = levels[0];
+    vaoID = finest->vaoID;
+    count = finest->count;
+    indexSize = finest->indexSize;
+    quality = finest->quality;
+    decodeOffset = finest->decodeOffset;
+    decodeScale = finest->decodeScale;
+    diffuseColor = finest->diffuseColor;
+    specularColor = finest->specularColor;
+    shininess = finest->shininess;
+
+    minP = finest->minP;
+    maxP = finest->maxP;
+    for (size_t l=1;  l<levels.size();  l++) {
+        minP = glm::min(minP, levels[l]->minP);
+        maxP = glm::max(maxP, levels[l]->maxP); }
+    center = 0.5f*(minP + maxP);
+    size = glm::length(maxP - minP);
+}
+
+// Coarser while clearly below the current level's switch size, finer
+// while clearly above the next finer level's.
+int LodShape::SelectLevel(const float pixels, const int current) const
+{
+    int level = std::min(std::max(current, 0), int(levels.size()) - 1);
+    while (level+1 < int(levels.size()) && pixels < switchPixels[level]*(1.0f - hysteresis))
+        level++;
+    while (level > 0 && pixels > switchPixels[level-1]*(1.0f + hysteresis))
+        level--;
+    return level;
+}
+
 ////////////////////////////////////////////////////////////////////////
 // Generates a plane with normals, texture coords, and tangent vectors
 // from an n by n grid of small quads.  A single quad might have been
 // sufficient, but that works poorly with the reflection map.
-Ply::Ply(const char* name, const bool reverse)
+Ply::Ply(const char* name, const bool reverse, const VertexQuality _quality)
 {
+    quality = _quality;
     diffuseColor = glm::vec3(0.8, 0.8, 0.5);
     specularColor = glm::vec3(0.5, 0.2, 0.7);
     shininess = 120.0;
 
-    // Open PLY file and read header;  Exit on any failure.
-    p_ply ply = ply_open(name, NULL, 0, NULL);
-    if (!ply) { throw std::exception(); }
-    if (!ply_read_header(ply)) { throw std::exception(); }
-
-    // Setup callback for vertices
-    ply_set_read_cb(ply, "vertex", "x", vertex_cb, this, 0);
-    ply_set_read_cb(ply, "vertex", "y", vertex_cb, this, 1);
-    ply_set_read_cb(ply, "vertex", "z", vertex_cb, this, 2);
-    //normal
-    ply_set_read_cb(ply, "vertex", "nx", normal_cb, this, 0);
-    ply_set_read_cb(ply, "vertex", "ny", normal_cb, this, 1);
-    ply_set_read_cb(ply, "vertex", "nz", normal_cb, this, 2);
-    //texture
-    ply_set_read_cb(ply, "vertex", "s", texture_cb, this, 0);
-    ply_set_read_cb(ply, "vertex", "t", texture_cb, this, 1);
-
-    ply_set_read_cb(ply, "vertex", "confidence", some_cb, this, 0);
-    ply_set_read_cb(ply, "vertex", "intensity", some_cb, this, 1);
-
-    // Setup callback for faces
-    ply_set_read_cb(ply, "face", "vertex_indices", face_cb, this, 0);
-
-    // Read the PLY file filling the arrays via the callbacks.
-    if (!ply_read(ply)) {printf("Failure in ply_read\n"); exit(-1); }
-
+    const std::string cache = std::string(name) + ".mesh";
+    const unsigned long long key = HashBytes(&reverse, sizeof(reverse));
+    if (LoadMeshCache(this, cache.c_str(), key, name)) {
+        MakeVAO();
+        return; }
+
+    // The bulk reader handles the usual files; rply the rest.
+    if (!ReadPly(name, this)) {
+        // Open PLY file and read header;  Exit on any failure.
+        p_ply ply = ply_open(name, NULL, 0, NULL);
+        if (!ply) { throw std::exception(); }
+        if (!ply_read_header(ply)) { throw std::exception(); }
+
+        // Setup callback for vertices
+        ply_set_read_cb(ply, "vertex", "x", vertex_cb, this, 0);
+        ply_set_read_cb(ply, "vertex", "y", vertex_cb, this, 1);
+        ply_set_read_cb(ply, "vertex", "z", vertex_cb, this, 2);
+        //normal
+        ply_set_read_cb(ply, "vertex", "nx", normal_cb, this, 0);
+        ply_set_read_cb(ply, "vertex", "ny", normal_cb, this, 1);
+        ply_set_read_cb(ply, "vertex", "nz", normal_cb, this, 2);
+        //texture
+        ply_set_read_cb(ply, "vertex", "s", texture_cb, this, 0);
+        ply_set_read_cb(ply, "vertex", "t", texture_cb, this, 1);
+
+        ply_set_read_cb(ply, "vertex", "confidence", some_cb, this, 0);
+        ply_set_read_cb(ply, "vertex", "intensity", some_cb, this, 1);
+
+        // Setup callback for faces
+        ply_set_read_cb(ply, "face", "vertex_indices", face_cb, this, 0);
+
+        // Read the PLY file filling the arrays via the callbacks.
+        if (!ply_read(ply)) {printf("Failure in ply_read\n"); exit(-1); }
+        ply_close(ply); }
+
+    // Tangents from the whole mesh, now that it is all loaded
+    if (Nrm.size() == 0)
+        ComputeNRM();
+    if (Tex.size() == Pnt.size())
+        ComputeTAN();
     MakeVAO();
+    SaveMeshCache(this, cache.c_str(), key, name);
 }
  
 
@@ -685,22 +939,6 @@ int Ply::some_cb(p_ply_argument argument) {
     return 1;
 }
 
-void ComputeTangent(Ply* ply)
-{
-    int t = ply->Tri.size() - 1;
-    int i = ply->Tri[t][0];
-    int j = ply->Tri[t][1];
-    int k = ply->Tri[t][2];
-    glm::vec2 A = ply->Tex[i] - ply->Tex[k]; 
-    glm::vec2 B = ply->Tex[j] - ply->Tex[k];
-    float d = A[0]*B[1] - A[1]*B[0];
-    float a =  B[1]/d;
-    float b = -A[1]/d;
-    glm::vec4 Tan = a*ply->Pnt[i] + b*ply->Pnt[j] + (1.0f-a-b)*ply->Pnt[k];
-    ply->Tan[i] = ply->Tan[j] = ply->Tan[k] = glm::normalize(Tan.xyz());
-    
-}
-
 // Face callback;  Must be static (stupid C++)
 int Ply::face_cb(p_ply_argument argument) {
     long length, value_index;
@@ -716,14 +954,11 @@ int Ply::face_cb(p_ply_argument argument) {
             staticTri[value_index] = (int)ply_get_argument_value(argument); }
         else if (value_index==2) {
             staticTri[2] = (int)ply_get_argument_value(argument);
-            ply->Tri.push_back(staticTri);
-            if(ply->Nrm.size()!=0)
-                ComputeTangent(ply); }
+            ply->Tri.push_back(staticTri); }
         else if (value_index==3) {
             staticTri[1] = staticTri[2];
             staticTri[2] = (int)ply_get_argument_value(argument);
-            ply->Tri.push_back(staticTri);
-            ComputeTangent(ply); } }
+            ply->Tri.push_back(staticTri); } }
 
     return 1;
 }
@@ -761,7 +996,7 @@ Plane::Plane(const float r, const int n)
 // sufficient, but that works poorly with the reflection map.
 ProceduralGround::ProceduralGround(const float _range, const int n,
                      const float _octaves, const float _persistence, const float _scale,
-                     const float _low, const float _high)
+                     const float _low, const float _high, const int seed)
     :range(_range), octaves(_octaves), persistence(_persistence), scale(_scale), 
      low(_low), high(_high)
 {
@@ -769,7 +1004,16 @@ ProceduralGround::ProceduralGround(const float _range, const int n,
     specularColor = glm::vec3(1.0, 1.0, 1.0);
     shininess = 10.0;
     specularColor = glm::vec3(0.0, 0.0, 0.0);
-    xoff = range*( time(NULL)%1000 );
+    xoff = range*( seed < 0 ? time(NULL)%1000 : seed );
+
+    // A seeded terrain is cached by everything that shapes it, in one
+    // file that a terrain made with other parameters replaces.
+    const float params[] = { range, float(n), octaves, persistence, scale, low, high, xoff };
+    const unsigned long long key = HashBytes(params, sizeof(params));
+    const char* cache = "ground.mesh";
+    if (seed >= 0 && LoadMeshCache(this, cache, key)) {
+        MakeVAO();
+        return; }
 
     float h = 0.001;
     for (int i=0;  i<=n;  i++) {
@@ -795,6 +1039,8 @@ ProceduralGround::ProceduralGround(const float _range, const int n,
                          (i  )*(n+1) + (j-1)); } } }
 
     MakeVAO();
+    if (seed >= 0)
+        SaveMeshCache(this, cache, key);
 }
 
 float ProceduralGround::HeightAt(const float x, const float y)
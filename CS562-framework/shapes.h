@@ -4,14 +4,27 @@
 // This is the most efficient way to get geometry into the OpenGL
 // graphics pipeline.
 //
-// Each vertex is specified as four attributes which are made
-// available in a vertex shader in the following attribute slots.
+// Each vertex is specified as four attributes, interleaved in one
+// buffer, which are made available in a vertex shader in the
+// following attribute slots.
 //
-// position,        glm::vec4,   attribute #0
+// position,        glm::vec3,   attribute #0 (w reads as 1)
 // normal,          glm::vec3,   attribute #1
 // texture coord,   glm::vec3,   attribute #2
 // tangent,         glm::vec3,   attribute #3
 //
+// Instanced draws (see DrawVAOInstanced) add per-instance attributes:
+//
+// model transform, glm::mat4,   attributes #4-#7
+// diffuse+shine,   glm::vec4,   attribute #8
+// specular+id,     glm::vec4,   attribute #9
+//
+// Every draw also sets two constant attributes that decode compressed
+// positions (see Shape::quality) as offset + position*scale:
+//
+// position offset, glm::vec3,   attribute #10
+// position scale,  glm::vec3,   attribute #11
+//
 // An instance of any of these shapes is create with a single call:
 //    unsigned int obj = CreateSphere(divisions, &quadCount);
 // and drawn by:
@@ -25,9 +38,40 @@
 
 #include "transform.h"
 #include "rply.h"
+#include "meshoptimize.h"
 
 #include <vector>
 
+// The per-instance attributes of an instanced draw.
+struct InstanceData
+{
+    glm::mat4 ModelTr;
+    glm::vec4 diffuse;          // w: shininess
+    glm::vec4 specular;         // w: objectId
+};
+
+// One indirect draw, as glDrawElementsIndirect reads it.
+struct DrawElementsCommand
+{
+    unsigned int count, instanceCount, firstIndex;
+    int baseVertex;
+    unsigned int baseInstance;
+};
+
+// Point attributes #4-#9 of the bound VAO at the InstanceData in
+// instanceBuffer from byte offset on, and turn them off again.
+void BindInstanceAttributes(const unsigned int instanceBuffer, const size_t offset);
+void UnbindInstanceAttributes();
+
+// Set attributes #10 and #11 for the draws that follow.
+void SetPositionDecode(const glm::vec3& offset, const glm::vec3& scale);
+
+// How a Shape's vertices are stored on the GPU
+enum VertexQuality {
+    vertexFull,                 // 44 bytes: floats
+    vertexCompressed            // 20 bytes: quantized (see VaoFromTris)
+};
+
 class Shape
 {
 public:
@@ -49,8 +93,22 @@ public:
     // Geometry defined by indices into data arrays
     std::vector<glm::ivec3> Tri;
     unsigned int count;
+    unsigned int indexSize;     // Bytes per index in the VAO: 2 or 4
+
+    // Set before MakeVAO.  Compressed positions decode as
+    // decodeOffset + position*decodeScale.
+    VertexQuality quality;
+    glm::vec3 decodeOffset, decodeScale;
 
-    // Defined by SetTransform by scanning data arrays
+    // The data arrays and bounds are final, from Cook or from a mesh
+    // cache (see meshcache.h), so MakeVAO derives nothing.
+    bool cooked;
+
+    // Vertex cache efficiency before and after OptimizeMesh (kept in
+    // the mesh cache too); zero for shapes it has not run on.
+    VertexCacheStats cacheBefore, cacheAfter;
+
+    // Defined by ComputeBounds (called by MakeVAO) by scanning data arrays
     glm::vec3 minP, maxP;
     glm::vec3 center;
     float size;
@@ -59,13 +117,36 @@ public:
     glm::vec3 projection;
     glm::vec2 textureCoord;
     // Constructor and destructor
-    Shape() :animate(false) {}
+    Shape() :indexSize(4), quality(vertexFull), decodeScale(1.0f), cooked(false), cacheBefore(), cacheAfter(),
+              animate(false) {}
     virtual ~Shape() {}
 
+    // Derives missing normals and texture coordinates, optimizes the
+    // triangle and vertex order, and computes the bounds; no OpenGL.
+    void Cook();
     virtual void MakeVAO();
     virtual void DrawVAO();
+    // Just the draw call; the caller has bound vaoID.
+    void DrawElements();
+    // Draws instances copies, reading per-instance attributes #4-#9
+    // from instanceBuffer starting at byte offset (see InstanceData).
+    virtual void DrawVAOInstanced(const unsigned int instanceBuffer, const size_t offset, const int instances);
+    // The same, with the instance count and first instance taken from
+    // the command at commandOffset in the bound GL_DRAW_INDIRECT_BUFFER
+    // (GL 4.2 for the first instance).
+    virtual void DrawVAOIndirect(const unsigned int instanceBuffer, const size_t commandOffset);
+
+    // Levels of detail, finest first (see LodShape); a plain Shape is
+    // its own only level.  SelectLevel picks the level for a copy
+    // covering pixels pixels on screen that now draws level current.
+    virtual int LevelCount() const { return 1; }
+    virtual Shape* Level(const int /*level*/) { return this; }
+    virtual int SelectLevel(const float /*pixels*/, const int /*current*/) const { return 0; }
+
     void ComputeNRM();
+    void ComputeTAN();
     void ComputeTEX();
+    void ComputeBounds();
 };
 
 class Box: public Shape
@@ -118,9 +199,11 @@ public:
     float high;
     float xoff;
 
+    // A seed of -1 takes one from the clock, for a new terrain each
+    // run, which is then not cached.
     ProceduralGround(const float _range, const int n,
                      const float _octaves, const float _persistence, const float _scale,
-                     const float _low, const float _high);
+                     const float _low, const float _high, const int seed=-1);
     float HeightAt(const float x, const float y);
 };
 
@@ -130,10 +213,32 @@ public:
     Quad(const int n=1);
 };
 
+// Several versions of one mesh, finest first, each drawn while the
+// copy's projected size (the diameter of its bounds, in pixels) is
+// between its neighbors' switch sizes: level k gives way to level k+1
+// below switchPixels[k].  A switch happens only once the size is past
+// the threshold by a fraction hysteresis, so a copy sitting at the
+// threshold doesn't flip back and forth.  The levels must share one
+// object space; the LodShape itself draws as the finest.
+class LodShape: public Shape
+{
+public:
+    std::vector<Shape*> levels;
+    std::vector<float> switchPixels; // One fewer than levels, decreasing
+    float hysteresis;
+
+    LodShape(const std::vector<Shape*>& _levels, const std::vector<float>& _switchPixels,
+             const float _hysteresis=0.15f);
+
+    virtual int LevelCount() const { return levels.size(); }
+    virtual Shape* Level(const int level) { return levels[level]; }
+    virtual int SelectLevel(const float pixels, const int current) const;
+};
+
 class Ply: public Shape
 {
 public:
-    Ply(const char* name, const bool reverse=false);
+    Ply(const char* name, const bool reverse=false, const VertexQuality _quality=vertexFull);
     virtual ~Ply() {printf("destruct Ply\n");};
     static int vertex_cb(p_ply_argument argument);
     static int normal_cb(p_ply_argument argument);
@@ -0,0 +1,345 @@
+///////////////////////////////////////////////////////////////////////
+// Quadric error mesh simplification.  See simplify.h.
+////////////////////////////////////////////////////////////////////////
+
+#include "math.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <algorithm>
+#include <queue>
+
+#include <glbinding/gl/gl.h>
+#include <glbinding/Binding.h>
+using namespace gl;
+
+#define GLM_FORCE_CTOR_INIT
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+
+#include "shapes.h"
+#include "meshcache.h"
+#include "parallel.h"
+#include "simplify.h"
+
+// A symmetric 4x4 matrix, the upper triangle row by row.  v'Qv, for
+// v = (p,1), is the weighted sum of squared distances from p to the
+// planes added in.
+struct Quadric
+{
+    double a[10];
+
+    Quadric() { std::fill(a, a+10, 0.0); }
+    void AddPlane(const glm::dvec3& n, const double d, const double w)
+    {
+        a[0] += w*n.x*n.x;  a[1] += w*n.x*n.y;  a[2] += w*n.x*n.z;  a[3] += w*n.x*d;
+        a[4] += w*n.y*n.y;  a[5] += w*n.y*n.z;  a[6] += w*n.y*d;
+        a[7] += w*n.z*n.z;  a[8] += w*n.z*d;
+        a[9] += w*d*d;
+    }
+    void Add(const Quadric& q) { for (int i=0;  i<10;  i++) a[i] += q.a[i]; }
+    double Error(const glm::dvec3& p) const
+    {
+        return a[0]*p.x*p.x + 2.0*a[1]*p.x*p.y + 2.0*a[2]*p.x*p.z + 2.0*a[3]*p.x
+            + a[4]*p.y*p.y + 2.0*a[5]*p.y*p.z + 2.0*a[6]*p.y
+            + a[7]*p.z*p.z + 2.0*a[8]*p.z + a[9];
+    }
+};
+
+struct Collapse
+{
+    double cost;
+    int from, to;               // from moves onto to
+    int fromVersion, toVersion; // Stale once either vertex changes
+    bool operator>(const Collapse& c) const { return cost > c.cost; }
+};
+
+class Simplifier
+{
+public:
+    Simplifier(const Shape& _source, const float attributeWeight);
+    float Run(const int targetTriangles, const float targetError);
+    void Output(Shape& result);
+
+private:
+    const Shape& source;
+    std::vector<glm::dvec3> P;
+    std::vector<glm::ivec3> tris;
+    std::vector<char> alive;    // Per triangle
+    std::vector<std::vector<int> > vertexTris; // May list dead triangles
+    std::vector<Quadric> quadrics;
+    std::vector<char> locked, removed;
+    std::vector<int> version;
+    std::vector<int> mark;      // Scratch for neighbor sets
+    int markStamp;
+    double attributeScale, size;
+    int live;
+    std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse> > heap;
+
+    double AttributeCost(const int a, const int b) const;
+    void Push(const int a, const int b);
+    bool Valid(const int from, const int to);
+    void Apply(const int from, const int to);
+};
+
+Simplifier::Simplifier(const Shape& _source, const float attributeWeight)
+    : source(_source), tris(_source.Tri), markStamp(0), size(0.0), live(_source.Tri.size())
+{
+    const int n = source.Pnt.size();
+    P.resize(n);
+    glm::dvec3 lo(1e300), hi(-1e300);
+    for (int v=0;  v<n;  v++) {
+        P[v] = glm::dvec3(source.Pnt[v].xyz());
+        lo = glm::min(lo, P[v]);
+        hi = glm::max(hi, P[v]); }
+    if (n > 0) size = glm::length(hi - lo);
+    attributeScale = double(attributeWeight)*size*double(attributeWeight)*size;
+
+    alive.assign(tris.size(), 1);
+    vertexTris.resize(n);
+    quadrics.resize(n);
+    locked.assign(n, 0);
+    removed.assign(n, 0);
+    version.assign(n, 0);
+    mark.assign(n, 0);
+
+    // Planes weighted by area over the mean area, keeping costs in
+    // squared distance whatever the mesh's scale.
+    std::vector<glm::dvec3> normals(tris.size());
+    std::vector<double> areas(tris.size());
+    double total = 0.0;
+    for (size_t t=0;  t<tris.size();  t++) {
+        const glm::dvec3 c = glm::cross(P[tris[t][1]] - P[tris[t][0]], P[tris[t][2]] - P[tris[t][0]]);
+        areas[t] = 0.5*glm::length(c);
+        normals[t] = areas[t] > 0.0 ? c/(2.0*areas[t]) : glm::dvec3(0.0);
+        total += areas[t]; }
+    const double mean = tris.empty() || total <= 0.0 ? 1.0 : total/tris.size();
+    for (size_t t=0;  t<tris.size();  t++)
+        for (int c=0;  c<3;  c++) {
+            const int v = tris[t][c];
+            vertexTris[v].push_back(t);
+            if (areas[t] > 0.0)
+                quadrics[v].AddPlane(normals[t], -glm::dot(normals[t], P[v]), areas[t]/mean); }
+
+    // Sorted edges, (lower, higher) packed in 64 bits: an edge listed
+    // once is a border, more than twice non-manifold.
+    std::vector<unsigned long long> edges;
+    edges.reserve(3*tris.size());
+    for (size_t t=0;  t<tris.size();  t++)
+        for (int c=0;  c<3;  c++) {
+            const unsigned int a = tris[t][c], b = tris[t][(c+1)%3];
+            edges.push_back((unsigned long long)std::min(a, b) << 32 | std::max(a, b)); }
+    std::sort(edges.begin(), edges.end());
+    for (size_t e=0;  e<edges.size();  ) {
+        size_t end = e + 1;
+        while (end < edges.size() && edges[end] == edges[e]) end++;
+        const int a = edges[e] >> 32, b = edges[e] & 0xffffffff;
+        if (end - e != 2)
+            locked[a] = locked[b] = 1;
+        e = end; }
+    for (size_t e=0;  e<edges.size();  e++)
+        if (e == 0 || edges[e] != edges[e-1])
+            Push(edges[e] >> 32, edges[e] & 0xffffffff);
+}
+
+double Simplifier::AttributeCost(const int a, const int b) const
+{
+    double d = 0.0;
+    if (source.Nrm.size() == P.size()) {
+        const glm::vec3 dn = source.Nrm[a] - source.Nrm[b];
+        d += glm::dot(dn, dn); }
+    if (source.Tex.size() == P.size()) {
+        const glm::vec2 dt = source.Tex[a] - source.Tex[b];
+        d += glm::dot(dt, dt); }
+    return attributeScale*d;
+}
+
+// Queues the cheaper direction of collapsing edge a-b, if either
+// vertex may move.
+void Simplifier::Push(const int a, const int b)
+{
+    if (locked[a] && locked[b]) return;
+    Quadric q = quadrics[a];
+    q.Add(quadrics[b]);
+    const double attributes = AttributeCost(a, b);
+    const double ab = locked[a] ? 1e300 : std::max(q.Error(P[b]), 0.0) + attributes;
+    const double ba = locked[b] ? 1e300 : std::max(q.Error(P[a]), 0.0) + attributes;
+    Collapse c;
+    c.cost = std::min(ab, ba);
+    c.from = ab <= ba ? a : b;
+    c.to = ab <= ba ? b : a;
+    c.fromVersion = version[c.from];
+    c.toVersion = version[c.to];
+    heap.push(c);
+}
+
+// The link condition (the vertices' only common neighbors are those
+// of the triangles they share) keeps the surface manifold; the normal
+// test keeps the moved triangles from folding over.
+bool Simplifier::Valid(const int from, const int to)
+{
+    markStamp++;
+    int shared = 0;
+    for (size_t k=0;  k<vertexTris[from].size();  k++) {
+        const int t = vertexTris[from][k];
+        if (!alive[t]) continue;
+        const glm::ivec3& tri = tris[t];
+        if (tri.x == to || tri.y == to || tri.z == to) {
+            shared++;
+            continue; }
+        for (int c=0;  c<3;  c++)
+            mark[tri[c]] = markStamp;
+
+        int i = 0;
+        while (tri[i] != from) i++;
+        const glm::dvec3& p1 = P[tri[(i+1)%3]];
+        const glm::dvec3& p2 = P[tri[(i+2)%3]];
+        const glm::dvec3 before = glm::cross(p1 - P[from], p2 - P[from]);
+        const glm::dvec3 after = glm::cross(p1 - P[to], p2 - P[to]);
+        if (glm::dot(before, after) <= 1e-3*glm::length(before)*glm::length(after))
+            return false; }
+    if (shared == 0) return false;
+
+    int common = 0;
+    markStamp++;
+    const int fromStamp = markStamp - 1;
+    for (size_t k=0;  k<vertexTris[to].size();  k++) {
+        const int t = vertexTris[to][k];
+        if (!alive[t]) continue;
+        const glm::ivec3& tri = tris[t];
+        if (tri.x == from || tri.y == from || tri.z == from) continue;
+        for (int c=0;  c<3;  c++) {
+            const int v = tri[c];
+            if (v == to || mark[v] != fromStamp) continue;
+            mark[v] = markStamp;
+            common++; } }
+    return common <= shared;
+}
+
+void Simplifier::Apply(const int from, const int to)
+{
+    for (size_t k=0;  k<vertexTris[from].size();  k++) {
+        const int t = vertexTris[from][k];
+        if (!alive[t]) continue;
+        glm::ivec3& tri = tris[t];
+        if (tri.x == to || tri.y == to || tri.z == to) {
+            alive[t] = 0;
+            live--;
+            continue; }
+        for (int c=0;  c<3;  c++)
+            if (tri[c] == from) tri[c] = to;
+        vertexTris[to].push_back(t); }
+    std::vector<int>().swap(vertexTris[from]);
+    quadrics[to].Add(quadrics[from]);
+    removed[from] = 1;
+    version[to]++;
+
+    // Drop the dead triangles, and requeue every edge of to.
+    std::vector<int>& fan = vertexTris[to];
+    fan.erase(std::remove_if(fan.begin(), fan.end(), [this](int t) { return !alive[t]; }), fan.end());
+    markStamp++;
+    for (size_t k=0;  k<fan.size();  k++)
+        for (int c=0;  c<3;  c++) {
+            const int v = tris[fan[k]][c];
+            if (v == to || mark[v] == markStamp) continue;
+            mark[v] = markStamp;
+            Push(to, v); }
+}
+
+float Simplifier::Run(const int targetTriangles, const float targetError)
+{
+    const double limit = double(targetError)*size*double(targetError)*size;
+    double reached = 0.0;
+    while (!heap.empty() && live > targetTriangles) {
+        const Collapse c = heap.top();
+        heap.pop();
+        if (removed[c.from] || removed[c.to] || version[c.from] != c.fromVersion || version[c.to] != c.toVersion)
+            continue;
+        if (c.cost > limit) break;
+        if (!Valid(c.from, c.to)) continue;
+        Apply(c.from, c.to);
+        reached = std::max(reached, c.cost); }
+    return size > 0.0 ? float(sqrt(reached)/size) : 0.0f;
+}
+
+// The surviving triangles, over the vertices they use in order of
+// first use.
+void Simplifier::Output(Shape& result)
+{
+    const size_t n = P.size();
+    std::vector<int> newIndex(n, -1);
+    std::vector<int> kept;
+    result.Tri.clear();
+    for (size_t t=0;  t<tris.size();  t++) {
+        if (!alive[t]) continue;
+        glm::ivec3 tri;
+        for (int c=0;  c<3;  c++) {
+            int& i = newIndex[tris[t][c]];
+            if (i < 0) {
+                i = kept.size();
+                kept.push_back(tris[t][c]); }
+            tri[c] = i; }
+        result.Tri.push_back(tri); }
+
+    result.Pnt.clear();  result.Nrm.clear();  result.Tex.clear();  result.Tan.clear();  result.Some.clear();
+    for (size_t k=0;  k<kept.size();  k++) {
+        const int v = kept[k];
+        result.Pnt.push_back(source.Pnt[v]);
+        if (source.Nrm.size() == n) result.Nrm.push_back(source.Nrm[v]);
+        if (source.Tex.size() == n) result.Tex.push_back(source.Tex[v]);
+        if (source.Tan.size() == n) result.Tan.push_back(source.Tan[v]);
+        if (source.Some.size() == n) result.Some.push_back(source.Some[v]); }
+}
+
+float SimplifyMesh(const Shape& source, Shape& result, const int targetTriangles,
+                   const float targetError, const float attributeWeight)
+{
+    Simplifier simplifier(source, attributeWeight);
+    const float error = simplifier.Run(targetTriangles, targetError);
+    simplifier.Output(result);
+    return error;
+}
+
+// Levels of a chain, each from the one before, from the cache where
+// it has them.  A level that is not much smaller than the one before
+// ends the chain.
+static void BuildLodChain(LodChain& chain)
+{
+    chain.levels.assign(1, chain.source);
+    for (int k=1;  k<chain.levelCount;  k++) {
+        const Shape* previous = chain.levels.back();
+        Shape* level = new Shape();
+        level->quality = chain.source->quality;
+        level->diffuseColor = chain.source->diffuseColor;
+        level->specularColor = chain.source->specularColor;
+        level->shininess = chain.source->shininess;
+
+        const double params[] = { double(chain.source->Pnt.size()), double(chain.source->Tri.size()),
+                                  double(k), chain.ratio, chain.maxError };
+        const unsigned long long key = HashBytes(params, sizeof(params));
+        char suffix[32];
+        sprintf(suffix, ".lod%d.mesh", k);
+        const std::string cache = chain.name ? std::string(chain.name) + suffix : std::string();
+        if (!chain.name || !LoadMeshCache(level, cache.c_str(), key, chain.name)) {
+            SimplifyMesh(*previous, *level, int(previous->Tri.size()*chain.ratio), chain.maxError);
+            level->Cook();
+            if (chain.name)
+                SaveMeshCache(level, cache.c_str(), key, chain.name); }
+
+        if (level->Tri.empty() || level->Tri.size() > 0.9*previous->Tri.size()) {
+            delete level;
+            break; }
+        chain.levels.push_back(level); }
+}
+
+void BuildLodChains(std::vector<LodChain>& chains)
+{
+    ParallelFor(chains.size(), [&](size_t first, size_t end) {
+        for (size_t c=first;  c<end;  c++)
+            BuildLodChain(chains[c]); }, 1);
+
+    for (size_t c=0;  c<chains.size();  c++)
+        for (size_t k=1;  k<chains[c].levels.size();  k++)
+            chains[c].levels[k]->MakeVAO();
+}
@@ -0,0 +1,58 @@
+///////////////////////////////////////////////////////////////////////
+// Mesh simplification by quadric error metrics (Garland and Heckbert),
+// for making levels of detail (see LodShape) at load time.
+//
+// SimplifyMesh collapses edges of a Shape's Tri, cheapest first, each
+// into one of its two vertices (a half-edge collapse).  The result's
+// vertices are thus a subset of the source's, and keep their Nrm,
+// Tex, Tan and Some exactly.  The cost of a collapse is the sum of
+// squared distances from the kept vertex to the planes of the
+// triangles both vertices have absorbed (their quadrics, each plane
+// weighted by its triangle's area), plus attributeWeight times the
+// difference in normal and texture coordinates, so creases and seams
+// go last.  Vertices on border or non-manifold edges never move, and a
+// collapse that would flip a triangle or pinch the surface is skipped.
+// Simplification stops at targetTriangles, or before a collapse
+// costing more than targetError.  Both the error and attributeWeight
+// are relative to the diagonal of the mesh's bounds.
+//
+// BuildLodChains makes the coarser levels of several meshes, one mesh
+// per thread, each level from the one before.  Levels of a mesh with
+// a file name are cached beside it as <name>.lod<k>.mesh (see
+// meshcache.h), and remade when the file changes.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _SIMPLIFY
+#define _SIMPLIFY
+
+#include <vector>
+
+class Shape;
+
+// Fills result's arrays (not its VAO) with a simplified source, and
+// returns the largest collapse cost reached, as a distance relative to
+// source's size.
+float SimplifyMesh(const Shape& source, Shape& result, const int targetTriangles,
+                   const float targetError=1.0f, const float attributeWeight=0.01f);
+
+struct LodChain
+{
+    Shape* source;              // The finest level, made (MakeVAO) already
+    const char* name;           // Its file, for caching; NULL for no cache
+    int levelCount;             // Source included
+    float ratio;                // Triangles of a level over those of the one before
+    float maxError;             // Passed to SimplifyMesh as targetError
+    std::vector<Shape*> levels; // Output: source, then each coarser level
+
+    LodChain(Shape* _source, const char* _name=NULL, const int _levelCount=4,
+             const float _ratio=0.25f, const float _maxError=0.05f)
+        : source(_source), name(_name), levelCount(_levelCount), ratio(_ratio), maxError(_maxError) {}
+};
+
+// Fills in each chain's levels.  A chain stops early where the error
+// bound keeps a level from getting much smaller.  Simplification runs
+// on worker threads; the VAOs are then made on the calling thread,
+// which must hold the GL context.
+void BuildLodChains(std::vector<LodChain>& chains);
+
+#endif
@@ -0,0 +1,564 @@
+///////////////////////////////////////////////////////////////////////
+// Out-of-core rendering of large scans.  See streamedmesh.h.
+////////////////////////////////////////////////////////////////////////
+
+#include "math.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <algorithm>
+#include <unordered_map>
+
+#include <glbinding/gl/gl.h>
+#include <glbinding/Binding.h>
+using namespace gl;
+
+#define GLM_FORCE_CTOR_INIT
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+
+#include "shader.h"
+#include "shapes.h"
+#include "plyreader.h"
+#include "streamedmesh.h"
+
+#include <glu.h>                // For gluErrorString
+#define CHECKERROR {GLenum err = glGetError(); if (err != GL_NO_ERROR) { fprintf(stderr, "OpenGL error (at line streamedmesh.cpp:%d): %s\n", __LINE__, gluErrorString(err)); exit(-1);} }
+
+#ifdef _WIN32
+#define fseek64 _fseeki64
+#else
+#define fseek64 fseeko
+#endif
+
+const char clusterMagic[8] = { 'C', 'S', 'C', 'L', 'U', 'S', '0', '1' };
+
+struct ClusterFileHeader
+{
+    char magic[8];
+    unsigned int nodeCount, maxVertices, maxIndices, pad;
+    unsigned long long nodeTable; // Offset of the node table
+};
+
+// Bytes per vertex in a page: position and normal
+const int pageVertexSize = 6*sizeof(float);
+
+static size_t PageSize(const ClusterNode& node)
+{
+    return size_t(node.vertexCount)*pageVertexSize + size_t(node.indexCount)*sizeof(unsigned short);
+}
+
+////////////////////////////////////////////////////////////////////////
+// The offline step
+
+class ClusterBuilder
+{
+public:
+    ClusterBuilder(const Shape& _mesh, FILE* _file, const int _clusterTriangles, std::atomic<float>* _progress)
+        : mesh(_mesh), file(_file), clusterTriangles(_clusterTriangles), offset(sizeof(ClusterFileHeader)),
+          maxVertices(0), maxIndices(0), progress(_progress), processed(0), work(0)
+    {
+        // Each level of the hierarchy visits every triangle once.
+        work = mesh.Tri.size();
+        for (size_t n=mesh.Tri.size();  n>size_t(clusterTriangles);  n=(n+1)/2)
+            work += mesh.Tri.size();
+        centroids.resize(mesh.Tri.size());
+        order.resize(mesh.Tri.size());
+        for (size_t t=0;  t<mesh.Tri.size();  t++) {
+            centroids[t] = (mesh.Pnt[mesh.Tri[t][0]].xyz() + mesh.Pnt[mesh.Tri[t][1]].xyz()
+                            + mesh.Pnt[mesh.Tri[t][2]].xyz())/3.0f;
+            order[t] = t; }
+    }
+
+    int Build(const size_t first, const size_t end);
+
+    const Shape& mesh;
+    FILE* file;
+    int clusterTriangles;
+    unsigned long long offset;
+    unsigned int maxVertices, maxIndices;
+    std::vector<ClusterNode> nodes;
+
+private:
+    std::vector<glm::vec3> centroids;
+    std::vector<int> order;     // Triangles, grouped by node as Build splits them
+    std::atomic<float>* progress;
+    size_t processed, work;     // Triangles visited so far, and in all
+
+    void WritePage(ClusterNode& node, const std::vector<float>& vertices,
+                   const std::vector<unsigned short>& indices);
+    bool Grid(const size_t first, const size_t end, const glm::vec3& minP, const float cell, const int resolution,
+              std::vector<float>& vertices, std::vector<unsigned short>& indices);
+    float Simplify(const size_t first, const size_t end, const glm::vec3& minP, const glm::vec3& maxP,
+                   std::vector<float>& vertices, std::vector<unsigned short>& indices);
+};
+
+void ClusterBuilder::WritePage(ClusterNode& node, const std::vector<float>& vertices,
+                               const std::vector<unsigned short>& indices)
+{
+    node.vertexCount = vertices.size()/6;
+    node.indexCount = indices.size();
+    node.offset = offset;
+    if (!vertices.empty()) fwrite(&vertices[0], sizeof(float), vertices.size(), file);
+    if (!indices.empty()) fwrite(&indices[0], sizeof(unsigned short), indices.size(), file);
+    offset += PageSize(node);
+    maxVertices = std::max(maxVertices, node.vertexCount);
+    maxIndices = std::max(maxIndices, node.indexCount);
+}
+
+// Merges the vertices of triangles order[first, end) that share a cell
+// of a resolution^3 grid over minP into their average, dropping the
+// triangles that collapse.  Returns whether the result fits a cluster.
+bool ClusterBuilder::Grid(const size_t first, const size_t end, const glm::vec3& minP, const float cell,
+                          const int resolution, std::vector<float>& vertices, std::vector<unsigned short>& indices)
+{
+    std::unordered_map<unsigned long long, int> cellVertex;
+    std::vector<glm::vec3> positions, normals;
+    std::vector<int> counts;
+    indices.clear();
+    for (size_t i=first;  i<end;  i++) {
+        const glm::ivec3& tri = mesh.Tri[order[i]];
+        int v[3];
+        for (int c=0;  c<3;  c++) {
+            const glm::vec3 p = mesh.Pnt[tri[c]].xyz();
+            const glm::ivec3 g = glm::min(glm::ivec3((p - minP)/cell), glm::ivec3(resolution - 1));
+            const unsigned long long key = ((unsigned long long)g.x << 42) | ((unsigned long long)g.y << 21) | g.z;
+            std::unordered_map<unsigned long long, int>::iterator it = cellVertex.find(key);
+            if (it == cellVertex.end()) {
+                it = cellVertex.insert(std::make_pair(key, int(positions.size()))).first;
+                positions.push_back(glm::vec3(0.0f));
+                normals.push_back(glm::vec3(0.0f));
+                counts.push_back(0); }
+            v[c] = it->second;
+            // Each original vertex is averaged in once per triangle using it;
+            // close enough for a stand-in.
+            positions[v[c]] += p;
+            if (!mesh.Nrm.empty()) normals[v[c]] += mesh.Nrm[tri[c]];
+            counts[v[c]]++; }
+        if (v[0] != v[1] && v[1] != v[2] && v[0] != v[2])
+            for (int c=0;  c<3;  c++) indices.push_back(v[c]); }
+
+    vertices.clear();
+    for (size_t k=0;  k<positions.size();  k++) {
+        const glm::vec3 p = positions[k]/float(std::max(counts[k], 1));
+        const float len = glm::length(normals[k]);
+        const glm::vec3 n = len > 0.0f ? normals[k]/len : normals[k];
+        vertices.push_back(p.x);  vertices.push_back(p.y);  vertices.push_back(p.z);
+        vertices.push_back(n.x);  vertices.push_back(n.y);  vertices.push_back(n.z); }
+    return indices.size()/3 <= size_t(clusterTriangles) && positions.size() <= 65535;
+}
+
+// Grids the triangles order[first, end) over minP..maxP, coarsening
+// the grid until the result fits a cluster.  Returns the cell diagonal.
+float ClusterBuilder::Simplify(const size_t first, const size_t end, const glm::vec3& minP, const glm::vec3& maxP,
+                               std::vector<float>& vertices, std::vector<unsigned short>& indices)
+{
+    const glm::vec3 extent = maxP - minP;
+    const float longest = std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-20f));
+    int resolution = 64;
+    while (!Grid(first, end, minP, longest/resolution, resolution, vertices, indices) && resolution > 1)
+        resolution /= 2;
+
+    // A grid coarse enough to fit can collapse every triangle, leaving
+    // a stand-in that draws nothing.  Then refine it until some survive,
+    // over budget if need be, as long as the vertices fit 16 bit indices.
+    // Failing that (tiny triangles far apart), one original triangle
+    // stands in, as crudely as the coarsest grid.
+    while (indices.empty() && resolution < (1 << 20)) {
+        resolution *= 2;
+        if (!Grid(first, end, minP, longest/resolution, resolution, vertices, indices)
+            && vertices.size()/6 > 65535)
+            break; }
+    if (indices.empty() || vertices.size()/6 > 65535) {
+        const glm::ivec3& tri = mesh.Tri[order[first]];
+        vertices.clear();
+        indices.clear();
+        for (int c=0;  c<3;  c++) {
+            const glm::vec3 p = mesh.Pnt[tri[c]].xyz();
+            const glm::vec3 n = mesh.Nrm.empty() ? glm::vec3(0.0f) : mesh.Nrm[tri[c]];
+            vertices.push_back(p.x);  vertices.push_back(p.y);  vertices.push_back(p.z);
+            vertices.push_back(n.x);  vertices.push_back(n.y);  vertices.push_back(n.z);
+            indices.push_back(c); }
+        resolution = 1; }
+    return longest/resolution*sqrtf(3.0f);
+}
+
+int ClusterBuilder::Build(const size_t first, const size_t end)
+{
+    const int id = nodes.size();
+    nodes.push_back(ClusterNode());
+
+    glm::vec3 minP(FLT_MAX), maxP(-FLT_MAX), minC(FLT_MAX), maxC(-FLT_MAX);
+    for (size_t i=first;  i<end;  i++) {
+        const glm::ivec3& tri = mesh.Tri[order[i]];
+        for (int c=0;  c<3;  c++) {
+            minP = glm::min(minP, mesh.Pnt[tri[c]].xyz());
+            maxP = glm::max(maxP, mesh.Pnt[tri[c]].xyz()); }
+        minC = glm::min(minC, centroids[order[i]]);
+        maxC = glm::max(maxC, centroids[order[i]]); }
+
+    ClusterNode node;
+    for (int c=0;  c<3;  c++) {
+        node.minP[c] = minP[c];
+        node.maxP[c] = maxP[c]; }
+    std::vector<float> vertices;
+    std::vector<unsigned short> indices;
+
+    if (end - first <= size_t(clusterTriangles)) {
+        // A leaf: the triangles themselves, with local indices
+        std::unordered_map<int, int> local;
+        for (size_t i=first;  i<end;  i++)
+            for (int c=0;  c<3;  c++) {
+                const int v = mesh.Tri[order[i]][c];
+                std::unordered_map<int, int>::iterator it = local.find(v);
+                if (it == local.end()) {
+                    it = local.insert(std::make_pair(v, int(vertices.size()/6))).first;
+                    const glm::vec3 p = mesh.Pnt[v].xyz();
+                    const glm::vec3 n = mesh.Nrm.empty() ? glm::vec3(0.0f) : mesh.Nrm[v];
+                    vertices.push_back(p.x);  vertices.push_back(p.y);  vertices.push_back(p.z);
+                    vertices.push_back(n.x);  vertices.push_back(n.y);  vertices.push_back(n.z); }
+                indices.push_back(it->second); }
+        node.error = 0.0f;
+        node.children[0] = node.children[1] = -1;
+        processed += end - first; }
+    else {
+        const glm::vec3 spread = maxC - minC;
+        const int axis = spread.x >= spread.y && spread.x >= spread.z ? 0 : spread.y >= spread.z ? 1 : 2;
+        const size_t mid = (first + end)/2;
+        std::nth_element(order.begin() + first, order.begin() + mid, order.begin() + end,
+                         [&](int a, int b) { return centroids[a][axis] < centroids[b][axis]; });
+        node.children[0] = Build(first, mid);
+        node.children[1] = Build(mid, end);
+        // Never finer than what it stands in for
+        node.error = std::max(Simplify(first, end, minP, maxP, vertices, indices),
+                              std::max(nodes[node.children[0]].error, nodes[node.children[1]].error));
+        processed += end - first; }
+    if (progress)
+        *progress = std::min(float(processed)/float(work), 1.0f);
+
+    WritePage(node, vertices, indices);
+    nodes[id] = node;
+    return id;
+}
+
+bool BuildClusterFile(const char* plyName, const char* clusterName, const int clusterTriangles,
+                      std::atomic<float>* progress)
+{
+    Shape mesh;
+    if (!ReadPly(plyName, &mesh) || mesh.Tri.empty()) {
+        printf("BuildClusterFile: cannot read %s\n", plyName);
+        return false; }
+    if (mesh.Nrm.empty())
+        mesh.ComputeNRM();
+
+    FILE* file = fopen(clusterName, "wb");
+    if (!file) {
+        printf("BuildClusterFile: cannot write %s\n", clusterName);
+        return false; }
+
+    // Pages first, then the node table, then the header goes back in.
+    ClusterFileHeader header;
+    memset(&header, 0, sizeof(header));
+    fwrite(&header, sizeof(header), 1, file);
+    ClusterBuilder builder(mesh, file, std::min(clusterTriangles, 65535/3), progress);
+    builder.Build(0, mesh.Tri.size());
+
+    memcpy(header.magic, clusterMagic, sizeof(clusterMagic));
+    header.nodeCount = builder.nodes.size();
+    header.maxVertices = builder.maxVertices;
+    header.maxIndices = builder.maxIndices;
+    header.nodeTable = builder.offset;
+    fwrite(&builder.nodes[0], sizeof(ClusterNode), builder.nodes.size(), file);
+    fseek(file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, file);
+    const bool ok = ferror(file) == 0;
+    fclose(file);
+    printf("BuildClusterFile: %s, %d triangles in %d nodes\n", clusterName, (int)mesh.Tri.size(), header.nodeCount);
+    if (!ok) remove(clusterName);
+    return ok;
+}
+
+ClusterCook::ClusterCook(const char* _plyName, const char* _clusterName, const int clusterTriangles)
+    : plyName(_plyName), clusterName(_clusterName), progress(0.0f), done(false)
+{
+    worker = std::thread([this, clusterTriangles]() {
+        BuildClusterFile(plyName.c_str(), clusterName.c_str(), clusterTriangles, &progress);
+        done = true; });
+}
+
+ClusterCook::~ClusterCook()
+{
+    worker.join();
+}
+
+////////////////////////////////////////////////////////////////////////
+// Streaming
+
+StreamedMesh::StreamedMesh(const char* clusterName, const int slotCount, const int ioThreads)
+    : loaded(false), errorThreshold(1.0f), uploadBudget(8),
+      nodeCount(0), residentNodes(0), drawnNodes(0), drawnTriangles(0), pendingLoads(0), evictions(0),
+      failedNodes(0),
+      fileName(clusterName), maxVertices(0), maxIndices(0), frame(0),
+      vaoID(0), vertexBuffer(0), indexBuffer(0),
+      uniformProgram(NULL), instancedUniform(-1), modelTrUniform(-1), normalTrUniform(-1), stopping(false)
+{
+    FILE* f = fopen(clusterName, "rb");
+    if (!f) return;
+    ClusterFileHeader header;
+    if (fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, clusterMagic, sizeof(clusterMagic)) != 0
+        || header.nodeCount == 0) {
+        fclose(f);
+        return; }
+    nodes.resize(header.nodeCount);
+    fseek64(f, header.nodeTable, SEEK_SET);
+    const bool read = fread(&nodes[0], sizeof(ClusterNode), nodes.size(), f) == nodes.size();
+    if (!read) {
+        fclose(f);
+        return; }
+    maxVertices = header.maxVertices;
+    maxIndices = header.maxIndices;
+    nodeCount = nodes.size();
+    slotOf.assign(nodes.size(), -1);
+    requested.assign(nodes.size(), 0);
+    failed.assign(nodes.size(), 0);
+    lastUsed.assign(nodes.size(), -1);
+    slotNode.assign(std::max(slotCount, 2), -1);
+
+    // One fixed allocation for all slots
+    glGenVertexArrays(1, &vaoID);
+    glGenBuffers(1, &vertexBuffer);
+    glGenBuffers(1, &indexBuffer);
+    glBindVertexArray(vaoID);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, size_t(slotNode.size())*maxVertices*pageVertexSize, NULL, GL_DYNAMIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, pageVertexSize, 0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, pageVertexSize, (void*)(3*sizeof(float)));
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, size_t(slotNode.size())*maxIndices*sizeof(unsigned short), NULL, GL_DYNAMIC_DRAW);
+    glBindVertexArray(0);
+    CHECKERROR;
+
+    // The root is always resident, so there is always something to draw.
+    Page root;
+    root.node = 0;
+    if (!ReadPage(f, 0, root.data)) {
+        fclose(f);
+        return; }
+    fclose(f);
+    Upload(root);
+    loaded = true;
+
+    for (int t=0;  t<ioThreads;  t++)
+        workers.push_back(std::thread(&StreamedMesh::Worker, this));
+}
+
+StreamedMesh::~StreamedMesh()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true; }
+    wake.notify_all();
+    for (size_t t=0;  t<workers.size();  t++)
+        workers[t].join();
+    if (vaoID) {
+        glDeleteVertexArrays(1, &vaoID);
+        glDeleteBuffers(1, &vertexBuffer);
+        glDeleteBuffers(1, &indexBuffer); }
+}
+
+bool StreamedMesh::ReadPage(FILE* f, const int node, std::vector<unsigned char>& data)
+{
+    data.resize(PageSize(nodes[node]));
+    if (data.empty()) return true;
+    return fseek64(f, nodes[node].offset, SEEK_SET) == 0 && fread(&data[0], 1, data.size(), f) == data.size();
+}
+
+// Each I/O thread reads the most urgent requested page, with its own
+// file handle.
+void StreamedMesh::Worker()
+{
+    FILE* f = fopen(fileName.c_str(), "rb");
+    while (true) {
+        Page page;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [this]() { return stopping || !requests.empty(); });
+            if (stopping) break;
+            page.node = requests.top().node;
+            requests.pop(); }
+        if (!f || !ReadPage(f, page.node, page.data))
+            page.data.clear();
+        std::lock_guard<std::mutex> guard(lock);
+        finished.push_back(page); }
+    if (f) fclose(f);
+}
+
+// Into a free slot, or the least recently used one that was not
+// needed this frame or the last.  The root's slot is never reused.  A
+// page that could not be read marks its node failed, for good.
+void StreamedMesh::Upload(const Page& page)
+{
+    const ClusterNode& node = nodes[page.node];
+    if (page.data.size() != PageSize(node)) {
+        printf("StreamedMesh: cannot read node %d of %s\n", page.node, fileName.c_str());
+        failed[page.node] = 1;
+        failedNodes++;
+        return; }
+
+    int slot = -1, oldest = frame - 1;
+    for (size_t s=0;  s<slotNode.size() && slot < 0;  s++)
+        if (slotNode[s] < 0) slot = s;
+    for (size_t s=0;  s<slotNode.size() && slot < 0;  s++)
+        if (slotNode[s] > 0 && lastUsed[slotNode[s]] < oldest) {
+            oldest = lastUsed[slotNode[s]];
+            slot = s; }
+    if (slot < 0) return;
+    if (slotNode[slot] >= 0) {
+        slotOf[slotNode[slot]] = -1;
+        evictions++; }
+    slotNode[slot] = page.node;
+    slotOf[page.node] = slot;
+
+    const size_t vertexBytes = size_t(node.vertexCount)*pageVertexSize;
+    if (node.vertexCount > 0) {
+        glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+        glBufferSubData(GL_ARRAY_BUFFER, size_t(slot)*maxVertices*pageVertexSize, vertexBytes, &page.data[0]);
+        glBindBuffer(GL_ARRAY_BUFFER, 0); }
+    if (node.indexCount > 0) {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, indexBuffer);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, size_t(slot)*maxIndices*sizeof(unsigned short),
+                        size_t(node.indexCount)*sizeof(unsigned short), &page.data[vertexBytes]);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0); }
+}
+
+// Draws n if its error is small enough or it has no children, else
+// its children once they are all resident, which a failed child never
+// is.  n itself is resident.
+void StreamedMesh::Select(const int n, const glm::mat4& ModelTr, const glm::vec4* planes, const glm::vec3& eye,
+                          const float scale, const float pixelsPerUnit, std::vector<Request>& wanted)
+{
+    const ClusterNode& node = nodes[n];
+    for (int p=0;  p<6;  p++) {
+        const glm::vec4& pl = planes[p];
+        const float d = pl.x*(pl.x >= 0.0f ? node.maxP[0] : node.minP[0])
+            + pl.y*(pl.y >= 0.0f ? node.maxP[1] : node.minP[1])
+            + pl.z*(pl.z >= 0.0f ? node.maxP[2] : node.minP[2]) + pl.w;
+        if (d < 0.0f) return; }
+    lastUsed[n] = frame;
+
+    // Error in pixels at the box's nearest possible distance
+    const glm::vec3 lo(node.minP[0], node.minP[1], node.minP[2]), hi(node.maxP[0], node.maxP[1], node.maxP[2]);
+    const glm::vec3 center = (ModelTr*glm::vec4(0.5f*(lo + hi), 1.0f)).xyz();
+    const float radius = 0.5f*scale*glm::length(hi - lo);
+    const float distance = std::max(glm::length(center - eye) - radius, 1e-3f);
+    const float pixels = node.error*scale/distance*pixelsPerUnit;
+
+    if (node.children[0] < 0 || pixels <= errorThreshold) {
+        selected.push_back(n);
+        return; }
+
+    bool ready = true;
+    for (int c=0;  c<2;  c++) {
+        const int child = node.children[c];
+        if (slotOf[child] >= 0) continue;
+        ready = false;
+        if (!requested[child] && !failed[child]) {
+            Request r = { pixels, child };
+            wanted.push_back(r);
+            requested[child] = 1; } }
+    if (!ready) {
+        selected.push_back(n);
+        return; }
+    for (int c=0;  c<2;  c++)
+        Select(node.children[c], ModelTr, planes, eye, scale, pixelsPerUnit, wanted);
+}
+
+void StreamedMesh::Update(const glm::mat4& ModelTr, const glm::mat4& viewProj, const glm::vec3& eye,
+                          const float pixelsPerUnit)
+{
+    if (!loaded) return;
+    frame++;
+    evictions = 0;
+
+    // Finished loads, most urgent first since that is the order they
+    // were read in
+    std::vector<Page> pages;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        const size_t count = std::min(finished.size(), size_t(uploadBudget));
+        pages.assign(finished.begin(), finished.begin() + count);
+        finished.erase(finished.begin(), finished.begin() + count); }
+    for (size_t i=0;  i<pages.size();  i++) {
+        Upload(pages[i]);
+        requested[pages[i].node] = 0; }
+
+    // Requests not yet taken by an I/O thread are dropped; Select asks
+    // again for those still needed, with this frame's priority, so
+    // nodes that left the view don't pile up in the queue.
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for ( ;  !requests.empty();  requests.pop())
+            requested[requests.top().node] = 0; }
+
+    // Frustum planes in the mesh's own space
+    const glm::mat4 T = glm::transpose(viewProj*ModelTr);
+    glm::vec4 planes[6];
+    for (int i=0;  i<3;  i++) {
+        planes[2*i] = T[3] + T[i];
+        planes[2*i+1] = T[3] - T[i]; }
+    const float scale = std::max(glm::length(glm::vec3(ModelTr[0])),
+                                 std::max(glm::length(glm::vec3(ModelTr[1])), glm::length(glm::vec3(ModelTr[2]))));
+
+    selected.clear();
+    std::vector<Request> wanted;
+    Select(0, ModelTr, planes, eye, scale, pixelsPerUnit, wanted);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for (size_t i=0;  i<wanted.size();  i++)
+            requests.push(wanted[i]);
+        pendingLoads = requests.size() + finished.size(); }
+    if (!wanted.empty()) wake.notify_all();
+
+    residentNodes = drawnTriangles = 0;
+    for (size_t s=0;  s<slotNode.size();  s++)
+        residentNodes += slotNode[s] >= 0;
+    drawnNodes = selected.size();
+    for (size_t i=0;  i<selected.size();  i++)
+        drawnTriangles += nodes[selected[i]].indexCount/3;
+}
+
+void StreamedMesh::Draw(ShaderProgram* program, const glm::mat4& ModelTr)
+{
+    if (!loaded || selected.empty()) return;
+
+    std::vector<GLsizei> counts;
+    std::vector<const void*> offsets;
+    std::vector<GLint> baseVertices;
+    for (size_t i=0;  i<selected.size();  i++) {
+        const int slot = slotOf[selected[i]];
+        counts.push_back(nodes[selected[i]].indexCount);
+        offsets.push_back((const void*)(size_t(slot)*maxIndices*sizeof(unsigned short)));
+        baseVertices.push_back(slot*maxVertices); }
+
+    if (program != uniformProgram) {
+        instancedUniform = program->Uniform("instanced");
+        modelTrUniform = program->Uniform("ModelTr");
+        normalTrUniform = program->Uniform("NormalTr");
+        uniformProgram = program; }
+    program->Set(instancedUniform, 0);
+    program->Set(modelTrUniform, ModelTr);
+    if (normalTrUniform >= 0)
+        program->Set(normalTrUniform, glm::inverse(ModelTr));
+
+    glBindVertexArray(vaoID);
+    SetPositionDecode(glm::vec3(0.0f), glm::vec3(1.0f));
+    glMultiDrawElementsBaseVertex(GL_TRIANGLES, &counts[0], GL_UNSIGNED_SHORT, &offsets[0],
+                                  counts.size(), &baseVertices[0]);
+    glBindVertexArray(0);
+    CHECKERROR;
+}
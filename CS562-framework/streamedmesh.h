@@ -0,0 +1,144 @@
+///////////////////////////////////////////////////////////////////////
+// Out-of-core rendering of scans too large for memory.
+//
+// BuildClusterFile is the offline step (run on a background thread by
+// a ClusterCook when the file is first wanted).  It splits a PLY mesh
+// recursively at the median triangle centroid along the longest axis,
+// into clusters of at most clusterTriangles triangles, and keeps the
+// splits as a binary bounds hierarchy.  Each interior node also gets a
+// coarse version of its whole subtree, made by clustering its vertices
+// on a grid, so it can stand in for its children from far away.  The
+// node's error is that grid's cell diagonal, in object space.  The
+// cluster file holds a header, one page per node (vertices as position
+// and normal floats, 16 bit local indices), then the node table.
+//
+// At run time a StreamedMesh keeps only the node table in memory.
+// Each frame, Update walks the hierarchy and picks the coarsest nodes
+// whose error projects to at most errorThreshold pixels, drawing a
+// resident parent wherever children are still on their way.  Missing
+// nodes are requested from background I/O threads, largest error
+// first.  The requests are renewed each frame, so those for nodes
+// that left the view are dropped.  A node whose page cannot be read
+// is marked failed and not requested again; its parent stands in for
+// it.  Loaded pages are uploaded into slots of one fixed-size
+// vertex and index buffer pair, evicting the least recently used
+// nodes.  GPU memory therefore stays at slotCount pages, however large
+// the mesh.  Draw submits all picked nodes in one
+// glMultiDrawElementsBaseVertex call.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _STREAMEDMESH
+#define _STREAMEDMESH
+
+#include <vector>
+#include <queue>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+class ShaderProgram;
+
+// The cluster file's node record
+struct ClusterNode
+{
+    float minP[3], maxP[3];
+    float error;                // Object space; 0 for leaves
+    int children[2];            // -1 for leaves
+    unsigned int vertexCount, indexCount;
+    unsigned long long offset;  // Of the node's page in the file
+};
+
+// progress, if given, climbs from 0 to 1 (roughly) as the file is built.
+bool BuildClusterFile(const char* plyName, const char* clusterName, const int clusterTriangles=4096,
+                      std::atomic<float>* progress=NULL);
+
+// BuildClusterFile on a background thread.  The destructor waits for it.
+class ClusterCook
+{
+public:
+    ClusterCook(const char* plyName, const char* clusterName, const int clusterTriangles=4096);
+    ~ClusterCook();
+
+    bool Done() const { return done; }
+    float Progress() const { return progress; }
+
+private:
+    std::string plyName, clusterName;
+    std::atomic<float> progress;
+    std::atomic<bool> done;
+    std::thread worker;
+};
+
+class StreamedMesh
+{
+public:
+    bool loaded;                // The cluster file opened
+    float errorThreshold;       // Pixels
+    int uploadBudget;           // Pages uploaded per Update
+
+    // Statistics from the most recent Update
+    int nodeCount, residentNodes, drawnNodes, drawnTriangles, pendingLoads, evictions;
+    int failedNodes;            // Since creation
+
+    StreamedMesh(const char* clusterName, const int slotCount=128, const int ioThreads=2);
+    ~StreamedMesh();
+
+    // Picks the nodes to draw for a camera at eye, with projection
+    // viewProj (WorldProj*WorldView) and pixelsPerUnit pixels per unit
+    // at distance 1, and the mesh at ModelTr.  Also uploads finished
+    // loads and requests new ones.
+    void Update(const glm::mat4& ModelTr, const glm::mat4& viewProj, const glm::vec3& eye,
+                const float pixelsPerUnit);
+
+    // Draws the picked nodes; the caller sets the material uniforms.
+    void Draw(ShaderProgram* program, const glm::mat4& ModelTr);
+
+private:
+    struct Page {
+        int node;
+        std::vector<unsigned char> data;
+    };
+    struct Request {
+        float priority;
+        int node;
+        bool operator<(const Request& r) const { return priority < r.priority; }
+    };
+
+    std::string fileName;
+    std::vector<ClusterNode> nodes;
+    unsigned int maxVertices, maxIndices;
+
+    // Per node: its slot (-1 if not resident), whether a load is
+    // outstanding, whether its page could not be read, and the last
+    // frame it was visited.
+    std::vector<int> slotOf;
+    std::vector<char> requested, failed;
+    std::vector<int> lastUsed;
+    std::vector<int> slotNode;  // Per slot: its node, or -1
+    int frame;
+
+    unsigned int vaoID, vertexBuffer, indexBuffer;
+    std::vector<int> selected;
+
+    // Uniform handles of the program last drawn with
+    ShaderProgram* uniformProgram;
+    int instancedUniform, modelTrUniform, normalTrUniform;
+
+    // Shared with the I/O threads
+    std::priority_queue<Request> requests;
+    std::vector<Page> finished;
+    std::mutex lock;
+    std::condition_variable wake;
+    bool stopping;
+    std::vector<std::thread> workers;
+
+    void Worker();
+    bool ReadPage(FILE* f, const int node, std::vector<unsigned char>& data);
+    void Upload(const Page& page);
+    void Select(const int n, const glm::mat4& ModelTr, const glm::vec4* planes, const glm::vec3& eye,
+                const float scale, const float pixelsPerUnit, std::vector<Request>& wanted);
+};
+
+#endif